@@ -13,8 +13,44 @@
 #include <mutex>
 #include <queue>
 #include <condition_variable>
+#include <map>
+#include <set>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cmath>
+#include <functional>
+#include <random>
+#include <deque>
+#include <limits>
+#include <csignal>
+#include <cstdio>
+#include <list>
+#include <string_view>
+#include <array>
+#include <ctime>
+#include <cstddef>
+#include <cerrno>
 #ifdef _WIN32
 #include <windows.h>
+#include <psapi.h>
+#include <intrin.h>
+#endif
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <sys/statvfs.h>
+#include <sys/vfs.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
 #endif
 
 namespace fs = std::filesystem;
@@ -32,6 +68,30 @@ static const std::vector<std::wstring> EXCLUDED_PATHS = {
     L"C:\\hiberfil.sys",
 };
 
+// T̐lioCgƂ̕Uj
+struct SubtreeEstimate {
+    double bytes = 0;
+    double variance = 0;
+    size_t samples = 0;
+};
+
+// XLŜ̒fviSIGINT / Ctrl+CA܂͒~̐Őݒj
+static std::atomic<bool> cancelRequested{ false };
+
+extern "C" void handleInterruptSignal(int) {
+    cancelRequested = true;
+}
+
+#ifdef _WIN32
+BOOL WINAPI handleConsoleControl(DWORD type) {
+    if (type == CTRL_C_EVENT || type == CTRL_BREAK_EVENT) {
+        cancelRequested = true;
+        return TRUE;
+    }
+    return FALSE;
+}
+#endif
+
 // ʊi[p\
 struct PathSizeInfo {
     fs::path path;
@@ -39,25 +99,46 @@ struct PathSizeInfo {
     bool calculated;
     bool isPartial;
     std::chrono::milliseconds elapsed;
+    bool isEstimated;   // TW{O}ꍇ
+    double estimate;    // Wvς + coCg
+    double margin;      // l95%MԂ̔
+    size_t id;          // ResultManager ̃^[Qbgԍ
+    double priority;    // vZ̖ڈi傫قǐɌvZj
+    std::uintmax_t staleBytes;  // size ̂ÕXibvVbg̒lgiߎj
 
     PathSizeInfo()
-        : path(), size(0), calculated(false), isPartial(false), elapsed(0) {}
+        : path(), size(0), calculated(false), isPartial(false), elapsed(0),
+          isEstimated(false), estimate(0), margin(0), id(0), priority(0), staleBytes(0) {}
 
     PathSizeInfo(const fs::path& p, std::uintmax_t s, bool c)
-        : path(p), size(s), calculated(c), isPartial(false), elapsed(0) {}
+        : path(p), size(s), calculated(c), isPartial(false), elapsed(0),
+          isEstimated(false), estimate(0), margin(0), id(0), priority(0), staleBytes(0) {}
+
+    // LOɎgTCYivZ͓r܂ł̍vj
+    double rankedSize() const {
+        return isEstimated ? estimate : static_cast<double>(size);
+    }
 };
 
 // ResultManagerNX
 class ResultManager {
 private:
     std::vector<PathSizeInfo> results;
+    std::deque<std::atomic<std::uintmax_t>> runningBytes;  // vZ̓ro߁i[J[bNȂŉZj
+    std::deque<std::atomic<std::uintmax_t>> staleBytes;    // ̂ÕXibvVbg̒lg
+    std::deque<std::atomic<std::uintmax_t>> allocatedBytes;  // ׂt@C̊蓖čς݃oCgigpʂ̏pj
+    std::deque<std::atomic<bool>> stopFlags;               // ^[QbgƂ̑ł؂v
+    std::vector<bool> outsideBound;                        // [gƕʂ̃t@CVXeigpʂ̏gȂj
     mutable std::mutex mutex;
     std::condition_variable cv;
     std::atomic<size_t> completedCount{ 0 };  // ̃JEgp
+    std::atomic<bool> rankingFinal{ false };  // N̏ʂm肵
+    std::atomic<size_t> prunedCount{ 0 };     // ʂɉeȂߑł؂^[Qbg
 
 public:
     void update(const fs::path& path, std::uintmax_t size, bool partial,
-                std::chrono::milliseconds elapsedTime) {
+                std::chrono::milliseconds elapsedTime,
+                const SubtreeEstimate* remaining = nullptr) {
         std::lock_guard<std::mutex> lock(mutex);
         auto it = std::find_if(results.begin(), results.end(),
                                [&path](const PathSizeInfo& info) { return info.path == path; });
@@ -66,6 +147,11 @@ public:
             it->calculated = true;
             it->isPartial = partial;
             it->elapsed = elapsedTime;
+            if (remaining && remaining->samples > 0) {
+                it->isEstimated = true;
+                it->estimate = static_cast<double>(size) + remaining->bytes;
+                it->margin = 1.96 * std::sqrt(remaining->variance);
+            }
             completedCount++;
         }
         cv.notify_all();
@@ -74,14 +160,169 @@ public:
     void addTarget(const fs::path& path) {
         std::lock_guard<std::mutex> lock(mutex);
         results.emplace_back(path, 0, false);
+        results.back().id = results.size() - 1;
+        runningBytes.emplace_back(0);
+        staleBytes.emplace_back(0);
+        allocatedBytes.emplace_back(0);
+        stopFlags.emplace_back(false);
+        outsideBound.push_back(false);
+    }
+
+    // [g̃t@CVXe̊Oɂ^[QbgBgpʂ̏̌vZɊ܂߂Ał؂Ȃ
+    void excludeFromUsageBound(size_t id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        outsideBound[id] = true;
+    }
+
+    // vZς݂̃^[QbgǉiXibvVbgJꍇj
+    void addCompletedTarget(const fs::path& path, std::uintmax_t size, bool partial) {
+        std::lock_guard<std::mutex> lock(mutex);
+        results.emplace_back(path, size, true);
+        results.back().id = results.size() - 1;
+        results.back().isPartial = partial;
+        runningBytes.emplace_back(size);
+        staleBytes.emplace_back(0);
+        allocatedBytes.emplace_back(0);
+        stopFlags.emplace_back(false);
+        outsideBound.push_back(false);
+        completedCount++;
+    }
+
+    const std::atomic<bool>& stopFlag(size_t id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stopFlags[id];
+    }
+
+    // t@CVXe̎gpʂ疢^[Qbg̏߁ANɓ蓾Ȃ
+    // ^[Qbgł؂Bugp - Wvς݂̊蓖āv͖Wṽt@C̊蓖Ă̏
+    // i蓖Ă st_blocks ŐAn[hN1񂾂BO̒lgt@C
+    // 蓖ĂȂ̂ŐAɂȂ鑤ɓ|jB̃TCY蓖Ă
+    // ̂̓Xp[Xt@CƁAWvς݂̃t@Cւ̃n[hN
+    bool applyUsageBound(std::uintmax_t usedBytes, size_t n) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (rankingFinal || results.empty() || n == 0) {
+            return rankingFinal;
+        }
+
+        size_t count = results.size();
+        std::vector<std::uintmax_t> lower(count), upper(count);
+        std::uintmax_t counted = 0;
+        for (size_t i = 0; i < count; ++i) {
+            lower[i] = results[i].calculated
+                ? results[i].size : runningBytes[i].load(std::memory_order_relaxed);
+            if (!outsideBound[i]) {
+                counted += allocatedBytes[i].load(std::memory_order_relaxed);
+            }
+        }
+        std::uintmax_t residual = usedBytes > counted ? usedBytes - counted : 0;
+        for (size_t i = 0; i < count; ++i) {
+            bool exact = results[i].calculated && !results[i].isPartial;
+            upper[i] = exact ? lower[i] :
+                outsideBound[i] ? std::numeric_limits<std::uintmax_t>::max() : lower[i] + residual;
+        }
+
+        std::vector<size_t> order(count);
+        for (size_t i = 0; i < count; ++i) {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(),
+                  [&lower](size_t a, size_t b) { return lower[a] > lower[b]; });
+        size_t top = std::min(n, count);
+
+        // N̊O: Nʂ̉ɓ͂Ȃ̂͑ł؂
+        bool final = true;
+        if (count > n) {
+            std::uintmax_t threshold = lower[order[n - 1]];
+            for (size_t k = n; k < count; ++k) {
+                size_t j = order[k];
+                if (upper[j] > threshold) {
+                    final = false;
+                } else if (!results[j].calculated && !stopFlags[j]) {
+                    stopFlags[j] = true;
+                    prunedCount++;
+                }
+            }
+        }
+
+        // N̓: ʑ̉ʑ̏ȏȂ珇ʂ͓ւȂ
+        std::uintmax_t minLower = std::numeric_limits<std::uintmax_t>::max();
+        for (size_t k = 0; final && k + 1 < top; ++k) {
+            minLower = std::min(minLower, lower[order[k]]);
+            for (size_t m = k + 1; m < top; ++m) {
+                if (upper[order[m]] > minLower) {
+                    final = false;
+                    break;
+                }
+            }
+        }
+
+        if (final) {
+            rankingFinal = true;
+            for (size_t i = 0; i < count; ++i) {
+                if (!results[i].calculated) {
+                    stopFlags[i] = true;
+                }
+            }
+        }
+        return final;
+    }
+
+    bool isRankingFinal() const {
+        return rankingFinal;
+    }
+
+    size_t prunedTargets() const {
+        return prunedCount;
+    }
+
+    // [J[ro߂ZJE^i^[Qbgǉ̓AhXςȂj
+    std::atomic<std::uintmax_t>& progressCounter(size_t id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return runningBytes[id];
+    }
+
+    std::atomic<std::uintmax_t>& staleCounter(size_t id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return staleBytes[id];
+    }
+
+    std::atomic<std::uintmax_t>& allocationCounter(size_t id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return allocatedBytes[id];
+    }
+
+    // ׂt@C̊蓖čς݃oCg̍v
+    std::uintmax_t allocatedCountedBytes() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::uintmax_t total = 0;
+        for (const auto& bytes : allocatedBytes) {
+            total += bytes.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    void setPriority(size_t id, double priority) {
+        std::lock_guard<std::mutex> lock(mutex);
+        results[id].priority = priority;
+    }
+
+    double priorityOf(size_t id) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return results[id].priority;
     }
 
     std::vector<PathSizeInfo> getTopN(size_t n) const {
         std::lock_guard<std::mutex> lock(mutex);
         std::vector<PathSizeInfo> sorted = results;
+        for (auto& info : sorted) {
+            if (!info.calculated) {
+                info.size = runningBytes[info.id].load(std::memory_order_relaxed);
+            }
+            info.staleBytes = staleBytes[info.id].load(std::memory_order_relaxed);
+        }
         std::sort(sorted.begin(), sorted.end(),
                   [](const PathSizeInfo& a, const PathSizeInfo& b) {
-                      return a.size > b.size;
+                      return a.rankedSize() > b.rankedSize();
                   });
         if (sorted.size() > n) {
             sorted.resize(n);
@@ -103,6 +344,29 @@ public:
     size_t completedTargets() const {
         return completedCount;
     }
+
+    // f: ̃^[Qbgr܂ł̍vŊm肵AʂƂĈt
+    void finalizeIncomplete() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& info : results) {
+            if (!info.calculated) {
+                info.size = runningBytes[info.id].load(std::memory_order_relaxed);
+                info.calculated = true;
+                info.isPartial = true;
+            }
+        }
+    }
+
+    // Wvς݂̃oCgi + vZ̓ro߁j
+    std::uintmax_t countedBytes() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::uintmax_t total = 0;
+        for (const auto& info : results) {
+            total += info.calculated
+                ? info.size : runningBytes[info.id].load(std::memory_order_relaxed);
+        }
+        return total;
+    }
 };
 
 // [eBeB֐
@@ -111,229 +375,8073 @@ double toGB(std::uintmax_t bytes) {
     return static_cast<double>(bytes) / GB;
 }
 
-// WvPʂ̔p֐
-bool isTargetUnit(const fs::path& path, int depth) {
-    try {
-        // pX̂ǂɃV{bNNꍇ͏O
-        fs::path current;
-        for (const auto& part : path) {
-            current /= part;
-            if (fs::is_symlink(current)) {
-                return false;
-            }
-        }
+// ؂̔z傫ȃy[Wɒu@
+enum class HugePageMode {
+    Off,          // ʏ̃y[W
+    Transparent,  // ߓIȑ傫ȃy[W madvise ŋ߂iLinuxAj
+    Explicit,     // \񂳂ꂽ傫ȃy[WiMAP_HUGETLBAWindows ̃[Wy[WjɎ
+};
 
-        // pX̊KwJEg
-        int pathDepth = 0;
-        for (const auto& _ : path.relative_path()) {
-            pathDepth++;
-        }
+// sIvV
+struct ScanOptions {
+#ifdef _WIN32
+    std::vector<fs::path> roots{ L"C:\\" };  // 郋[gi--root Œuj
+#else
+    std::vector<fs::path> roots{ "/" };
+#endif
+    bool rootsGiven = false;
+    bool polite = false;          // ᕉ׃[h
+    double politeOpsPerSec = 2000; // foCX̃^f[^쐔ibj
+    double busyThreshold = 0.5;   // ̎gp𒴂obNIt
+    size_t workers = 0;           // [J[i0 ͎j
+    double timeBudget = 0;        // XLŜ̎ԗ\ZibA0 ͖j
+    double estimateOnly = 0;      // _v[û݂Ő肷鎞ԁibA0 ͒ʏXLj
+    bool largestFirst = true;     // 傫ȃ^[QbgvZ
+    bool earlyExit = false;       // gpʂ̏ŏʂm肵ł؂
+    std::uintmax_t maxBytes = 0;  // Wvς݂̃oCgɒB璆fi0 ͖j
+    std::chrono::steady_clock::duration operationTimeout = std::chrono::seconds(30);       // ^f[^1̏
+    std::chrono::steady_clock::duration networkOperationTimeout = std::chrono::seconds(5); // lbg[N}Egł̏
+    std::vector<std::string> excludeRules;  // --exclude Ŏw肳ꂽO[
+    std::vector<fs::path> excludeFiles;     // --exclude-from Ŏw肳ꂽ[t@C
+    double hotspotFraction = 0;             // Ŝɑ΂邱̊ȏ̃fBNg
+    std::uintmax_t hotspotBytes = 0;        // oCgŎwiǂ 0 Ȃ疳j
+    fs::path savePath;                      // ʂXibvVbgƂĕۑ
+    fs::path openPath;                      // ɃXibvVbgJĕ\
+    bool freeze = false;                    // ؂ǂݍݐp̊ȌȌ`ɋl߁A̖؂Ɣׂ
+    fs::path diffOld;                       // 2̃XibvVbg̍\
+    fs::path diffNew;
+    fs::path mergePath;                     // ̃XibvVbgĕۑ
+    std::vector<std::string> mergeInputs;   // ́i"file"  "label=file"j
+    fs::path sincePath;                     // ÕXibvVbgςfBNgǂ
+    bool trustUnchanged = false;            // ςĂȂfBNg̃t@C stat Ȃ
+    double approximatePercent = 0;          // O̍vɑ΂Ă̊̕؂ɂ͍~Ȃi0 ͖j
+    std::int64_t memoryBudget = 0;          // ؂Ɏg̏ioCgA0 ͖j
+    HugePageMode hugePages = HugePageMode::Transparent;  // ؂̔zuy[W
+    bool hugePageReport = false;            // --huge-pages w肵WvƖ₢킹̎Ԃ𑪂Ď
+    fs::path checkpointPath;                // ro߂ۑA͂ĊJ
+    double checkpointInterval = 60;         // `FbN|Cg̊Ԋuibj
+    fs::path historyPath;                   // XLƂɃfBNgTCY̗ǋL
+    std::uintmax_t historyMinBytes = 1024ULL * 1024 * 1024;  // ɎcfBNg̍ŏTCY
+    fs::path trendPath;                     // 瑝߂fBNg
+    double forecastPercent = 0;             // gp̒lɒB\i0 ͖j
+    double trendDays = 30;                  // ߂ԁij
+};
 
-        // w肳ꂽ[ƈvꍇA܂
-        // t@C݂Ő[̊Kw̏ꍇɏWvPʂƂ
-        return pathDepth == depth ||
-            (pathDepth < depth && fs::is_regular_file(path));
-    } catch (...) {
-        return false;
+// œǂݔ΂Gg̕
+enum class ErrorCategory {
+    Permission,  // Ȃ
+    Vanished,    // 񋓂 stat ̊Ԃɏ
+    Io,          // o̓G[
+    Loop,        // V{bNÑ[v
+    Timeout,     // Ȃł؂
+    Other,
+    Count
+};
+
+const char* errorCategoryName(ErrorCategory category) {
+    switch (category) {
+    case ErrorCategory::Permission: return "permission denied";
+    case ErrorCategory::Vanished:   return "vanished";
+    case ErrorCategory::Io:         return "I/O error";
+    case ErrorCategory::Loop:       return "symlink loop";
+    case ErrorCategory::Timeout:    return "timed out";
+    default:                        return "other";
     }
 }
 
-bool isExcludedPath(const fs::path& p) {
-    try {
-        std::wstring pathW = p.lexically_normal().wstring();
-        std::transform(pathW.begin(), pathW.end(), pathW.begin(), ::towlower);
-        for (const auto& ex : EXCLUDED_PATHS) {
-            std::wstring exW = ex;
-            std::transform(exW.begin(), exW.end(), exW.begin(), ::towlower);
-            if (pathW.rfind(exW, 0) == 0) {
-                return true;
-            }
-        }
-    } catch (...) {
-        return true;
+ErrorCategory classifyError(const std::error_code& ec) {
+    if (ec == std::errc::permission_denied || ec == std::errc::operation_not_permitted) {
+        return ErrorCategory::Permission;
     }
-    return false;
+    if (ec == std::errc::no_such_file_or_directory || ec == std::errc::not_a_directory) {
+        return ErrorCategory::Vanished;
+    }
+    if (ec == std::errc::too_many_symbolic_link_levels) {
+        return ErrorCategory::Loop;
+    }
+    if (ec == std::errc::io_error) {
+        return ErrorCategory::Io;
+    }
+    if (ec == std::errc::timed_out) {
+        return ErrorCategory::Timeout;
+    }
+    return ErrorCategory::Other;
 }
 
-// fBNgTCYvZ֐iċAj
-std::pair<std::uintmax_t, bool> calculateDirectorySizeWithTimeout(
-    const fs::path& dir,
-    const std::chrono::steady_clock::time_point& startTime,
-    const ResultManager& manager
-) {
-    std::uintmax_t total = 0;
-    const auto timeLimit = std::chrono::minutes(1);
-    bool isPartial = false;
-
-    try {
-        for (const auto& entry : fs::directory_iterator(dir)) {
-            // V{bNNXLbv
-            if (fs::is_symlink(entry)) {
-                continue;
-            }
+// XLvi[J[̓bNȂŉZj
+struct ScanStats {
+    static const size_t CATEGORY_COUNT = static_cast<size_t>(ErrorCategory::Count);
+    static const size_t MAX_ERROR_SAMPLES = 10;
 
-            // Ԑ`FbN
-            auto elapsed = std::chrono::steady_clock::now() - startTime;
-            if (elapsed >= timeLimit) {
-                auto currentTop = manager.getTopN(1);
-                if (manager.completedTargets() == manager.totalTargets() - 1 &&
-                    (currentTop.empty() || total > currentTop[0].size)) {
-                    isPartial = true;
-                    break;
-                }
-            }
+    std::atomic<std::uint64_t> entries{ 0 };
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    std::atomic<std::uint64_t> errors[CATEGORY_COUNT] = {};
+    std::mutex sampleMutex;
+    std::vector<fs::path> errorSamples[CATEGORY_COUNT];  // ނƂɐ擪̐c
+    // ÕXibvVbgƂ̍őꍇ̓
+    std::atomic<std::uint64_t> reusedDirectories{ 0 };  // ςĂ炸ꗗǂ܂Ȃ
+    std::atomic<std::uint64_t> rereadDirectories{ 0 };
+    std::atomic<std::uint64_t> reusedFiles{ 0 };        // ꗗO񂩂pt@C
+    std::atomic<std::uint64_t> reusedBytes{ 0 };
+    // ߎō~Ȃ
+    std::atomic<std::uint64_t> prunedSubtrees{ 0 };
+    std::atomic<std::uint64_t> prunedNodes{ 0 };       // ؂Ɋ܂܂ĂXibvVbg̃m[h
+    std::atomic<std::uint64_t> staleBytes{ 0 };
 
-            try {
-                if (fs::is_directory(entry)) {
-                    auto [size, partial] = calculateDirectorySizeWithTimeout(entry, startTime, manager);
-                    total += size;
-                    isPartial |= partial;
-                } else if (fs::is_regular_file(entry)) {
-                    total += fs::file_size(entry);
-                }
-            } catch (...) {}
+    void recordError(ErrorCategory category, const fs::path& p) {
+        size_t index = static_cast<size_t>(category);
+        // 𒴂烍bNȂ
+        if (errors[index].fetch_add(1, std::memory_order_relaxed) < MAX_ERROR_SAMPLES) {
+            std::lock_guard<std::mutex> lock(sampleMutex);
+            errorSamples[index].push_back(p);
         }
-    } catch (...) {}
+    }
+
+    void recordError(const std::error_code& ec, const fs::path& p) {
+        recordError(classifyError(ec), p);
+    }
+
+    std::uint64_t errorCount(ErrorCategory category) const {
+        return errors[static_cast<size_t>(category)].load(std::memory_order_relaxed);
+    }
+
+    std::vector<fs::path> errorPaths(ErrorCategory category) {
+        std::lock_guard<std::mutex> lock(sampleMutex);
+        return errorSamples[static_cast<size_t>(category)];
+    }
+
+    double entriesPerSecond() const {
+        double sec = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - startTime).count();
+        return sec > 0 ? static_cast<double>(entries.load()) / sec : 0.0;
+    }
+};
 
-    return { total, isPartial };
+// pXfoCX̎ʎq
+std::uint64_t deviceIdOf(const fs::path& p) {
+#ifdef __linux__
+    struct stat st;
+    if (::stat(p.c_str(), &st) == 0) {
+        return static_cast<std::uint64_t>(st.st_dev);
+    }
+    return 0;
+#else
+    return std::hash<std::wstring>{}(p.root_name().wstring());
+#endif
 }
 
-// WvΏۃpXW֐
-void collectTargetPaths(const fs::path& root, int currentDepth, int maxDepth,
-                        ResultManager& manager) {
-    try {
-        // OpXƐ[݂̐̂`FbN
-        if (isExcludedPath(root) || currentDepth > maxDepth) {
-            return;
-        }
+// fBNg̓ꐫiLinux  st_dev  st_inoAWindows ̓{[̃VAԍƃt@CԍjB
+// q̃[goCh}EgApX̕\Lɂ炸̂Ɏg
+struct FileIdentity {
+    std::uint64_t device = 0;
+    std::uint64_t index = 0;
 
-        // WvPʂ̔iV{bNÑ`FbN܂ށj
-        if (isTargetUnit(root, maxDepth)) {
-            manager.addTarget(root);
-        }
+    bool operator==(const FileIdentity& other) const {
+        return device == other.device && index == other.index;
+    }
+};
 
-        // fBNg̏ꍇ͍ċA
-        if (fs::is_directory(root) && currentDepth < maxDepth) {
-            for (const auto& entry : fs::directory_iterator(root)) {
-                collectTargetPaths(entry.path(), currentDepth + 1, maxDepth, manager);
-            }
+bool fileIdentityOf(const fs::path& p, FileIdentity& identity) {
+#ifdef _WIN32
+    HANDLE handle = CreateFileW(p.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    BY_HANDLE_FILE_INFORMATION info;
+    bool ok = GetFileInformationByHandle(handle, &info) != 0;
+    CloseHandle(handle);
+    if (ok) {
+        identity.device = info.dwVolumeSerialNumber;
+        identity.index = (static_cast<std::uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+    }
+    return ok;
+#elif defined(__linux__)
+    struct stat st;
+    if (::stat(p.c_str(), &st) != 0) {
+        return false;
+    }
+    identity.device = static_cast<std::uint64_t>(st.st_dev);
+    identity.index = static_cast<std::uint64_t>(st.st_ino);
+    return true;
+#else
+    (void)p;
+    (void)identity;
+    return false;
+#endif
+}
+
+#ifdef __linux__
+bool fileIdentityOf(int fd, FileIdentity& identity) {
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        return false;
+    }
+    identity.device = static_cast<std::uint64_t>(st.st_dev);
+    identity.index = static_cast<std::uint64_t>(st.st_ino);
+    return true;
+}
+#endif
+
+// ƃt@C{lǂݏłVt@CƂčB̃t@CV{bN
+// N͊JAOgĂΗ̐ڔtč蒼BpXԂis͋j
+fs::path createPrivateFile(const fs::path& base) {
+    const int ATTEMPTS = 16;
+    std::mt19937_64 rng(std::random_device{}());
+    for (int attempt = 0; attempt < ATTEMPTS; ++attempt) {
+        fs::path path = base;
+        if (attempt > 0) {
+            std::ostringstream suffix;
+            suffix << "." << std::hex << (rng() & 0xFFFFFFFFFFull);
+            path += suffix.str();
         }
-    } catch (...) {}
+#ifdef _WIN32
+        HANDLE handle = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_NEW,
+                                    FILE_ATTRIBUTE_TEMPORARY, nullptr);
+        if (handle != INVALID_HANDLE_VALUE) {
+            CloseHandle(handle);
+            return path;
+        }
+        if (GetLastError() != ERROR_FILE_EXISTS) {
+            return fs::path();
+        }
+#elif defined(__linux__)
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+        if (fd >= 0) {
+            ::close(fd);
+            return path;
+        }
+        if (errno != EEXIST) {
+            return fs::path();
+        }
+#else
+        return fs::path();
+#endif
+    }
+    return fs::path();
 }
 
-// J[\p̊֐ǉ
-void moveCursorToTop() {
-    std::cout << "\033[H"; // J[\ʂ̐擪Ɉړ
+// ̃[gfBNgidvhj
+bool isOtherRoot(const std::vector<FileIdentity>* otherRoots, const FileIdentity& identity) {
+    return otherRoots &&
+        std::find(otherRoots->begin(), otherRoots->end(), identity) != otherRoots->end();
 }
 
-void clearToEndOfLine() {
-    std::cout << "\033[K"; // J[\s܂ŃNA
+bool isOtherRoot(const std::vector<FileIdentity>* otherRoots, const fs::path& dir) {
+    FileIdentity identity;
+    return otherRoots && !otherRoots->empty() && fileIdentityOf(dir, identity) &&
+        isOtherRoot(otherRoots, identity);
 }
 
-// ʕ\֐C
-void displayResults(const ResultManager& manager, size_t limit) {
-    moveCursorToTop();
+// {[̎gpʁistatvfs / GetDiskFreeSpaceExj
+struct VolumeUsage {
+    std::uintmax_t usedBytes = 0;
+    std::uintmax_t usedInodes = 0;  // 擾łȂł 0
+    std::uintmax_t totalBytes = 0;  // e
+    bool valid = false;
+};
 
-    // i\
-    size_t completed = manager.completedTargets();
-    size_t total = manager.totalTargets();
-    std::cout << "Progress: " << completed << "/" << total
-        << " (" << (total > 0 ? (completed * 100 / total) : 0) << "%)\n\n";
-    clearToEndOfLine();
+VolumeUsage queryVolumeUsage(const fs::path& p) {
+    VolumeUsage usage;
+#ifdef _WIN32
+    ULARGE_INTEGER available, total, free;
+    if (GetDiskFreeSpaceExW(p.root_path().c_str(), &available, &total, &free)) {
+        usage.usedBytes = total.QuadPart - free.QuadPart;
+        usage.totalBytes = total.QuadPart;
+        usage.valid = true;
+    }
+#elif defined(__linux__)
+    struct statvfs st;
+    if (::statvfs(p.c_str(), &st) == 0) {
+        usage.usedBytes = static_cast<std::uintmax_t>(st.f_blocks - st.f_bfree) * st.f_frsize;
+        usage.usedInodes = static_cast<std::uintmax_t>(st.f_files - st.f_ffree);
+        usage.totalBytes = static_cast<std::uintmax_t>(st.f_blocks) * st.f_frsize;
+        usage.valid = true;
+    }
+#else
+    (void)p;
+#endif
+    return usage;
+}
 
-    // LO\
-    std::cout << "=== Top " << limit << " Largest Files/Folders ===\n";
-    clearToEndOfLine();
+// gpʂɑ΂Wvς݃oCgEinode iƎc莞Ԃ߂
+// i[J[XVJE^\XbhǂނŁA[J[̕S͂Ȃj
+class ProgressTracker {
+private:
+    VolumeUsage reference;
+    std::uintmax_t bytes = 0;
+    std::uint64_t inodes = 0;
+    double bytesRate = 0;   // X[vbgioCg/bj
+    double inodesRate = 0;  // X[vbgiinode/bj
+    std::chrono::steady_clock::time_point lastSample;
+    bool sampled = false;
 
-    for (size_t i = 0; i < limit; ++i) {
-        auto results = manager.getTopN(limit);
-        if (i < results.size()) {
-            const auto& info = results[i];
-            if (info.calculated) {
-                std::cout << (i + 1) << ". " << info.path.string()
-                    << " : " << std::fixed << std::setprecision(2)
-                    << toGB(info.size) << " GB"
-                    << (info.isPartial ? "+" : "")
-                    << " (" << info.elapsed.count() / 1000.0 << " sec)";
-            } else {
-                std::cout << (i + 1) << ". " << info.path.string()
-                    << " : calculating...";
+public:
+    explicit ProgressTracker(const VolumeUsage& usage) : reference(usage) {}
+
+    void sample(std::uintmax_t countedBytes, std::uint64_t countedInodes,
+                std::chrono::steady_clock::time_point now) {
+        // wړρi萔 10bj
+        const double TIME_CONSTANT = 10.0;
+        if (sampled) {
+            double dt = std::chrono::duration<double>(now - lastSample).count();
+            if (dt <= 0) {
+                return;
             }
+            double alpha = 1.0 - std::exp(-dt / TIME_CONSTANT);
+            double instantBytes = static_cast<double>(countedBytes - std::min(countedBytes, bytes)) / dt;
+            double instantInodes = static_cast<double>(countedInodes - std::min(countedInodes, inodes)) / dt;
+            // ŏ̋Ԃ͕ς̏lƂĂ̂܂܎g
+            if (bytesRate == 0 && inodesRate == 0) {
+                alpha = 1.0;
+            }
+            bytesRate += alpha * (instantBytes - bytesRate);
+            inodesRate += alpha * (instantInodes - inodesRate);
         }
-        std::cout << "\n";
-        clearToEndOfLine();
+        bytes = countedBytes;
+        inodes = countedInodes;
+        lastSample = now;
+        sampled = true;
     }
-}
-
-int main() {
-#ifdef _WIN32
-    HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
-    DWORD dwMode = 0;
-    GetConsoleMode(hOut, &dwMode);
-    dwMode |= ENABLE_VIRTUAL_TERMINAL_PROCESSING;
-    SetConsoleMode(hOut, dwMode);
-#endif
 
-    std::cout.setf(std::ios::unitbuf);
-    const int MAX_DEPTH = 4;
-    const size_t DISPLAY_LIMIT = 16;
-    const int DISPLAY_FPS = 2;
-    const auto DISPLAY_INTERVAL = std::chrono::milliseconds(1000 / DISPLAY_FPS);
+    bool hasReference() const {
+        return reference.valid && reference.usedBytes > 0;
+    }
 
-    ResultManager manager;
+    double bytesFraction() const {
+        return hasReference()
+            ? std::min(1.0, static_cast<double>(bytes) / reference.usedBytes) : 0.0;
+    }
 
-    // Phase 1: WvΏۂ̎W
-    std::cout << "Collecting target paths...\n";
-    collectTargetPaths(L"C:\\", 0, MAX_DEPTH, manager);
+    double inodesFraction() const {
+        return reference.usedInodes > 0
+            ? std::min(1.0, static_cast<double>(inodes) / reference.usedInodes) : 0.0;
+    }
 
-    // Phase 2: TCYvZ
-    std::vector<std::future<void>> calculationTasks;
-    auto results = manager.getTopN(manager.totalTargets());  // S^[Qbg擾
+    std::uintmax_t countedBytes() const {
+        return bytes;
+    }
 
-    for (const auto& target : results) {
-        calculationTasks.push_back(std::async(std::launch::async,
-            [&manager](const fs::path& path) {
-                auto startTime = std::chrono::steady_clock::now();
-                std::uintmax_t size;
-                bool isPartial = false;
-                try {
-                    if (fs::is_directory(path)) {
-                        auto [dirSize, partial] = calculateDirectorySizeWithTimeout(path, startTime, manager);
-                        size = dirSize;
-                        isPartial = partial;
-                    } else {
-                        size = fs::file_size(path);
-                    }
-                } catch (...) {
-                    size = 0;
-                }
-                auto endTime = std::chrono::steady_clock::now();
-                auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
-                    endTime - startTime);
-                manager.update(path, size, isPartial, elapsed);
-            }, target.path
-        ));
+    std::uintmax_t referenceBytes() const {
+        return reference.usedBytes;
     }
 
-    // Phase 3: ʕ\[v
-    auto lastUpdate = std::chrono::steady_clock::now();
-    while (!manager.isComplete()) {
-        auto now = std::chrono::steady_clock::now();
-        if (now - lastUpdate >= DISPLAY_INTERVAL) {
-            displayResults(manager, DISPLAY_LIMIT);
-            lastUpdate = now;
+    // c莞ԁibAsȂ畉jB^f[^Ȃ̂ inode g΂D
+    double etaSeconds() const {
+        if (reference.usedInodes > 0 && inodesRate > 0) {
+            double remaining = static_cast<double>(reference.usedInodes) - static_cast<double>(inodes);
+            return std::max(0.0, remaining / inodesRate);
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (hasReference() && bytesRate > 0) {
+            double remaining = static_cast<double>(reference.usedBytes) - static_cast<double>(bytes);
+            return std::max(0.0, remaining / bytesRate);
+        }
+        return -1;
     }
+};
 
-    // ŏIʕ\
-    displayResults(manager, DISPLAY_LIMIT);
-    std::cout << "\nAnalysis complete!\n";
+// b "1h02m03s" `ɐ`
+std::string formatDuration(double seconds) {
+    auto total = static_cast<long long>(seconds + 0.5);
+    std::ostringstream out;
+    if (total >= 3600) {
+        out << total / 3600 << "h" << std::setw(2) << std::setfill('0') << (total / 60) % 60 << "m";
+    } else if (total >= 60) {
+        out << total / 60 << "m";
+    }
+    out << std::setw(total >= 60 ? 2 : 1) << std::setfill('0') << total % 60 << "s";
+    return out.str();
+}
+
+// foCXƂ̃g[NoPbgŃ^f[^̔s[g𐧌
+class IoThrottle {
+private:
+    struct Bucket {
+        std::mutex mutex;
+        double tokens = 0;
+        double rate = 0;
+        std::chrono::steady_clock::time_point last;
+    };
 
-    // S^XN̊ҋ@
-    for (auto& task : calculationTasks) {
-        task.wait();
+    double baseRate;
+    double minRate;
+    std::mutex mapMutex;
+    std::map<std::uint64_t, std::unique_ptr<Bucket>> buckets;
+
+    Bucket& bucketFor(std::uint64_t device) {
+        std::lock_guard<std::mutex> lock(mapMutex);
+        auto& b = buckets[device];
+        if (!b) {
+            b = std::make_unique<Bucket>();
+            b->rate = baseRate;
+            b->tokens = burst(baseRate);
+            b->last = std::chrono::steady_clock::now();
+        }
+        return *b;
     }
 
-    return 0;
+    // oPc̗eʁi0.1bB1ƃg[N1܂炸擾łȂ̂ōŒ1j
+    static double burst(double rate) {
+        return std::max(1.0, rate / 10);
+    }
+
+public:
+    explicit IoThrottle(double opsPerSecond)
+        : baseRate(opsPerSecond), minRate(std::max(1.0, opsPerSecond / 64)) {}
+
+    // g[N1擾܂őҋ@
+    void acquire(std::uint64_t device) {
+        Bucket& b = bucketFor(device);
+        while (true) {
+            std::chrono::duration<double> wait;
+            {
+                std::lock_guard<std::mutex> lock(b.mutex);
+                auto now = std::chrono::steady_clock::now();
+                double dt = std::chrono::duration<double>(now - b.last).count();
+                b.last = now;
+                b.tokens = std::min(burst(b.rate), b.tokens + dt * b.rate);
+                if (b.tokens >= 1.0) {
+                    b.tokens -= 1.0;
+                    return;
+                }
+                wait = std::chrono::duration<double>((1.0 - b.tokens) / b.rate);
+            }
+            std::this_thread::sleep_for(wait);
+        }
+    }
+
+    // foCXgpɉă[g𒲐iߎ͔AȊO͏Xɉ񕜁j
+    void adjust(std::uint64_t device, double utilization, double threshold) {
+        Bucket& b = bucketFor(device);
+        std::lock_guard<std::mutex> lock(b.mutex);
+        if (utilization > threshold) {
+            b.rate = std::max(minRate, b.rate / 2);
+        } else {
+            b.rate = std::min(baseRate, b.rate + baseRate / 16);
+        }
+    }
+
+    double currentRate(std::uint64_t device) {
+        Bucket& b = bucketFor(device);
+        std::lock_guard<std::mutex> lock(b.mutex);
+        return b.rate;
+    }
+};
+
+// /proc/diskstats Iɓǂ݁AfoCX̎gpibusy timej𑪒肷
+class DiskStatsMonitor {
+private:
+    struct DeviceState {
+        std::uint64_t lastTicks = 0;
+        std::uint64_t busyMs = 0;
+        double utilization = 0;
+        bool seen = false;
+    };
+
+    std::map<std::uint64_t, DeviceState> devices;
+    mutable std::mutex mutex;
+    std::atomic<bool> running{ false };
+    std::thread worker;
+    IoThrottle* throttle = nullptr;
+    double threshold = 1.0;
+    std::chrono::steady_clock::time_point startTime;
+
+    static bool readIoTicks(std::map<std::uint64_t, std::uint64_t>& ticks) {
+#ifdef __linux__
+        std::ifstream in("/proc/diskstats");
+        if (!in) {
+            return false;
+        }
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            unsigned int major = 0, minor = 0;
+            std::string name;
+            std::uint64_t value = 0;
+            if (!(fields >> major >> minor >> name)) {
+                continue;
+            }
+            // io_ticks ͖Ǒ10Ԗڂ̃tB[h
+            for (int i = 0; i < 10 && (fields >> value); ++i) {}
+            if (fields) {
+                ticks[static_cast<std::uint64_t>(makedev(major, minor))] = value;
+            }
+        }
+        return true;
+#else
+        (void)ticks;
+        return false;
+#endif
+    }
+
+    void sample(std::chrono::milliseconds interval) {
+        std::map<std::uint64_t, std::uint64_t> ticks;
+        if (!readIoTicks(ticks)) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& [dev, state] : devices) {
+            auto it = ticks.find(dev);
+            if (it == ticks.end()) {
+                continue;
+            }
+            if (state.seen) {
+                std::uint64_t delta = it->second - state.lastTicks;
+                state.busyMs += delta;
+                state.utilization = static_cast<double>(delta) / interval.count();
+                if (throttle) {
+                    throttle->adjust(dev, state.utilization, threshold);
+                }
+            }
+            state.lastTicks = it->second;
+            state.seen = true;
+        }
+    }
+
+public:
+    ~DiskStatsMonitor() {
+        stop();
+    }
+
+    void watch(std::uint64_t device) {
+        std::lock_guard<std::mutex> lock(mutex);
+        devices[device];
+    }
+
+    void start(IoThrottle* t, double busyThreshold) {
+        throttle = t;
+        threshold = busyThreshold;
+        startTime = std::chrono::steady_clock::now();
+        running = true;
+        worker = std::thread([this]() {
+            const auto interval = std::chrono::milliseconds(500);
+            sample(interval);
+            while (running) {
+                std::this_thread::sleep_for(interval);
+                sample(interval);
+            }
+        });
+    }
+
+    void stop() {
+        running = false;
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+    // ĎfoCX̂ő̎gpƁAXLJn busy Ԃ̊
+    bool summary(double& utilization, double& busyRatio) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        double elapsedMs = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - startTime).count();
+        bool any = false;
+        utilization = 0;
+        busyRatio = 0;
+        for (const auto& [dev, state] : devices) {
+            if (!state.seen) {
+                continue;
+            }
+            any = true;
+            utilization = std::max(utilization, state.utilization);
+            if (elapsedMs > 0) {
+                busyRatio = std::max(busyRatio, state.busyMs / elapsedMs);
+            }
+        }
+        return any;
+    }
+};
+
+// [J[Xbh CPU/I/O DxŒɂ
+void lowerCurrentThreadPriority() {
+#ifdef _WIN32
+    // obNOEh[h CPU  I/O ̗̗Dx
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+#elif defined(__linux__)
+    // ioprio: IOPRIO_CLASS_IDLE (3) ̃Xbhɐݒ
+    const int IOPRIO_WHO_PROCESS = 1;
+    const int IOPRIO_CLASS_IDLE = 3;
+    const int IOPRIO_CLASS_SHIFT = 13;
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+
+    // SCHED_IDLE gȂ nice 19 ɃtH[obN
+    struct sched_param param;
+    std::memset(&param, 0, sizeof(param));
+    if (sched_setscheduler(0, SCHED_IDLE, &param) != 0) {
+        setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19);
+    }
+#endif
+}
+
+// s狁߂[J[Ɠ I/O 
+struct WorkerBudget {
+    size_t affinityCpus = 1;   // sched_getaffinity Ŏgp\ CPU 
+    double cgroupCpus = 0;     // cgroup v2 cpu.max ̏i0 ͖j
+    std::uint64_t ioMaxIops = 0; // cgroup v2 io.max  riops i0 ͖j
+    size_t ioDepth = 1;        // ̃foCX֓ɔsĂ悢^f[^ I/O ̐
+    size_t workers = 1;        // ̃foCX𓯎ɑ郏[J[iXbh ioDepth ̏j
+    size_t cpuWorkers = 1;     // CPU ̐猈܂鐔ivZXŜ̃[J[̏j
+};
+
+// ݂̃vZX cgroup v2 fBNg
+fs::path currentCgroupDir() {
+    std::ifstream in("/proc/self/cgroup");
+    std::string line;
+    while (std::getline(in, line)) {
+        // cgroup v2  "0::/path" ̌`
+        if (line.rfind("0::", 0) == 0) {
+            return fs::path("/sys/fs/cgroup") / fs::path(line.substr(3)).relative_path();
+        }
+    }
+    return {};
+}
+
+// cpu.max  cgroup ̑c܂ŒHAł CPU ̏Ԃi0 ͖j
+double readCgroupCpuLimit(const fs::path& cgroupDir) {
+    double limit = 0;
+    for (fs::path dir = cgroupDir; !dir.empty(); dir = dir.parent_path()) {
+        std::ifstream in(dir / "cpu.max");
+        std::string quota;
+        double period = 0;
+        if (in >> quota >> period && quota != "max" && period > 0) {
+            double cpus = std::stod(quota) / period;
+            limit = limit > 0 ? std::min(limit, cpus) : cpus;
+        }
+        if (dir == "/sys/fs/cgroup" || dir == dir.parent_path()) {
+            break;
+        }
+    }
+    return limit;
+}
+
+// io.max wfoCX̓ǂݍ IOPS Ԃi0 ͖jB
+// io.max ̓fBXNŜ major:minor ŏ̂ŁAp[eBVȂẽfBXNɓǂݑւ
+std::uint64_t readCgroupIoLimit(const fs::path& cgroupDir, std::uint64_t device) {
+#ifdef __linux__
+    std::uint64_t limit = 0;
+    std::ostringstream partition;
+    partition << major(static_cast<dev_t>(device)) << ":" << minor(static_cast<dev_t>(device));
+    std::string key = partition.str();
+    fs::path sysfs = fs::path("/sys/dev/block") / key;
+    std::error_code ec;
+    if (fs::exists(sysfs / "partition", ec)) {
+        std::ifstream parent(sysfs / ".." / "dev");
+        std::string disk;
+        if (parent >> disk) {
+            key = disk;
+        }
+    }
+    for (fs::path dir = cgroupDir; !dir.empty(); dir = dir.parent_path()) {
+        std::ifstream in(dir / "io.max");
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            std::string dev, item;
+            if (!(fields >> dev) || dev != key) {
+                continue;
+            }
+            while (fields >> item) {
+                if (item.rfind("riops=", 0) == 0 && item != "riops=max") {
+                    std::uint64_t iops = std::stoull(item.substr(6));
+                    limit = limit > 0 ? std::min(limit, iops) : iops;
+                }
+            }
+        }
+        if (dir == "/sys/fs/cgroup" || dir == dir.parent_path()) {
+            break;
+        }
+    }
+    return limit;
+#else
+    (void)cgroupDir;
+    (void)device;
+    return 0;
+#endif
+}
+
+// affinity  cgroup ̐烏[J[v[̑傫߂
+WorkerBudget detectWorkerBudget(std::uint64_t device) {
+    WorkerBudget budget;
+#ifdef _WIN32
+    DWORD_PTR processMask = 0, systemMask = 0;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask)) {
+        size_t count = 0;
+        for (; processMask; processMask &= processMask - 1) {
+            count++;
+        }
+        budget.affinityCpus = std::max<size_t>(1, count);
+    }
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        budget.affinityCpus = std::max(1, CPU_COUNT(&set));
+    }
+    try {
+        fs::path cgroupDir = currentCgroupDir();
+        if (!cgroupDir.empty()) {
+            budget.cgroupCpus = readCgroupCpuLimit(cgroupDir);
+            budget.ioMaxIops = readCgroupIoLimit(cgroupDir, device);
+        }
+    } catch (...) {}
+#else
+    budget.affinityCpus = std::max(1u, std::thread::hardware_concurrency());
+#endif
+    (void)device;
+
+    double cpus = static_cast<double>(budget.affinityCpus);
+    if (budget.cgroupCpus > 0) {
+        cpus = std::min(cpus, budget.cgroupCpus);
+    }
+    budget.cpuWorkers = static_cast<size_t>(std::max(1.0, std::ceil(cpus)));
+
+    //  I/O ̓XbhƂ͕ʂɁAfoCXƂ̏ƂČ߂iCPU ̐{܂ŏd˂Ă悢jB
+    // Xbh CPU ̂̕ŁA--workers ő₵ƂɃfoCX֌鐔ŗ}
+    const size_t IO_DEPTH_PER_CPU = 4;
+    const size_t MAX_IO_DEPTH = 64;
+    budget.ioDepth = std::min(MAX_IO_DEPTH, budget.cpuWorkers * IO_DEPTH_PER_CPU);
+    if (budget.ioMaxIops > 0) {
+        // 1삠2msƌςA𒴂铯s͂Ȃ
+        size_t iopsDepth = static_cast<size_t>(std::max<std::uint64_t>(1, budget.ioMaxIops / 500));
+        budget.ioDepth = std::min(budget.ioDepth, iopsDepth);
+    }
+    budget.workers = std::min(budget.cpuWorkers, budget.ioDepth);
+    return budget;
+}
+
+// Œ萔̃XbhŃ^XN郏[J[v[
+class WorkerPool {
+private:
+    struct Task {
+        double priority;
+        std::uint64_t sequence;
+        std::function<void()> run;
+
+        bool operator<(const Task& other) const {
+            // Dx̂ɁAȂ瓊
+            if (priority != other.priority) {
+                return priority < other.priority;
+            }
+            return sequence > other.sequence;
+        }
+    };
+
+    // s̏L^XN̏W܂ifoCXƂȂǁj
+    struct Group {
+        std::vector<Task> tasks;  // q[vƂĊǗ
+        size_t limit = std::numeric_limits<size_t>::max();
+        size_t running = 0;
+    };
+
+    std::vector<std::thread> threads;
+    std::deque<std::atomic<bool>> retired;  // ȂȂA[ς݂̃Xbh
+    std::map<std::uint64_t, Group> groups;
+    std::vector<std::pair<bool, std::uint64_t>> runningGroup;  // XbhƂ̎sO[v
+    std::uint64_t nextSequence = 0;
+    std::function<void()> onThreadStart;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::condition_variable exitCv;
+    bool stopping = false;
+    size_t exitedThreads = 0;
+
+    static size_t& threadIndex() {
+        thread_local size_t index = 0;
+        return index;
+    }
+
+    // ɒBĂȂO[v̂A擪̃^XN̗Dxł́B
+    // mutex ێԂŌĂԂ
+    Group* runnableGroup(std::uint64_t* key) {
+        Group* best = nullptr;
+        for (auto& entry : groups) {
+            Group& group = entry.second;
+            if (group.tasks.empty() || group.running >= group.limit) {
+                continue;
+            }
+            if (!best || best->tasks.front() < group.tasks.front()) {
+                best = &group;
+                *key = entry.first;
+            }
+        }
+        return best;
+    }
+
+    // mutex ێԂŌĂԂ
+    void releaseGroup(size_t index) {
+        if (runningGroup[index].first) {
+            auto it = groups.find(runningGroup[index].second);
+            if (it != groups.end()) {
+                it->second.running--;
+            }
+            runningGroup[index].first = false;
+        }
+    }
+
+    // mutex ێԂŌĂԂ
+    void spawnThread() {
+        size_t index = threads.size();
+        retired.emplace_back(false);
+        runningGroup.emplace_back(false, 0);
+        threads.emplace_back([this, index]() {
+            threadIndex() = index;
+            if (onThreadStart) {
+                onThreadStart();
+            }
+            while (true) {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    std::uint64_t key = 0;
+                    Group* group = nullptr;
+                    cv.wait(lock, [this, index, &group, &key]() {
+                        group = runnableGroup(&key);
+                        return stopping || retired[index] || group;
+                    });
+                    if (!group || retired[index]) {
+                        exitedThreads++;
+                        exitCv.notify_all();
+                        return;
+                    }
+                    std::pop_heap(group->tasks.begin(), group->tasks.end());
+                    task = std::move(group->tasks.back().run);
+                    group->tasks.pop_back();
+                    group->running++;
+                    runningGroup[index] = { true, key };
+                }
+                task();
+                {
+                    // ؂̂čς݂Ȃg retire ŕԂĂ
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!retired[index]) {
+                        releaseGroup(index);
+                    }
+                }
+                cv.notify_one();
+            }
+        });
+    }
+
+public:
+    WorkerPool(size_t count, const std::function<void()>& threadStart)
+        : onThreadStart(threadStart) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < count; ++i) {
+            spawnThread();
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto& t : threads) {
+            if (t.joinable()) {
+                t.join();
+            }
+        }
+    }
+
+    // Ăяo[J[Xbh̔ԍ
+    static size_t currentIndex() {
+        return threadIndex();
+    }
+
+    // ȂXbh؂̂āÃXbhNĕxۂ
+    void retire(size_t index) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping || index >= retired.size() || retired[index]) {
+                return;
+            }
+            retired[index] = true;
+            releaseGroup(index);  // Ȃ^XNO[v̘gǂȂ悤
+            spawnThread();
+        }
+        cv.notify_all();
+    }
+
+    // ̃^XNjAP\ԓɑSXbhÎ҂B
+    // IȂXbhcꍇ͐؂藣 false ԂiĂяo̓vZXI邱Ɓj
+    bool shutdown(std::chrono::milliseconds grace) {
+        bool allExited;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            stopping = true;
+            groups.clear();
+            cv.notify_all();
+            allExited = exitCv.wait_for(lock, grace,
+                                        [this]() { return exitedThreads == threads.size(); });
+        }
+        for (auto& t : threads) {
+            if (allExited) {
+                t.join();
+            } else {
+                t.detach();
+            }
+        }
+        return allExited;
+    }
+
+    // O[vœɎs^XN̏ݒ肷
+    void setGroupLimit(std::uint64_t group, size_t limit) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            groups[group].limit = std::max<size_t>(1, limit);
+        }
+        cv.notify_all();
+    }
+
+    void submit(std::function<void()> task, double priority = 0, std::uint64_t group = 0) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping) {
+                return;
+            }
+            auto& tasks = groups[group].tasks;
+            tasks.push_back(Task{ priority, nextSequence++, std::move(task) });
+            std::push_heap(tasks.begin(), tasks.end());
+        }
+        cv.notify_one();
+    }
+};
+
+// WvPʂ̔p֐
+bool isTargetUnit(const fs::path& path, int depth) {
+    try {
+        // pX̂ǂɃV{bNNꍇ͏O
+        std::error_code ec;
+        fs::path current;
+        for (const auto& part : path) {
+            current /= part;
+            if (fs::is_symlink(current, ec)) {
+                return false;
+            }
+        }
+
+        // pX̊KwJEg
+        int pathDepth = 0;
+        for (const auto& _ : path.relative_path()) {
+            pathDepth++;
+        }
+
+        // w肳ꂽ[ƈvꍇA܂
+        // t@C݂Ő[̊Kw̏ꍇɏWvPʂƂ
+        return pathDepth == depth ||
+            (pathDepth < depth && fs::is_regular_file(path, ec));
+    } catch (...) {
+        return false;
+    }
+}
+
+// O[pXvfPʂ̃I[g}gɃRpĆB
+// 1Kw~邽тɏԂ1vfi߂̂ŁA̗͂vf̒ɔႷB
+//   /var/cache, C:\Windows  [g̑OvizׂĂOj
+//   node_modules, *.tmp     Cӂ̐[̗vfɈvi**/ ₤j
+//   **/build/tmp            ** 0ȏ̗vfɈv
+//   *.log size>1G age>30d   TCYEoߎԂ̏tit@Ĉ݃TCY𔻒j
+//   "My Documents/*.bak"    ͍sǂނ̂ŁA󔒂܂ރpX͂̂܂܂łpň͂ł悢
+class ExclusionSet {
+public:
+    using NativeString = fs::path::string_type;
+    using State = std::vector<std::uint32_t>;  // Lȃm[h̏Wij
+
+private:
+    struct Rule {
+        std::uintmax_t minSize = 0;
+        std::uintmax_t maxSize = std::numeric_limits<std::uintmax_t>::max();
+        std::int64_t minAgeSeconds = 0;
+        std::int64_t maxAgeSeconds = std::numeric_limits<std::int64_t>::max();
+
+        bool hasPredicates() const {
+            return minSize > 0 || maxSize != std::numeric_limits<std::uintmax_t>::max() ||
+                minAgeSeconds > 0 || maxAgeSeconds != std::numeric_limits<std::int64_t>::max();
+        }
+    };
+
+    struct Node {
+        std::map<NativeString, std::uint32_t> literal;                 // ChJ[hȂ̎q
+        std::vector<std::pair<NativeString, std::uint32_t>> globs;     // ChJ[ht̎q
+        std::uint32_t anyDepth = 0;                                    // ** ̎qi0 ͂Ȃj
+        bool isAnyDepth = false;
+        std::vector<std::uint32_t> rules;                              // ňv郋[
+    };
+
+    std::vector<Node> nodes{ Node() };
+    std::vector<Rule> rules;
+    std::string ruleText;  // 󂯕t[̌is؂j
+
+    static bool ignoreCase() {
+#ifdef _WIN32
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    static NativeString normalize(NativeString s) {
+        if (ignoreCase()) {
+            std::transform(s.begin(), s.end(), s.begin(),
+                           [](fs::path::value_type c) {
+                               return static_cast<fs::path::value_type>(std::towlower(c));
+                           });
+        }
+        return s;
+    }
+
+    static bool hasWildcard(const NativeString& s) {
+        return s.find_first_of(fs::path(L"*?").native()) != NativeString::npos;
+    }
+
+    // *  ? ݂̂̃Ouƍi* ̒ւ̃obNgbNŐ`ɋ߂j
+    static bool globMatch(const NativeString& pattern, const NativeString& text) {
+        size_t p = 0, t = 0, starP = NativeString::npos, starT = 0;
+        while (t < text.size()) {
+            if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == text[t])) {
+                p++;
+                t++;
+            } else if (p < pattern.size() && pattern[p] == '*') {
+                starP = p++;
+                starT = t;
+            } else if (starP != NativeString::npos) {
+                p = starP + 1;
+                t = ++starT;
+            } else {
+                return false;
+            }
+        }
+        while (p < pattern.size() && pattern[p] == '*') {
+            p++;
+        }
+        return p == pattern.size();
+    }
+
+    std::uint32_t addNode() {
+        nodes.emplace_back();
+        return static_cast<std::uint32_t>(nodes.size() - 1);
+    }
+
+    // ** m[hHēBłm[hԂɉ
+    void addWithClosure(State& state, std::uint32_t node) const {
+        state.push_back(node);
+        if (nodes[node].anyDepth != 0) {
+            addWithClosure(state, nodes[node].anyDepth);
+        }
+    }
+
+    static void canonicalize(State& state) {
+        std::sort(state.begin(), state.end());
+        state.erase(std::unique(state.begin(), state.end()), state.end());
+    }
+
+    static bool parseSize(const std::string& text, std::uintmax_t& value) {
+        size_t pos = 0;
+        double number = std::stod(text, &pos);
+        double scale = 1;
+        if (pos < text.size()) {
+            switch (std::toupper(static_cast<unsigned char>(text[pos]))) {
+            case 'K': scale = 1024.0; break;
+            case 'M': scale = 1024.0 * 1024; break;
+            case 'G': scale = 1024.0 * 1024 * 1024; break;
+            case 'T': scale = 1024.0 * 1024 * 1024 * 1024; break;
+            default: return false;
+            }
+        }
+        value = static_cast<std::uintmax_t>(number * scale);
+        return true;
+    }
+
+    static bool parseAge(const std::string& text, std::int64_t& seconds) {
+        size_t pos = 0;
+        double number = std::stod(text, &pos);
+        double scale = 86400;  // PʂȂ͓
+        if (pos < text.size()) {
+            switch (text[pos]) {
+            case 's': scale = 1; break;
+            case 'm': scale = 60; break;
+            case 'h': scale = 3600; break;
+            case 'd': scale = 86400; break;
+            default: return false;
+            }
+        }
+        seconds = static_cast<std::int64_t>(number * scale);
+        return true;
+    }
+
+public:
+    // pX̗vfihCu΂1vfƂj
+    static std::vector<NativeString> components(const fs::path& p) {
+        std::vector<NativeString> parts;
+        if (p.has_root_name()) {
+            parts.push_back(p.root_name().native());
+        }
+        for (const auto& part : p.relative_path()) {
+            if (!part.empty() && part != ".") {
+                parts.push_back(part.native());
+            }
+        }
+        return parts;
+    }
+
+    bool empty() const {
+        return rules.empty();
+    }
+
+    // [1ǉBsȂ false
+    bool addRule(const std::string& line) {
+        // ͍sǂ݁AłȂꂪꂽƂ܂łp^[Ƃ
+        // ipX̓r̋󔒂Ő؂Ȃ߁j
+        const char* const SPACES = " \t\r";
+        std::string pattern = line;
+        std::vector<std::string> predicates;
+        for (;;) {
+            pattern.erase(pattern.find_last_not_of(SPACES) + 1);
+            size_t separator = pattern.find_last_of(SPACES);
+            if (separator == std::string::npos) {
+                break;
+            }
+            std::string last = pattern.substr(separator + 1);
+            if (last.rfind("size>", 0) != 0 && last.rfind("size<", 0) != 0 &&
+                last.rfind("age>", 0) != 0 && last.rfind("age<", 0) != 0) {
+                break;
+            }
+            predicates.push_back(last);
+            pattern.erase(separator);
+        }
+        pattern.erase(0, std::min(pattern.find_first_not_of(SPACES), pattern.size()));
+        if (pattern.size() >= 2 && pattern.front() == '"' && pattern.back() == '"') {
+            pattern = pattern.substr(1, pattern.size() - 2);
+        }
+        if (pattern.empty()) {
+            return false;
+        }
+        Rule rule;
+        try {
+            for (const auto& predicate : predicates) {
+                if (predicate.rfind("size>", 0) == 0) {
+                    if (!parseSize(predicate.substr(5), rule.minSize)) return false;
+                    rule.minSize++;
+                } else if (predicate.rfind("size<", 0) == 0) {
+                    if (!parseSize(predicate.substr(5), rule.maxSize)) return false;
+                    rule.maxSize = rule.maxSize > 0 ? rule.maxSize - 1 : 0;
+                } else if (predicate.rfind("age>", 0) == 0) {
+                    if (!parseAge(predicate.substr(4), rule.minAgeSeconds)) return false;
+                } else if (predicate.rfind("age<", 0) == 0) {
+                    if (!parseAge(predicate.substr(4), rule.maxAgeSeconds)) return false;
+                } else {
+                    return false;
+                }
+            }
+        } catch (...) {
+            return false;
+        }
+
+        // ΃pX̓[gAȊO͔Cӂ̐[v
+        fs::path patternPath(pattern);
+        std::vector<NativeString> parts = components(patternPath);
+        if (parts.empty()) {
+            return false;
+        }
+        if (!patternPath.is_absolute() && !patternPath.has_root_directory() &&
+            parts.front() != fs::path("**").native()) {
+            parts.insert(parts.begin(), fs::path("**").native());
+        }
+
+        std::uint32_t node = 0;
+        for (const auto& rawPart : parts) {
+            NativeString part = normalize(rawPart);
+            if (part == fs::path("**").native()) {
+                if (nodes[node].anyDepth == 0) {
+                    std::uint32_t child = addNode();
+                    nodes[child].isAnyDepth = true;
+                    nodes[node].anyDepth = child;
+                }
+                node = nodes[node].anyDepth;
+            } else if (hasWildcard(part)) {
+                auto it = std::find_if(nodes[node].globs.begin(), nodes[node].globs.end(),
+                                       [&part](const auto& g) { return g.first == part; });
+                if (it != nodes[node].globs.end()) {
+                    node = it->second;
+                } else {
+                    std::uint32_t child = addNode();
+                    nodes[node].globs.emplace_back(part, child);
+                    node = child;
+                }
+            } else {
+                auto it = nodes[node].literal.find(part);
+                if (it != nodes[node].literal.end()) {
+                    node = it->second;
+                } else {
+                    std::uint32_t child = addNode();
+                    nodes[node].literal.emplace(part, child);
+                    node = child;
+                }
+            }
+        }
+        nodes[node].rules.push_back(static_cast<std::uint32_t>(rules.size()));
+        rules.push_back(rule);
+        ruleText += line + "\n";
+        return true;
+    }
+
+    // 󂯕t[̌ĩ[ --exclude-from ̒g܂ށj
+    const std::string& text() const {
+        return ruleText;
+    }
+
+    // t@Cǂݍށis # Ŏn܂s͖j
+    bool loadFile(const fs::path& file, std::string& error) {
+        std::ifstream in(file);
+        if (!in) {
+            error = "cannot open " + file.string();
+            return false;
+        }
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(in, line)) {
+            lineNumber++;
+            auto first = line.find_first_not_of(" \t\r");
+            if (first == std::string::npos || line[first] == '#') {
+                continue;
+            }
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            if (!addRule(line.substr(first))) {
+                error = file.string() + ":" + std::to_string(lineNumber) + ": invalid rule";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    State initialState() const {
+        State state;
+        if (!empty()) {
+            addWithClosure(state, 0);
+            canonicalize(state);
+        }
+        return state;
+    }
+
+    // Ԃ1vfi߂
+    State advance(const State& state, const NativeString& rawComponent) const {
+        State next;
+        if (state.empty()) {
+            return next;
+        }
+        NativeString component = normalize(rawComponent);
+        for (std::uint32_t index : state) {
+            const Node& node = nodes[index];
+            if (node.isAnyDepth) {
+                next.push_back(index);  // ** ͔Cӌ̗vfǂݔ΂
+            }
+            auto it = node.literal.find(component);
+            if (it != node.literal.end()) {
+                addWithClosure(next, it->second);
+            }
+            for (const auto& glob : node.globs) {
+                if (globMatch(glob.first, component)) {
+                    addWithClosure(next, glob.second);
+                }
+            }
+        }
+        canonicalize(next);
+        return next;
+    }
+
+    // pXŜ擪ƍ
+    State stateFor(const fs::path& p) const {
+        State state = initialState();
+        for (const auto& part : components(p)) {
+            if (state.empty()) {
+                break;
+            }
+            state = advance(state, part);
+        }
+        return state;
+    }
+
+    // Ԃňv[̂ꂩGgO邩B
+    // facts() ̓TCYEoߎԂ̏ƂĂ΂A{TCY, oߕb} Ԃ
+    template <typename Facts>
+    bool excludes(const State& state, bool isDirectory, Facts&& facts) const {
+        for (std::uint32_t index : state) {
+            for (std::uint32_t r : nodes[index].rules) {
+                const Rule& rule = rules[r];
+                if (!rule.hasPredicates()) {
+                    return true;
+                }
+                std::pair<std::uintmax_t, std::int64_t> f = facts();
+                bool sizeOk = isDirectory
+                    ? (rule.minSize == 0 && rule.maxSize == std::numeric_limits<std::uintmax_t>::max())
+                    : (f.first >= rule.minSize && f.first <= rule.maxSize);
+                bool ageOk = f.second >= rule.minAgeSeconds && f.second <= rule.maxAgeSeconds;
+                if (sizeOk && ageOk) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    bool excludes(const State& state) const {
+        return excludes(state, true, []() { return std::pair<std::uintmax_t, std::int64_t>(0, 0); });
+    }
+};
+
+// Gg {TCY, ŏIXV̌oߕb}iO[̏pj
+std::pair<std::uintmax_t, std::int64_t> entryFacts(const fs::directory_entry& entry) {
+    std::error_code ec;
+    std::uintmax_t size = entry.is_regular_file(ec) ? entry.file_size(ec) : 0;
+    if (ec) {
+        size = 0;
+    }
+    auto modified = entry.last_write_time(ec);
+    std::int64_t age = 0;
+    if (!ec) {
+        age = std::chrono::duration_cast<std::chrono::seconds>(
+            fs::file_time_type::clock::now() - modified).count();
+    }
+    return { size, age };
+}
+
+// ̃fBNg̃nhi` Linux ̂݁j
+struct DirectoryHandle;
+
+#ifdef __linux__
+struct DirectoryHandle {
+    fs::path path;
+    std::shared_ptr<DirectoryHandle> parent;
+    int fd = -1;            // -1 ͒ǂoς
+    int pins = 0;           // gp̐i0 ̂Ƃǂoj
+    bool inLru = false;
+    std::list<DirectoryHandle*>::iterator lruPosition;
+};
+
+// JĂfBNg fd ̗\ZǗB
+// fBNg͐e fd ̑ openat ŊJAq̗񋓂ςނ܂ fd g񂷁B
+// gI fd  LRU ɒuA\Z𒴂Â̂BfBNg
+// ĂѕKvɂȂA܂JĂł߂c悩̑΃pXŊJ
+class DirectoryHandleCache {
+public:
+    using HandlePtr = std::shared_ptr<DirectoryHandle>;
+
+    // ێĂԂ fd Ȃ
+    class Pin {
+    public:
+        Pin() = default;
+        Pin(DirectoryHandleCache* owner, HandlePtr handle)
+            : cache(owner), pinned(std::move(handle)) {}
+        Pin(Pin&& other) noexcept
+            : cache(other.cache), pinned(std::move(other.pinned)) {
+            other.cache = nullptr;
+        }
+        Pin& operator=(Pin&& other) noexcept {
+            if (this != &other) {
+                reset();
+                cache = other.cache;
+                pinned = std::move(other.pinned);
+                other.cache = nullptr;
+            }
+            return *this;
+        }
+        Pin(const Pin&) = delete;
+        Pin& operator=(const Pin&) = delete;
+        ~Pin() {
+            reset();
+        }
+
+        void reset() {
+            if (cache && pinned) {
+                cache->unpin(*pinned);
+            }
+            cache = nullptr;
+            pinned.reset();
+        }
+
+        int fd() const {
+            return pinned ? pinned->fd : -1;
+        }
+
+        const HandlePtr& handle() const {
+            return pinned;
+        }
+
+    private:
+        DirectoryHandleCache* cache = nullptr;
+        HandlePtr pinned;
+    };
+
+    struct Statistics {
+        std::uint64_t opened = 0;     // VJfBNg
+        std::uint64_t relative = 0;   // ̂e fd J܂܂
+        std::uint64_t reopened = 0;   // ǂoɊJ
+        std::uint64_t evicted = 0;
+        size_t peak = 0;
+        size_t budget = 0;
+    };
+
+    explicit DirectoryHandleCache(size_t limit) : budget(std::max<size_t>(limit, 4)) {}
+
+    // \tg~bgn[h~bg܂ňグAfBNg fd ɉ񂹂鐔Ԃ
+    static size_t budgetFromLimit(size_t workers) {
+        const rlim_t MAX_SOFT_LIMIT = 1 << 16;
+        struct rlimit limit;
+        if (::getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+            return 256;
+        }
+        rlim_t wanted = limit.rlim_max == RLIM_INFINITY
+            ? MAX_SOFT_LIMIT : std::min<rlim_t>(limit.rlim_max, MAX_SOFT_LIMIT);
+        if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < wanted) {
+            struct rlimit raised = limit;
+            raised.rlim_cur = wanted;
+            if (::setrlimit(RLIMIT_NOFILE, &raised) == 0) {
+                limit.rlim_cur = wanted;
+            }
+        }
+        size_t soft = limit.rlim_cur == RLIM_INFINITY
+            ? static_cast<size_t>(MAX_SOFT_LIMIT) : static_cast<size_t>(limit.rlim_cur);
+        // WóAp directory_iteratorA/proc ̓ǂݍ݂ȂǂɎc
+        size_t reserve = std::max(soft / 4, workers * 2 + 16);
+        return soft > reserve ? soft - reserve : soft / 2;
+    }
+
+    // fBNgJBparent ΂ fd ̑΂ŁAȂΐ΃pXŊJ
+    Pin open(const HandlePtr& parent, const fs::path& path, std::error_code& ec) {
+        HandlePtr handle(new DirectoryHandle, [this](DirectoryHandle* h) { destroy(h); });
+        handle->path = path;
+        handle->parent = parent;
+        int fd = -1;
+        bool parentWasOpen = false;
+        if (parent) {
+            Pin parentPin = pin(parent, ec, &parentWasOpen);
+            if (ec) {
+                return Pin();
+            }
+            fd = openAt(parentPin.fd(), path.filename(), ec);
+        } else {
+            fd = openAt(AT_FDCWD, path, ec);
+        }
+        if (ec) {
+            return Pin();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        handle->fd = fd;
+        handle->pins = 1;
+        counters.opened++;
+        if (parentWasOpen) {
+            counters.relative++;
+        }
+        return Pin(this, std::move(handle));
+    }
+
+    // gpɂBǂoĂΊJ
+    Pin pin(const HandlePtr& handle, std::error_code& ec, bool* wasOpen = nullptr) {
+        std::vector<fs::path> names;
+        HandlePtr ancestor;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (handle->fd >= 0) {
+                takeLocked(*handle);
+                if (wasOpen) {
+                    *wasOpen = true;
+                }
+                return Pin(this, handle);
+            }
+            HandlePtr current = handle;
+            while (current && current->fd < 0) {
+                names.push_back(current->path.filename());
+                current = current->parent;
+            }
+            if (current) {
+                takeLocked(*current);
+                ancestor = current;
+            }
+        }
+
+        fs::path relative;
+        if (ancestor) {
+            for (auto it = names.rbegin(); it != names.rend(); ++it) {
+                relative /= *it;
+            }
+        } else {
+            relative = handle->path;
+        }
+        int fd = openAt(ancestor ? ancestor->fd : AT_FDCWD, relative, ec);
+        if (ancestor) {
+            unpin(*ancestor);
+        }
+        if (ec) {
+            return Pin();
+        }
+
+        int duplicate = -1;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (handle->fd >= 0) {
+                duplicate = fd;  // ̃[J[ɊJ
+                openCount--;
+            } else {
+                handle->fd = fd;
+                counters.reopened++;
+            }
+            takeLocked(*handle);
+        }
+        if (duplicate >= 0) {
+            ::close(duplicate);
+        }
+        return Pin(this, handle);
+    }
+
+    Statistics statistics() {
+        std::lock_guard<std::mutex> lock(mutex);
+        Statistics result = counters;
+        result.budget = budget;
+        return result;
+    }
+
+private:
+    // \ZmۂĂJBEMFILE/ENFILE ȂǂočĎs
+    int openAt(int dirFd, const fs::path& path, std::error_code& ec) {
+        const int FLAGS = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+        reserve(budget);
+        while (true) {
+            int fd = ::openat(dirFd, path.c_str(), FLAGS);
+            if (fd >= 0) {
+                ec.clear();
+                return fd;
+            }
+            int error = errno;
+            if ((error == EMFILE || error == ENFILE) && evictOne()) {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            openCount--;
+            ec = std::error_code(error, std::generic_category());
+            return -1;
+        }
+    }
+
+    void reserve(size_t limit) {
+        std::vector<int> toClose;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            while (openCount >= limit && !lru.empty()) {
+                toClose.push_back(evictLocked());
+            }
+            openCount++;
+            counters.peak = std::max(counters.peak, openCount);
+        }
+        for (int fd : toClose) {
+            ::close(fd);
+        }
+    }
+
+    bool evictOne() {
+        int fd = -1;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (lru.empty()) {
+                return false;
+            }
+            fd = evictLocked();
+        }
+        ::close(fd);
+        return true;
+    }
+
+    int evictLocked() {
+        DirectoryHandle* victim = lru.back();
+        lru.pop_back();
+        victim->inLru = false;
+        int fd = victim->fd;
+        victim->fd = -1;
+        openCount--;
+        counters.evicted++;
+        return fd;
+    }
+
+    void takeLocked(DirectoryHandle& handle) {
+        if (handle.inLru) {
+            lru.erase(handle.lruPosition);
+            handle.inLru = false;
+        }
+        handle.pins++;
+    }
+
+    void unpin(DirectoryHandle& handle) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--handle.pins == 0 && handle.fd >= 0) {
+            lru.push_front(&handle);
+            handle.lruPosition = lru.begin();
+            handle.inLru = true;
+        }
+    }
+
+    // Ō̎QƂBẻÂŃbN̊O delete 
+    void destroy(DirectoryHandle* handle) {
+        int fd = -1;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (handle->inLru) {
+                lru.erase(handle->lruPosition);
+            }
+            fd = handle->fd;
+            if (fd >= 0) {
+                openCount--;
+            }
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        delete handle;
+    }
+
+    std::mutex mutex;
+    std::list<DirectoryHandle*> lru;  // 擪ŋߎg
+    size_t openCount = 0;             // JĂ fd ƊJƂĂ镪
+    size_t budget;
+    Statistics counters;
+};
+#else
+class DirectoryHandleCache;
+#endif
+
+// zbgX|bgilȏ߂ŏ̃fBNgj1
+struct Hotspot {
+    fs::path path;
+    std::uintmax_t bytes = 0;
+    bool remainder = false;  // ꗗɂqc
+};
+
+// lȏ̕؂~BqŐłȂc肪lȏȂÃfBNggB
+// Tree  totalBytes / isDirectory / forEachChild / pathOf ؁i̖؂ƃXibvVbgjŁA
+// m[h 0 ׂ͂Ẵ[g̏̉zm[h
+template <typename Tree>
+std::uintmax_t collectHotspots(const Tree& tree, std::uint32_t node, std::uintmax_t threshold,
+                               std::vector<Hotspot>& out) {
+    std::uintmax_t inChildren = 0;
+    std::uintmax_t explained = 0;
+    tree.forEachChild(node, [&](std::uint32_t child) {
+        if (tree.isDirectory(child) && tree.totalBytes(child) >= threshold) {
+            inChildren += tree.totalBytes(child);
+            explained += collectHotspots(tree, child, threshold, out);
+        }
+    });
+    std::uintmax_t rest = tree.totalBytes(node) - inChildren;
+    if (node != 0 && rest >= threshold) {
+        out.push_back(Hotspot{ tree.pathOf(node), rest, inChildren > 0 });
+        explained += rest;
+    }
+    return explained;
+}
+
+// threshold  0 ȂŜɑ΂ fraction 猈߁A傫ɕԂ
+template <typename Tree>
+std::vector<Hotspot> findHotspots(const Tree& tree, double fraction, std::uintmax_t threshold,
+                                  std::uintmax_t& total, std::uintmax_t& explained) {
+    total = tree.totalBytes(0);
+    if (threshold == 0) {
+        threshold = static_cast<std::uintmax_t>(std::ceil(fraction * static_cast<double>(total)));
+    }
+    std::vector<Hotspot> result;
+    explained = total > 0 ? collectHotspots(tree, 0, std::max<std::uintmax_t>(threshold, 1), result) : 0;
+    std::sort(result.begin(), result.end(),
+              [](const Hotspot& a, const Hotspot& b) { return a.bytes > b.bytes; });
+    return result;
+}
+
+// XibvVbgt@Č`io[W 1jB
+// wb_Am[hzA^[Qbg̓YzAO̕\̏ 8 oCgEŕׂB
+// m[h͑OŌZ͖OiUTF-8 ̃oCgjȂ̂ŁAm[h i ̕؂ [i, end) ̘AԂɂȂB
+// m[h 0 ׂ͂Ẵ[g̏̉zm[hBǂݍ݂ mmap 邾ŉ͂͂Ȃ
+const char SNAPSHOT_MAGIC[8] = { 'D', 'W', 'S', 'N', 'A', 'P', '\r', '\n' };
+const std::uint32_t SNAPSHOT_VERSION = 1;
+const std::uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;  // Ɠǂފ̃GfBAƍ
+
+struct SnapshotHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byteOrder;
+    std::uint64_t headerSize;
+    std::uint64_t nodeCount;
+    std::uint64_t nodesOffset;
+    std::uint64_t targetCount;
+    std::uint64_t targetsOffset;   // std::uint32_t ̔z
+    std::uint64_t stringsSize;
+    std::uint64_t stringsOffset;   // UTF-8 ̖OA
+    std::uint64_t directoryCount;
+    std::int64_t createdAt;        // UNIX iimbj
+    std::uint64_t scanFingerprint; // O[Ȃǈꗗ̒gEݒ̃nbVi0 ͋L^Ȃj
+};
+
+struct SnapshotNode {
+    std::uint64_t size;        // ؂̍v
+    std::int64_t mtime;        // UNIX iimbAsȂ 0j
+    std::int64_t ctime;
+    std::uint32_t parent;
+    std::uint32_t end;         // ؂̒̃m[h
+    std::uint64_t nameOffset;
+    std::uint32_t nameLength;
+    std::uint32_t flags;
+};
+static_assert(sizeof(SnapshotNode) == 48, "snapshot node layout must not change within a version");
+static_assert(sizeof(SnapshotHeader) % 8 == 0, "snapshot sections are 8-byte aligned");
+
+const std::uint32_t SNAPSHOT_DIRECTORY = 1;
+const std::uint32_t SNAPSHOT_TARGET = 2;   // LȎΏ
+const std::uint32_t SNAPSHOT_PARTIAL = 4;  // Wvrőł؂ꂽ
+const std::uint32_t SNAPSHOT_STALE = 8;    // ߎœǂ܂AO̍vpiqm[hȂj
+const std::uint32_t SNAPSHOT_AGGREGATED = 16;  // ̃t@Cm[hɂvi\Zɂj
+
+std::string toUtf8(const fs::path::string_type& name) {
+#ifdef _WIN32
+    return fs::path(name).u8string();
+#else
+    return name;
+#endif
+}
+
+// XibvVbg̖OiUTF-8jpXɌq
+void appendSnapshotComponent(fs::path& path, const std::string& name) {
+    fs::path part = fs::u8path(name);
+    if (path.empty() || (!part.has_root_name() && !part.has_root_directory())) {
+        path /= part;
+        return;
+    }
+    // XibvVbg̃x̉̃[gi"/"  "C:"j͒ʏ̊KwƂČq
+    std::string component = toUtf8(part.native());
+    while (!component.empty() && (component.back() == '/' || component.back() == '\\')) {
+        component.pop_back();
+    }
+    if (!component.empty()) {
+        path += fs::path::preferred_separator;
+        path += fs::u8path(component);
+    }
+}
+
+// ǂݍݐpɃ}bvXibvVbgBJƂ̓wb_Ɗë͈̔͂A
+// m[hƂ̒liO͈̔́AeAendj͎QƂƂɌ
+class Snapshot {
+private:
+    const char* data = nullptr;
+    std::uint64_t length = 0;
+#ifdef _WIN32
+    void* view = nullptr;
+#elif defined(__linux__)
+    void* mapping = nullptr;
+#else
+    std::vector<std::uint64_t> buffer;  // 8 oCgEɒu
+#endif
+    const SnapshotHeader* headerData = nullptr;
+    const SnapshotNode* nodeData = nullptr;
+    const std::uint32_t* targetData = nullptr;
+    const char* strings = nullptr;
+
+    bool fits(std::uint64_t offset, std::uint64_t count, std::uint64_t unit) const {
+        return offset % 8 == 0 && offset <= length && count <= (length - offset) / unit;
+    }
+
+    bool map(const fs::path& path, std::string& error) {
+#ifdef _WIN32
+        HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            error = "cannot open " + path.string();
+            return false;
+        }
+        LARGE_INTEGER size;
+        HANDLE section = nullptr;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+            section = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        }
+        if (section) {
+            view = MapViewOfFile(section, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(section);
+        }
+        CloseHandle(file);
+        if (!view) {
+            error = "cannot map " + path.string();
+            return false;
+        }
+        data = static_cast<const char*>(view);
+        length = static_cast<std::uint64_t>(size.QuadPart);
+#elif defined(__linux__)
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            error = "cannot open " + path.string();
+            return false;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* address = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+            if (address != MAP_FAILED) {
+                mapping = address;
+                length = static_cast<std::uint64_t>(st.st_size);
+            }
+        }
+        ::close(fd);
+        if (!mapping) {
+            error = "cannot map " + path.string();
+            return false;
+        }
+        data = static_cast<const char*>(mapping);
+#else
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if (!in) {
+            error = "cannot open " + path.string();
+            return false;
+        }
+        length = static_cast<std::uint64_t>(in.tellg());
+        buffer.resize((length + 7) / 8);
+        in.seekg(0);
+        in.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(length));
+        if (!in) {
+            error = "cannot read " + path.string();
+            return false;
+        }
+        data = reinterpret_cast<const char*>(buffer.data());
+#endif
+        return true;
+    }
+
+public:
+    Snapshot() = default;
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    ~Snapshot() {
+#ifdef _WIN32
+        if (view) {
+            UnmapViewOfFile(view);
+        }
+#elif defined(__linux__)
+        if (mapping) {
+            ::munmap(mapping, static_cast<size_t>(length));
+        }
+#endif
+    }
+
+    bool open(const fs::path& path, std::string& error) {
+        if (!map(path, error)) {
+            return false;
+        }
+        headerData = reinterpret_cast<const SnapshotHeader*>(data);
+        const SnapshotHeader& h = *headerData;
+        // scanFingerprint ȂȑÕwb_[ǂ߂悤ɂ
+        const size_t minimumHeader = offsetof(SnapshotHeader, scanFingerprint);
+        if (length < sizeof(SnapshotHeader) || std::memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) != 0) {
+            error = "not a DiskWiz snapshot";
+            return false;
+        }
+        if (h.version != SNAPSHOT_VERSION) {
+            error = "unsupported snapshot version " + std::to_string(h.version);
+            return false;
+        }
+        if (h.byteOrder != SNAPSHOT_BYTE_ORDER) {
+            error = "snapshot was written on a machine with a different byte order";
+            return false;
+        }
+        if (h.headerSize < minimumHeader || h.nodeCount == 0 ||
+            h.nodeCount > std::numeric_limits<std::uint32_t>::max() ||
+            !fits(h.nodesOffset, h.nodeCount, sizeof(SnapshotNode)) ||
+            !fits(h.targetsOffset, h.targetCount, sizeof(std::uint32_t)) ||
+            !fits(h.stringsOffset, h.stringsSize, 1) || h.nodesOffset < h.headerSize) {
+            error = "snapshot is truncated or corrupt";
+            return false;
+        }
+        nodeData = reinterpret_cast<const SnapshotNode*>(data + h.nodesOffset);
+        targetData = reinterpret_cast<const std::uint32_t*>(data + h.targetsOffset);
+        strings = data + h.stringsOffset;
+        return true;
+    }
+
+    const SnapshotHeader& header() const {
+        return *headerData;
+    }
+
+    // ̐ݒ̃nbViL^̂ȂȑÕXibvVbgł 0j
+    std::uint64_t scanFingerprint() const {
+        return headerData->headerSize >= sizeof(SnapshotHeader) ? headerData->scanFingerprint : 0;
+    }
+
+    std::uint32_t size() const {
+        return static_cast<std::uint32_t>(headerData->nodeCount);
+    }
+
+    const SnapshotNode& node(std::uint32_t index) const {
+        return nodeData[index];
+    }
+
+    // ^[Qbg̓Yi͈͊Ô͓̂ǂݔ΂j
+    template <typename Function>
+    void forEachTarget(Function&& function) const {
+        for (std::uint64_t i = 0; i < headerData->targetCount; ++i) {
+            if (targetData[i] < size()) {
+                function(targetData[i]);
+            }
+        }
+    }
+
+    std::string_view nameView(std::uint32_t index) const {
+        const SnapshotNode& n = nodeData[index];
+        if (n.nameOffset > headerData->stringsSize || n.nameLength > headerData->stringsSize - n.nameOffset) {
+            return std::string_view();
+        }
+        return std::string_view(strings + n.nameOffset, n.nameLength);
+    }
+
+    std::string name(std::uint32_t index) const {
+        return std::string(nameView(index));
+    }
+
+    // findHotspots gǂݎp̃ANZT
+    std::uintmax_t totalBytes(std::uint32_t index) const {
+        return nodeData[index].size;
+    }
+
+    bool isDirectory(std::uint32_t index) const {
+        return (nodeData[index].flags & SNAPSHOT_DIRECTORY) != 0;
+    }
+
+    std::uint32_t flags(std::uint32_t index) const {
+        return nodeData[index].flags;
+    }
+
+    // }bvĂ傫
+    std::uint64_t mappedBytes() const {
+        return length;
+    }
+
+    // q͕؂̋ԂщzȂH: for (c = firstChild(i); c != 0; c = nextSibling(i, c))B
+    // ꂽ end Ŏ~܂Ȃ悤AOiȂꍇe̋Ԃoꍇ͑ł؂
+    std::uint32_t firstChild(std::uint32_t index) const {
+        return index + 1 < std::min(nodeData[index].end, size()) ? index + 1 : 0;
+    }
+
+    std::uint32_t nextSibling(std::uint32_t parent, std::uint32_t child) const {
+        std::uint32_t next = nodeData[child].end;
+        return next > child && next < std::min(nodeData[parent].end, size()) ? next : 0;
+    }
+
+    template <typename Function>
+    void forEachChild(std::uint32_t index, Function&& function) const {
+        for (std::uint32_t child = firstChild(index); child != 0; child = nextSibling(index, child)) {
+            function(child);
+        }
+    }
+
+    // ؂̋ԁig܂ށj
+    std::uint32_t subtreeEnd(std::uint32_t index) const {
+        return std::max(index + 1, std::min(nodeData[index].end, size()));
+    }
+
+    fs::path pathOf(std::uint32_t index) const {
+        std::vector<std::uint32_t> chain;
+        while (index != 0 && index < size()) {
+            chain.push_back(index);
+            std::uint32_t parent = nodeData[index].parent;
+            if (parent >= index) {
+                break;
+            }
+            index = parent;
+        }
+        fs::path path;
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+            appendSnapshotComponent(path, name(*it));
+        }
+        return path;
+    }
+
+    std::vector<Hotspot> hotspots(double fraction, std::uintmax_t threshold,
+                                  std::uintmax_t& total, std::uintmax_t& explained) const {
+        return findHotspots(*this, fraction, threshold, total, explained);
+    }
+
+    // pXɑΉm[hiȂ 0jBZɒĤŁA^[Qbg̓ȂǏ̌Ɏg
+    std::uint32_t find(const fs::path& path) const {
+        std::uint32_t index = 0;
+        for (const auto& part : path) {
+            std::string wanted = toUtf8(part.native());
+            std::uint32_t found = 0;
+            forEachChild(index, [&](std::uint32_t child) {
+                if (found == 0 && name(child) == wanted) {
+                    found = child;
+                }
+            });
+            if (found == 0) {
+                return 0;
+            }
+            index = found;
+        }
+        return index;
+    }
+
+    // TufBNg̖OYւ̑Ή
+    std::map<std::string, std::uint32_t> childDirectories(std::uint32_t index) const {
+        std::map<std::string, std::uint32_t> children;
+        forEachChild(index, [&](std::uint32_t child) {
+            if (isDirectory(child)) {
+                children.emplace(name(child), child);
+            }
+        });
+        return children;
+    }
+};
+
+// 傫Ȕz̗̈BHUGE_PAGE_SIZE ȏ̗v̔{ɐ؂グĒڃ}bvA
+// 傫ȃy[W TLB ̃~X炷B\񂳂ꂽ傫ȃy[WgȂΒʏ̃y[Wɖ߂
+class HugePageArena {
+public:
+    static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    struct Statistics {
+        std::uint64_t regions = 0;          // ̈
+        std::uint64_t bytes = 0;
+        std::uint64_t explicitRegions = 0;  // ̂\񂳂ꂽ傫ȃy[Ŵ
+        std::uint64_t fallbacks = 0;        // \񂳂ꂽ傫ȃy[WmۂłȂ
+    };
+
+private:
+    struct State {
+        std::atomic<HugePageMode> mode{ HugePageMode::Transparent };
+        std::atomic<std::uint64_t> regions{ 0 };
+        std::atomic<std::uint64_t> bytes{ 0 };
+        std::atomic<std::uint64_t> explicitRegions{ 0 };
+        std::atomic<std::uint64_t> fallbacks{ 0 };
+    };
+
+    static State& state() {
+        static State instance;
+        return instance;
+    }
+
+    static size_t roundUp(size_t bytes, size_t unit) {
+        return (bytes + unit - 1) / unit * unit;
+    }
+
+#ifdef _WIN32
+    // [Wy[Wɂ SeLockMemoryPrivilege vBĂΈxLɂ
+    static bool enableLockMemoryPrivilege() {
+        static const bool enabled = [] {
+            HANDLE token = nullptr;
+            if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+                return false;
+            }
+            TOKEN_PRIVILEGES privileges{};
+            privileges.PrivilegeCount = 1;
+            privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+            bool ok = LookupPrivilegeValueW(nullptr, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid) &&
+                AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr) &&
+                GetLastError() == ERROR_SUCCESS;
+            CloseHandle(token);
+            return ok;
+        }();
+        return enabled;
+    }
+#endif
+
+public:
+    // ŏ̊mۂOɌĂԂƁiHugePageAllocator ͊mۂƉœ[hj
+    static void setMode(HugePageMode mode) {
+        state().mode = mode;
+    }
+
+    static HugePageMode mode() {
+        return state().mode.load();
+    }
+
+    static void* allocate(size_t bytes) {
+        State& s = state();
+        HugePageMode mode = s.mode.load(std::memory_order_relaxed);
+        void* region = nullptr;
+#ifdef _WIN32
+        if (mode == HugePageMode::Explicit) {
+            SIZE_T large = GetLargePageMinimum();
+            if (large > 0 && enableLockMemoryPrivilege()) {
+                region = VirtualAlloc(nullptr, roundUp(bytes, large), MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                                      PAGE_READWRITE);
+            }
+            ++(region ? s.explicitRegions : s.fallbacks);
+        }
+        if (!region) {
+            region = VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        }
+        if (!region) {
+            throw std::bad_alloc();
+        }
+#elif defined(__linux__)
+        size_t length = roundUp(bytes, HUGE_PAGE_SIZE);
+#ifdef MAP_HUGETLB
+        if (mode == HugePageMode::Explicit) {
+            void* mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                                -1, 0);
+            region = mapped == MAP_FAILED ? nullptr : mapped;
+            ++(region ? s.explicitRegions : s.fallbacks);
+        }
+#endif
+        if (!region) {
+            // 傫ȃy[W̋Eɑ邽ߗ]Ƀ}bvAO̒[Ԃ
+            void* mapped = mmap(nullptr, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mapped == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            auto start = reinterpret_cast<std::uintptr_t>(mapped);
+            size_t head = roundUp(start, HUGE_PAGE_SIZE) - start;
+            if (head > 0) {
+                munmap(mapped, head);
+            }
+            munmap(reinterpret_cast<void*>(start + head + length), HUGE_PAGE_SIZE - head);
+            region = reinterpret_cast<void*>(start + head);
+#ifdef MADV_HUGEPAGE
+            madvise(region, length, MADV_HUGEPAGE);
+#endif
+        }
+#else
+        (void)mode;
+        region = ::operator new(bytes);
+#endif
+        ++s.regions;
+        s.bytes += bytes;
+        return region;
+    }
+
+    static void release(void* region, size_t bytes) {
+        State& s = state();
+#ifdef _WIN32
+        VirtualFree(region, 0, MEM_RELEASE);
+#elif defined(__linux__)
+        munmap(region, roundUp(bytes, HUGE_PAGE_SIZE));
+#else
+        ::operator delete(region);
+#endif
+        --s.regions;
+        s.bytes -= bytes;
+    }
+
+    static Statistics statistics() {
+        State& s = state();
+        Statistics result;
+        result.regions = s.regions.load();
+        result.bytes = s.bytes.load();
+        result.explicitRegions = s.explicitRegions.load();
+        result.fallbacks = s.fallbacks.load();
+        return result;
+    }
+};
+
+// 傫ȗv HugePageArena AP[^î --huge-pages off ł͒ʏǂB
+// off ő}bvgƁAVXe THP ݒ肪 always Ȃ傫ȃy[WɍڂĂ܂j
+template <typename T>
+class HugePageAllocator {
+    static bool fromArena(size_t count) {
+        return count * sizeof(T) >= HugePageArena::HUGE_PAGE_SIZE && HugePageArena::mode() != HugePageMode::Off;
+    }
+
+public:
+    using value_type = T;
+
+    HugePageAllocator() = default;
+
+    template <typename U>
+    HugePageAllocator(const HugePageAllocator<U>&) {}
+
+    T* allocate(size_t count) {
+        if (fromArena(count)) {
+            return static_cast<T*>(HugePageArena::allocate(count * sizeof(T)));
+        }
+        return std::allocator<T>().allocate(count);
+    }
+
+    void deallocate(T* pointer, size_t count) {
+        if (fromArena(count)) {
+            HugePageArena::release(pointer, count * sizeof(T));
+        } else {
+            std::allocator<T>().deallocate(pointer, count);
+        }
+    }
+
+    template <typename U>
+    bool operator==(const HugePageAllocator<U>&) const {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const HugePageAllocator<U>&) const {
+        return false;
+    }
+};
+
+template <typename T>
+using HugePageVector = std::vector<T, HugePageAllocator<T>>;
+
+// ĂяoXbh dTLB ̓ǂݍ݃~X perf_event_open ŐigȂ valid()  falsej
+class TlbMissCounter {
+private:
+    int fd = -1;
+
+public:
+    TlbMissCounter() {
+#ifdef __linux__
+        struct perf_event_attr attr {};
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+
+    TlbMissCounter(const TlbMissCounter&) = delete;
+    TlbMissCounter& operator=(const TlbMissCounter&) = delete;
+
+    ~TlbMissCounter() {
+#ifdef __linux__
+        if (fd >= 0) {
+            close(fd);
+        }
+#endif
+    }
+
+    bool valid() const {
+        return fd >= 0;
+    }
+
+    void start() {
+#ifdef __linux__
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    std::uint64_t stop() {
+        std::uint64_t count = 0;
+#ifdef __linux__
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &count, sizeof(count)) != static_cast<ssize_t>(sizeof(count))) {
+                count = 0;
+            }
+        }
+#endif
+        return count;
+    }
+};
+
+// 64 rbg 1 ̐
+inline int popcount64(std::uint64_t word) {
+#ifdef _MSC_VER
+    return static_cast<int>(__popcnt64(word));
+#else
+    return __builtin_popcountll(word);
+#endif
+}
+
+// rankiʒuO 1 ̐j selectik Ԗڂ 1  0 ̈ʒujǂݍݐp̃rbgB
+// 512 rbg̃ubNƂɁA擪܂ł 1 ̐ƁAubN̊e̎O܂ł̐i9 rbg ~ 7j
+// 2 Ŏirank9jBselect  512 Ƃ̕W{ōiĂubN񕪒T
+class RankSelectBits {
+private:
+    static const std::uint64_t BLOCK_WORDS = 8;
+    static const std::uint64_t SAMPLE = 512;
+    HugePageVector<std::uint64_t> words;
+    HugePageVector<std::uint64_t> counts;      // ubNƂ (擪܂ł 1 ̐, ꂲƂ̑Βl)BŌ͑S
+    std::vector<std::uint64_t> oneSamples;   // k*SAMPLE Ԗڂ 1 ܂ރubN
+    std::vector<std::uint64_t> zeroSamples;
+    std::uint64_t length = 0;
+
+    std::uint64_t blockBits() const {
+        return BLOCK_WORDS * 64;
+    }
+
+    std::uint64_t onesBefore(std::uint64_t block) const {
+        return counts[block * 2];
+    }
+
+    std::uint64_t zerosBefore(std::uint64_t block) const {
+        return block * blockBits() - counts[block * 2];
+    }
+
+    // ubŇ wordi0..7j̎O܂ł 1 ̐
+    std::uint64_t onesInBlockBefore(std::uint64_t block, std::uint64_t word) const {
+        return word == 0 ? 0 : counts[block * 2 + 1] >> (9 * (word - 1)) & 0x1FF;
+    }
+
+    // ̒ k Ԗځi0 n܂j 1 ̈ʒuBoCgƂ̗ݐςZŋ߁Aݐς k ȉ̃oCg̐
+    // ȂɐĖړĨoCg߁AoCg͕̒\ň
+    static std::uint64_t selectInWord(std::uint64_t word, std::uint64_t k) {
+        const std::uint64_t ONES = 0x0101010101010101ULL;
+        const std::uint64_t HIGHS = 0x8080808080808080ULL;
+        static const auto inByte = [] {
+            std::array<std::array<std::uint8_t, 8>, 256> table{};
+            for (unsigned byte = 0; byte < 256; ++byte) {
+                unsigned rank = 0;
+                for (unsigned bit = 0; bit < 8; ++bit) {
+                    if ((byte >> bit & 1) != 0) {
+                        table[byte][rank++] = static_cast<std::uint8_t>(bit);
+                    }
+                }
+            }
+            return table;
+        }();
+        std::uint64_t bytes = word - ((word >> 1) & 0x5555555555555555ULL);
+        bytes = (bytes & 0x3333333333333333ULL) + ((bytes >> 2) & 0x3333333333333333ULL);
+        bytes = (bytes + (bytes >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+        std::uint64_t cumulative = bytes * ONES;
+        std::uint64_t covered = ((((k * ONES) | HIGHS) - cumulative) & HIGHS) >> 7;
+        std::uint64_t base = (covered * ONES >> 56) * 8;
+        std::uint64_t before = base == 0 ? 0 : cumulative >> (base - 8) & 0xFF;
+        return base + inByte[word >> base & 0xFF][k - before];
+    }
+
+    // W{ōi͈͂AcountBefore(b) <= k ƂȂŌ̃ubN񕪒T
+    template <typename CountBefore>
+    std::uint64_t findBlock(const std::vector<std::uint64_t>& samples, std::uint64_t k,
+                            CountBefore&& countBefore) const {
+        std::uint64_t s = k / SAMPLE;
+        std::uint64_t low = samples[s];
+        std::uint64_t high = s + 1 < samples.size() ? samples[s + 1] : counts.size() / 2 - 2;
+        while (low < high) {
+            std::uint64_t middle = (low + high + 1) / 2;
+            if (countBefore(middle) <= k) {
+                low = middle;
+            } else {
+                high = middle - 1;
+            }
+        }
+        return low;
+    }
+
+public:
+    void push(bool bit) {
+        if (length % 64 == 0) {
+            words.push_back(0);
+        }
+        if (bit) {
+            words.back() |= 1ULL << (length % 64);
+        }
+        ++length;
+    }
+
+    // ǉIčBŌ̃ubN̗] 0 ̌Ŗ߂
+    void finish() {
+        std::uint64_t blocks = (words.size() + BLOCK_WORDS - 1) / BLOCK_WORDS;
+        words.resize(blocks * BLOCK_WORDS, 0);
+        words.shrink_to_fit();
+        counts.assign((blocks + 1) * 2, 0);
+        std::uint64_t total = 0;
+        for (std::uint64_t b = 0; b < blocks; ++b) {
+            counts[b * 2] = total;
+            std::uint64_t inBlock = 0;
+            for (std::uint64_t w = 0; w < BLOCK_WORDS; ++w) {
+                if (w > 0) {
+                    counts[b * 2 + 1] |= inBlock << (9 * (w - 1));
+                }
+                inBlock += static_cast<std::uint64_t>(popcount64(words[b * BLOCK_WORDS + w]));
+            }
+            total += inBlock;
+        }
+        counts[blocks * 2] = total;
+        oneSamples.clear();
+        zeroSamples.clear();
+        std::uint64_t zeros = length - total;
+        for (std::uint64_t b = 0; b < blocks; ++b) {
+            while (oneSamples.size() * SAMPLE < onesBefore(b + 1)) {
+                oneSamples.push_back(b);
+            }
+            while (zeroSamples.size() * SAMPLE < std::min(zerosBefore(b + 1), zeros)) {
+                zeroSamples.push_back(b);
+            }
+        }
+        oneSamples.shrink_to_fit();
+        zeroSamples.shrink_to_fit();
+    }
+
+    std::uint64_t size() const {
+        return length;
+    }
+
+    // [0, position)  1 ̐
+    std::uint64_t rank1(std::uint64_t position) const {
+        std::uint64_t block = position / blockBits();
+        std::uint64_t word = position / 64;
+        std::uint64_t result = onesBefore(block) + onesInBlockBefore(block, word % BLOCK_WORDS);
+        if (position % 64 != 0) {
+            result += static_cast<std::uint64_t>(popcount64(words[word] & ((1ULL << (position % 64)) - 1)));
+        }
+        return result;
+    }
+
+    // k Ԗځi0 n܂j 1 ̈ʒu
+    std::uint64_t select1(std::uint64_t k) const {
+        std::uint64_t block = findBlock(oneSamples, k, [this](std::uint64_t b) { return onesBefore(b); });
+        k -= onesBefore(block);
+        std::uint64_t word = BLOCK_WORDS - 1;
+        while (onesInBlockBefore(block, word) > k) {
+            --word;
+        }
+        k -= onesInBlockBefore(block, word);
+        word += block * BLOCK_WORDS;
+        return word * 64 + selectInWord(words[word], k);
+    }
+
+    // k Ԗځi0 n܂j 0 ̈ʒu
+    std::uint64_t select0(std::uint64_t k) const {
+        std::uint64_t block = findBlock(zeroSamples, k, [this](std::uint64_t b) { return zerosBefore(b); });
+        k -= zerosBefore(block);
+        std::uint64_t word = BLOCK_WORDS - 1;
+        while (word * 64 - onesInBlockBefore(block, word) > k) {
+            --word;
+        }
+        k -= word * 64 - onesInBlockBefore(block, word);
+        word += block * BLOCK_WORDS;
+        return word * 64 + selectInWord(~words[word], k);
+    }
+
+    // position ȍ~ōŏ 0 ̈ʒui 0 邱Ɓj
+    std::uint64_t nextZero(std::uint64_t position) const {
+        std::uint64_t w = position / 64;
+        std::uint64_t free = ~words[w] & (~0ULL << (position % 64));
+        while (free == 0) {
+            free = ~words[++w];
+        }
+        return w * 64 + static_cast<std::uint64_t>(popcount64((free & (~free + 1)) - 1));
+    }
+
+    std::uint64_t memoryBytes() const {
+        return (words.capacity() + counts.capacity() + oneSamples.capacity() + zeroSamples.capacity()) *
+            sizeof(std::uint64_t);
+    }
+};
+
+// 64 ƂɁÃubN̍ől܂rbgŋl߂B
+// t@CԋԂ͋ɂȂ
+class PackedIntegers {
+private:
+    static const size_t BLOCK = 64;
+    HugePageVector<std::uint64_t> bits;
+    std::vector<std::uint64_t> blockOffsets;  // ubN̐擪̃rbgʒu
+    std::vector<std::uint8_t> widths;
+    std::vector<std::uint64_t> pending;
+    std::uint64_t used = 0;
+
+    void write(std::uint64_t value, unsigned width) {
+        if (width == 0) {
+            return;
+        }
+        while (bits.size() * 64 < used + width) {
+            bits.push_back(0);
+        }
+        unsigned shift = static_cast<unsigned>(used % 64);
+        bits[used / 64] |= value << shift;
+        if (shift + width > 64) {
+            bits[used / 64 + 1] |= value >> (64 - shift);
+        }
+        used += width;
+    }
+
+    void flush() {
+        std::uint64_t largest = *std::max_element(pending.begin(), pending.end());
+        unsigned width = 0;
+        for (; width < 64 && (largest >> width) != 0; ++width) {
+        }
+        widths.push_back(static_cast<std::uint8_t>(width));
+        blockOffsets.push_back(used);
+        for (std::uint64_t value : pending) {
+            write(value, width);
+        }
+        pending.clear();
+    }
+
+public:
+    void push(std::uint64_t value) {
+        pending.push_back(value);
+        if (pending.size() == BLOCK) {
+            flush();
+        }
+    }
+
+    void finish() {
+        if (!pending.empty()) {
+            flush();
+        }
+        pending.shrink_to_fit();
+        bits.shrink_to_fit();
+        blockOffsets.shrink_to_fit();
+        widths.shrink_to_fit();
+    }
+
+    std::uint64_t operator[](std::uint64_t index) const {
+        std::uint64_t block = index / BLOCK;
+        unsigned width = widths[block];
+        if (width == 0) {
+            return 0;
+        }
+        std::uint64_t position = blockOffsets[block] + (index % BLOCK) * width;
+        unsigned shift = static_cast<unsigned>(position % 64);
+        std::uint64_t value = bits[position / 64] >> shift;
+        if (shift + width > 64) {
+            value |= bits[position / 64 + 1] << (64 - shift);
+        }
+        return width == 64 ? value : value & ((1ULL << width) - 1);
+    }
+
+    std::uint64_t memoryBytes() const {
+        return (bits.capacity() + blockOffsets.capacity()) * sizeof(std::uint64_t) + widths.capacity();
+    }
+};
+
+// I؂ǂݍݐpɋl߂́Bm[h͕D̏ɔԍUA
+//   `: LOUDSi"10" ɑĊem[h̎q̐ 1 Ƌ؂ 0BZ͘AԍɂȂj
+//   ؂̍v: PackedIntegers
+//   O: 16 Ƃ̋؂肩Ae̒ǑZƂ̋ʕȂāiOkjׂ
+//   tO: fBNgǂ̃rbgƁAȊÕtO̃m[ḧꗗ
+// ŎB͎ȂBTree  findHotspots ƓANZT name / flags ؁iZ͖Oj
+class FrozenTree {
+private:
+    static const std::uint32_t NAME_BUCKET = 16;
+    RankSelectBits topology;
+    PackedIntegers sizes;
+    std::vector<std::uint64_t> directoryBits;
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> marked;  // (m[h, tO) ԍ
+    HugePageVector<char> names;
+    std::vector<std::uint64_t> nameBuckets;  // NAME_BUCKET Ƃ names ̈ʒu
+    std::uint32_t nodeCount = 0;
+
+    static void putVarint(HugePageVector<char>& out, std::uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    std::uint64_t getVarint(std::uint64_t& position) const {
+        std::uint64_t value = 0;
+        for (int shift = 0; position < names.size() && shift < 64; shift += 7) {
+            auto byte = static_cast<unsigned char>(names[position++]);
+            value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                break;
+            }
+        }
+        return value;
+    }
+
+    // m[h̎q LOUDS ̊Jnʒu
+    std::uint64_t childrenStart(std::uint32_t node) const {
+        return topology.select0(node) + 1;
+    }
+
+public:
+    // ؂𕝗DŒHċl߂Bm[h 32 rbg̔ԍɎ܂Ȃ false
+    template <typename Tree>
+    bool build(const Tree& tree) {
+        *this = FrozenTree();
+        std::vector<std::uint32_t> order{ 0 };    // ԍ  ̖؂̃m[h
+        std::vector<bool> groupStart{ true };     // e̍ŏ̎q
+        topology.push(true);
+        topology.push(false);
+        std::string previous;
+        for (size_t i = 0; i < order.size(); ++i) {
+            std::uint32_t source = order[i];
+            bool first = true;
+            tree.forEachChild(source, [&](std::uint32_t child) {
+                order.push_back(child);
+                groupStart.push_back(first);
+                first = false;
+                topology.push(true);
+            });
+            topology.push(false);
+            if (order.size() > std::numeric_limits<std::uint32_t>::max()) {
+                *this = FrozenTree();
+                return false;
+            }
+
+            sizes.push(tree.totalBytes(source));
+            std::uint32_t flags = tree.flags(source);
+            if (i % 64 == 0) {
+                directoryBits.push_back(0);
+            }
+            if ((flags & SNAPSHOT_DIRECTORY) != 0) {
+                directoryBits.back() |= 1ULL << (i % 64);
+            }
+            if ((flags & ~SNAPSHOT_DIRECTORY) != 0) {
+                marked.emplace_back(static_cast<std::uint32_t>(i), flags & ~SNAPSHOT_DIRECTORY);
+            }
+
+            std::string name = i == 0 ? std::string() : tree.name(source);
+            size_t shared = 0;
+            if (i % NAME_BUCKET == 0) {
+                nameBuckets.push_back(names.size());
+            } else if (!groupStart[i]) {
+                size_t limit = std::min(previous.size(), name.size());
+                while (shared < limit && previous[shared] == name[shared]) {
+                    ++shared;
+                }
+            }
+            putVarint(names, shared);
+            putVarint(names, name.size() - shared);
+            names.insert(names.end(), name.begin() + static_cast<std::ptrdiff_t>(shared), name.end());
+            previous = std::move(name);
+        }
+        nodeCount = static_cast<std::uint32_t>(order.size());
+        topology.finish();
+        sizes.finish();
+        directoryBits.shrink_to_fit();
+        marked.shrink_to_fit();
+        names.shrink_to_fit();
+        nameBuckets.shrink_to_fit();
+        return true;
+    }
+
+    std::uint32_t size() const {
+        return nodeCount;
+    }
+
+    std::uintmax_t totalBytes(std::uint32_t node) const {
+        return sizes[node];
+    }
+
+    bool isDirectory(std::uint32_t node) const {
+        return (directoryBits[node / 64] >> (node % 64) & 1) != 0;
+    }
+
+    std::uint32_t flags(std::uint32_t node) const {
+        auto it = std::lower_bound(marked.begin(), marked.end(), std::make_pair(node, 0U));
+        std::uint32_t result = isDirectory(node) ? SNAPSHOT_DIRECTORY : 0;
+        return it != marked.end() && it->first == node ? result | it->second : result;
+    }
+
+    // eim[h 0  0jBnode Ԗڂ 1 ̑Oɂ 0 ̐ 1 
+    std::uint32_t parent(std::uint32_t node) const {
+        return node == 0 ? 0 : static_cast<std::uint32_t>(topology.select1(node) - node - 1);
+    }
+
+    // q͘Aԍ [first, first + count)BJnʒu̎Oɂ 0 傤 node + 1 ̂ŁA
+    // ŏ̎q̔ԍiO 1 ̐j rank ɋ܂
+    void children(std::uint32_t node, std::uint32_t& first, std::uint32_t& count) const {
+        std::uint64_t start = childrenStart(node);
+        first = static_cast<std::uint32_t>(start - node - 1);
+        count = static_cast<std::uint32_t>(topology.nextZero(start) - start);
+    }
+
+    template <typename Function>
+    void forEachChild(std::uint32_t node, Function&& function) const {
+        std::uint32_t first = 0, count = 0;
+        children(node, first, count);
+        for (std::uint32_t child = first; child < first + count; ++child) {
+            function(child);
+        }
+    }
+
+    std::string name(std::uint32_t node) const {
+        std::uint64_t position = nameBuckets[node / NAME_BUCKET];
+        std::string current;
+        for (std::uint32_t i = node / NAME_BUCKET * NAME_BUCKET;; ++i) {
+            std::uint64_t shared = getVarint(position);
+            std::uint64_t suffix = getVarint(position);
+            current.resize(std::min<std::uint64_t>(shared, current.size()));
+            current.append(names.data() + position, static_cast<size_t>(suffix));
+            position += suffix;
+            if (i == node) {
+                return current;
+            }
+        }
+    }
+
+    fs::path pathOf(std::uint32_t node) const {
+        std::vector<std::uint32_t> chain;
+        for (; node != 0; node = parent(node)) {
+            chain.push_back(node);
+        }
+        fs::path path;
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+            appendSnapshotComponent(path, name(*it));
+        }
+        return path;
+    }
+
+    template <typename Function>
+    void forEachTarget(Function&& function) const {
+        for (const auto& entry : marked) {
+            if ((entry.second & SNAPSHOT_TARGET) != 0) {
+                function(entry.first);
+            }
+        }
+    }
+
+    std::vector<Hotspot> hotspots(double fraction, std::uintmax_t threshold,
+                                  std::uintmax_t& total, std::uintmax_t& explained) const {
+        return findHotspots(*this, fraction, threshold, total, explained);
+    }
+
+    // ȇ傫ioCgj
+    std::uint64_t topologyBytes() const {
+        return topology.memoryBytes();
+    }
+
+    std::uint64_t sizeBytes() const {
+        return sizes.memoryBytes();
+    }
+
+    std::uint64_t nameBytes() const {
+        return names.capacity() + nameBuckets.capacity() * sizeof(std::uint64_t);
+    }
+
+    std::uint64_t flagBytes() const {
+        return directoryBits.capacity() * sizeof(std::uint64_t) +
+            marked.capacity() * sizeof(std::pair<std::uint32_t, std::uint32_t>);
+    }
+
+    std::uint64_t memoryBytes() const {
+        return sizeof(*this) + topologyBytes() + sizeBytes() + nameBytes() + flagBytes();
+    }
+};
+
+// t@C UNIX iimbjɂBC++17 ɂ clock_cast Ȃ̂Ōݎ̍ŊZ
+std::int64_t toUnixNanoseconds(fs::file_time_type time) {
+    auto sinceNow = time - fs::file_time_type::clock::now();
+    auto system = std::chrono::system_clock::now() +
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(sinceNow);
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(system.time_since_epoch()).count();
+}
+
+#ifdef __linux__
+std::int64_t toUnixNanoseconds(const struct timespec& time) {
+    return static_cast<std::int64_t>(time.tv_sec) * 1000000000LL + time.tv_nsec;
+}
+#endif
+
+// 1̃^[Qbg𑖍ۂ̐ݒƋL
+// ̃Nt@CifoCXinodeԍĵA蓖Ă𐔂
+class HardLinkSet {
+    std::mutex mutex;
+    std::set<std::pair<std::uint64_t, std::uint64_t>> seen;
+
+public:
+    // ߂Č̂Ȃ true
+    bool insert(std::uint64_t device, std::uint64_t inode) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return seen.emplace(device, inode).second;
+    }
+};
+
+// ̒fЂƖT̃fBNgi`͌j
+struct TreeFragment;
+struct DirectoryWork;
+
+struct TraversalContext {
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    ScanStats* stats = nullptr;
+    IoThrottle* throttle = nullptr;
+    std::uint64_t device = 0;                         // Xbgp̃foCX
+    std::atomic<std::uintmax_t>* progress = nullptr;  // ro߂̌J
+    const std::atomic<bool>* stop = nullptr;          // ł؂v
+    std::uint64_t stayOnDevice = 0;                   // 0 ȊOȂ炱̃foCX̊Oւ͍~Ȃ
+    const ExclusionSet* exclusions = nullptr;         // ɓKp鏜O[
+    DirectoryHandleCache* handles = nullptr;          // ݒ肳Ă fd ΂őiLinuxj
+    const std::vector<FileIdentity>* otherRoots = nullptr;  // ̃[giɂ͍~Ȃj
+    const Snapshot* previous = nullptr;               // ̊ɂÕXibvVbg
+    bool trustUnchanged = false;                      // ςĂȂfBNg̃t@C stat Ȃ
+    std::uintmax_t pruneBelow = 0;                    // O̍vꖢ̕ςĂȂ؂ɂ͍~Ȃ
+    std::atomic<std::uintmax_t>* stale = nullptr;     // O̒lgoCǧJ
+    std::atomic<std::uintmax_t>* allocated = nullptr; // 蓖čς݃oCǧJigpʂ̏pj
+    std::uint64_t allocationDevice = 0;               // 蓖Ă𐔂t@CVXeigpʂ𑪂́j
+    HardLinkSet* hardLinks = nullptr;                 // 蓖Ă𐔂n[hN
+    // \Z𒴂Ă΁AfЂ̂ǂݏI؂oiTraversalState::mutex ێČĂԁj
+    std::function<void(TreeFragment&, std::vector<DirectoryWork>&)> spillFinished;
+
+    bool stopRequested() const {
+        return cancelRequested.load(std::memory_order_relaxed) ||
+            (stop && stop->load(std::memory_order_relaxed));
+    }
+};
+
+#ifdef __linux__
+bool isVirtualFilesystemType(unsigned long type) {
+    switch (type) {
+    case 0x9FA0:      // proc
+    case 0x62656572:  // sysfs
+    case 0x0027E0EB:  // cgroup
+    case 0x63677270:  // cgroup2
+    case 0x00001CD1:  // devpts
+    case 0x64626720:  // debugfs
+    case 0x74726163:  // tracefs
+    case 0x73636673:  // securityfs
+    case 0x6165676C:  // pstore
+    case 0xCAFE4A11:  // bpf
+    case 0x62656570:  // configfs
+    case 0x65735543:  // fusectl
+    case 0x958458F6:  // hugetlbfs
+    case 0x19800202:  // mqueue
+    case 0x42494E4D:  // binfmt_misc
+    case 0x00000187:  // autofsiHƃ}Egj
+    case 0x6E736673:  // nsfs
+    case 0xF97CFF8C:  // selinuxfs
+    case 0xDE5E81E4:  // efivarfs
+    case 0x67596969:  // rpc_pipefs
+        return true;
+    default:
+        return false;
+    }
+}
+
+// devtmpfs  f_type  tmpfs Ɠ TMPFS_MAGIC Ȃ̂ŁA}WbNԍł͌ȂB
+// /proc/self/mountinfo ̃t@CVXeŔ肷iNɑ邱Ƃ͂܂Ȃ̂ňxǂށj
+bool isDevtmpfsDevice(std::uint64_t device) {
+    static const std::vector<std::uint64_t> devices = [] {
+        std::vector<std::uint64_t> result;
+        std::ifstream in("/proc/self/mountinfo");
+        std::string line;
+        while (std::getline(in, line)) {
+            // "ID eID major:minor [g }Eg IvV [Cӂ̗...] -  \[X IvV"
+            std::istringstream fields(line);
+            std::string id, parent, number, field;
+            unsigned int majorNumber = 0, minorNumber = 0;
+            if (!(fields >> id >> parent >> number) ||
+                std::sscanf(number.c_str(), "%u:%u", &majorNumber, &minorNumber) != 2) {
+                continue;
+            }
+            while (fields >> field && field != "-") {
+            }
+            if (fields >> field && field == "devtmpfs") {
+                result.push_back(static_cast<std::uint64_t>(makedev(majorNumber, minorNumber)));
+            }
+        }
+        return result;
+    }();
+    return std::find(devices.begin(), devices.end(), device) != devices.end();
+}
+
+// foCXPʂ̔BfoCX̎ނ͂قƂǕςȂ̂ŁAXbhƂɃLbV
+template <typename IsVirtual>
+bool shouldSkipDevice(std::uint64_t device, std::uint64_t stayOnDevice, IsVirtual&& isVirtual) {
+    if (stayOnDevice != 0 && device != stayOnDevice) {
+        return true;
+    }
+    thread_local std::map<std::uint64_t, bool> virtualByDevice;
+    auto it = virtualByDevice.find(device);
+    if (it != virtualByDevice.end()) {
+        return it->second;
+    }
+    bool result = isVirtual() || isDevtmpfsDevice(device);
+    virtualByDevice[device] = result;
+    return result;
+}
+#endif
+
+// zt@CVXeiproc, sysfs, cgroup ȂǁjǂBpXł͂Ȃ f_type ̃}WbNԍŔ肷
+bool isVirtualFilesystem(const fs::path& p) {
+#ifdef __linux__
+    struct statfs st;
+    if (::statfs(p.c_str(), &st) != 0) {
+        return false;
+    }
+    return isVirtualFilesystemType(static_cast<unsigned long>(st.f_type));
+#else
+    (void)p;
+    return false;
+#endif
+}
+
+// fBNg𑖍ΏۂOׂizt@CVXeA܂ stayOnDevice ȊÕfoCXj
+bool shouldSkipDirectory(const fs::path& dir, std::uint64_t stayOnDevice) {
+#ifdef __linux__
+    struct stat st;
+    if (::lstat(dir.c_str(), &st) != 0) {
+        return false;
+    }
+    return shouldSkipDevice(static_cast<std::uint64_t>(st.st_dev), stayOnDevice,
+                            [&dir]() { return isVirtualFilesystem(dir); });
+#else
+    (void)dir;
+    (void)stayOnDevice;
+    return false;
+#endif
+}
+
+#ifdef __linux__
+// JĂfBNgɂēipXȂj
+bool shouldSkipDirectory(int fd, std::uint64_t stayOnDevice) {
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        return false;
+    }
+    return shouldSkipDevice(static_cast<std::uint64_t>(st.st_dev), stayOnDevice, [fd]() {
+        struct statfs fsInfo;
+        return ::fstatfs(fd, &fsInfo) == 0 &&
+            isVirtualFilesystemType(static_cast<unsigned long>(fsInfo.f_type));
+    });
+}
+#endif
+
+// T̃fBNgƁA܂ł̏O[̏ƍ
+struct DirectoryWork {
+    fs::path path;
+    ExclusionSet::State exclusion;
+    std::shared_ptr<DirectoryHandle> parent;  // efBNg̃nhifd ΂ŊJꍇj
+    std::uint32_t node = 0;                   // TreeFragment ̃m[hi؂ꍇj
+    std::uint32_t previous = 0;               // ÕXibvVbgł̃m[hi0 ͕sj
+};
+
+// ؂̃gpʂ̌ςƁA\Z𒴂Ƃ̏kޏԁi--memory-budgetjB
+// ScanTree A TreeFragment m[h𑫂тɉZ
+struct TreeMemory {
+    std::atomic<std::int64_t> bytes{ 0 };
+    std::atomic<bool> dropFiles{ false };  // t@Cm[hɂAfBNgƂ̍vɂ
+};
+
+// 1̃^[Qbgz̃fBNg̖؁Bt@C̃TCY͐efBNgɏݍށB
+// [J[ TraversalState::mutex ̉ŒǋLA^[Qbg̊ ScanTree ֈڂ
+struct TreeFragment {
+    struct Node {
+        std::uint32_t parent;
+        fs::path::string_type name;
+        std::uintmax_t bytes;  // fBNg: m[hɂĂȂ̃t@C̍vAt@C: TCY
+        std::int64_t mtime;    // UNIX iimbj
+        std::int64_t ctime;
+        bool isDirectory;
+        bool isStale;          // ߎœǂ܂ȂfBNgibytes ͑O̍vj
+        bool isAggregated;     // keepFiles Ȃ̂Ƀ\Ẑߒ̃t@C bytes ɂ܂Ƃ߂
+        std::uint32_t spill = 0;  // qXst@C֏oꍇAScanTree  spills ̔ԍ + 1
+                                  // ibytes ͕؂̍vj
+    };
+    bool keepFiles = false;  // t@Cm[hɂiXibvVbgpj
+    TreeMemory* memory = nullptr;
+    std::int64_t accounted = 0;  // memory ɉZ
+    std::int64_t spillChecked = 0;  // O񏑂o݂ accountedi{Ɉ܂Ŏ݂Ȃj
+    std::vector<Node> nodes{ Node{ 0, {}, 0, 0, 0, true, false, false } };  // nodes[0] ^[Qbgg
+
+    TreeFragment() = default;
+    TreeFragment(const TreeFragment&) = delete;
+    TreeFragment& operator=(const TreeFragment&) = delete;
+
+    ~TreeFragment() {
+        if (memory) {
+            memory->bytes.fetch_sub(accounted, std::memory_order_relaxed);
+        }
+    }
+
+    static std::int64_t costOf(const Node& node) {
+        return static_cast<std::int64_t>(sizeof(Node) + node.name.size() * sizeof(fs::path::value_type));
+    }
+
+    void push(Node&& node) {
+        if (memory) {
+            std::int64_t cost = costOf(node);
+            accounted += cost;
+            memory->bytes.fetch_add(cost, std::memory_order_relaxed);
+        }
+        nodes.push_back(std::move(node));
+    }
+
+    // t@Cm[hɂ邩i\Z𒴂ȍ~͂܂Ƃ߂j
+    bool keepsFiles() const {
+        return keepFiles && !(memory && memory->dropFiles.load(std::memory_order_relaxed));
+    }
+
+    std::uint32_t add(std::uint32_t parent, const fs::path::string_type& name) {
+        push(Node{ parent, name, 0, 0, 0, true, false, false });
+        return static_cast<std::uint32_t>(nodes.size() - 1);
+    }
+
+    // 폜̈󂪕tĂȂm[hVzɈڂApending ̃m[h̓Ytւ
+    void compact(const std::vector<char>& removed, std::vector<DirectoryWork>& pending) {
+        std::vector<std::uint32_t> renumber(nodes.size(), 0);
+        std::vector<Node> kept;
+        kept.reserve(std::count(removed.begin(), removed.end(), 0));
+        std::int64_t cost = 0;
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            if (!removed[i]) {
+                renumber[i] = static_cast<std::uint32_t>(kept.size());
+                kept.push_back(std::move(nodes[i]));
+                kept.back().parent = renumber[kept.back().parent];
+                cost += costOf(kept.back());
+            }
+        }
+        for (auto& work : pending) {
+            work.node = renumber[work.node];
+        }
+        nodes.swap(kept);
+        if (memory) {
+            memory->bytes.fetch_add(cost - accounted, std::memory_order_relaxed);
+        }
+        accounted = cost;
+    }
+};
+
+// 1fBNg̏WvBǂݏIƂɂ܂Ƃ߂Ė؂֋L^
+struct DirectorySummary {
+    std::uintmax_t bytes = 0;                // m[hɂȂt@C̍v
+    std::int64_t mtime = 0;
+    std::int64_t ctime = 0;
+    std::vector<TreeFragment::Node> files;   // t@Cm[hɂꍇƁAǂ܂ȂfBNg
+
+    void addFile(bool keepFiles, const fs::path::string_type& name, std::uintmax_t size,
+                 std::int64_t fileMtime, std::int64_t fileCtime) {
+        if (keepFiles) {
+            files.push_back(TreeFragment::Node{ 0, name, size, fileMtime, fileCtime, false, false, false });
+        } else {
+            bytes += size;
+        }
+    }
+
+    void addStaleDirectory(const fs::path::string_type& name, std::uintmax_t size,
+                           std::int64_t directoryMtime, std::int64_t directoryCtime) {
+        files.push_back(TreeFragment::Node{ 0, name, size, directoryMtime, directoryCtime, true, true, false });
+    }
+};
+
+// qGg̏ƍԂ߁AOȂ true Ԃ
+template <typename Facts>
+bool advanceExclusion(const TraversalContext& ctx, const ExclusionSet::State& parent,
+                      const fs::path& child, bool isDirectory, Facts&& facts,
+                      ExclusionSet::State& childState) {
+    if (!ctx.exclusions || parent.empty()) {
+        childState.clear();
+        return false;
+    }
+    childState = ctx.exclusions->advance(parent, child.filename().native());
+    return !childState.empty() &&
+        ctx.exclusions->excludes(childState, isDirectory, std::forward<Facts>(facts));
+}
+
+// ̃^[Qbg̋LԁBEHb`hbO͉ȂoƁA
+// T̃fBNgʂ̃[J[ɈpA~܂Xbȟʂ͔j
+struct TraversalState {
+    size_t targetId = 0;
+    fs::path targetPath;
+    std::chrono::steady_clock::time_point startTime;
+    std::chrono::steady_clock::duration timeout = std::chrono::seconds(30);
+    size_t workerIndex = 0;
+    std::mutex mutex;                 // pending  currentDir ی
+    std::vector<DirectoryWork> pending;  // T̃fBNg
+    fs::path currentDir;                 // ǂݍݒ̃fBNg
+    std::atomic<std::int64_t> operationStart{ 0 };  // s̑̊Jni0 ͑Oj
+    std::atomic<bool> abandoned{ false };
+    std::shared_ptr<TreeFragment> fragment;  // fBNg̖؂ꍇ̂݁imutex ŕیj
+    // `FbN|Cgpimutex ŕیjBcommittedBytes ͓ǂݏIfBNg܂ł̍vŁA
+    // ǂݍݒ̃fBNgiinFlight Ȃ currentDirj pending ǂ߂Ύc肪B
+    // ǂݍݒ̃fBNgς񂾎q͓ǂݒōĂѐς܂̂ŁApendingAtPop ͊܂߂Ȃ
+    bool resumable = false;
+    bool inFlight = false;
+    size_t pendingAtPop = 0;
+    std::uintmax_t committedBytes = 0;
+
+    // mutex ێԂŌĂԂ
+    std::uint32_t addDirectoryNode(std::uint32_t parent, const fs::path::string_type& name) {
+        return fragment ? fragment->add(parent, name) : 0;
+    }
+
+    bool keepFiles() const {
+        return fragment && fragment->keepsFiles();
+    }
+
+    // fBNg1̏Wv؂ɋL^
+    void finishDirectory(std::uint32_t node, DirectorySummary& summary) {
+        if (!fragment) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (abandoned) {
+            return;
+        }
+        auto& directory = fragment->nodes[node];
+        directory.bytes += summary.bytes;
+        directory.mtime = summary.mtime;
+        directory.ctime = summary.ctime;
+        // ǂłԂɃ\Z𒴂ĂAW߂t@C܂Ƃ߂
+        bool aggregate = fragment->keepFiles && !fragment->keepsFiles();
+        directory.isAggregated |= aggregate;
+        for (auto& file : summary.files) {
+            if (aggregate && !file.isDirectory) {
+                fragment->nodes[node].bytes += file.bytes;
+                continue;
+            }
+            file.parent = node;
+            fragment->push(std::move(file));
+        }
+    }
+
+    // ĊJɕKvȁAm肵vƖǂ̃fBNg
+    bool resumePoint(std::uintmax_t& committed, std::vector<fs::path>& frontier) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!resumable || abandoned) {
+            return false;
+        }
+        committed = committedBytes;
+        frontier.clear();
+        size_t count = inFlight ? std::min(pendingAtPop, pending.size()) : pending.size();
+        for (size_t i = 0; i < count; ++i) {
+            frontier.push_back(pending[i].path);
+        }
+        if (inFlight) {
+            frontier.push_back(currentDir);
+        }
+        return true;
+    }
+
+    // ubN鑀̑OŌĂԁBpĂȍ~̌ʂ͎̂Ă
+    void beginOperation();
+    bool endOperation() {
+        operationStart.store(0, std::memory_order_relaxed);
+        return !abandoned.load();
+    }
+};
+
+std::int64_t steadyNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void TraversalState::beginOperation() {
+    operationStart.store(steadyNowNs(), std::memory_order_relaxed);
+}
+
+// fBNgTCYvZ֐iIȃX^bNőA؂ꎞ͖TfBNgԂj
+struct TraversalResult {
+    std::uintmax_t total = 0;
+    bool isPartial = false;
+    bool abandoned = false;          // EHb`hbOɈpꂽiʂ͖j
+    std::uintmax_t staleBytes = 0;   // total ̂ÕXibvVbg̒lg
+    std::vector<DirectoryWork> frontier;  // ܂łɒTłȂfBNg
+};
+
+// ÕXibvVbgfBNgςĂȂBGg̒ǉE폜E
+// fBNg mtime XV̂ŁAmtime  ctime vΈꗗ͑OƓƂ݂ȂB
+// ߎœǂ܂ȂfBNgt@CvɂfBNg͈ꗗČłȂ̂ŁA
+// allowStaleivgꍇjłȂΕς̂ƂĈ
+bool isUnchangedDirectory(const TraversalContext& ctx, std::uint32_t previous,
+                          std::int64_t mtime, std::int64_t ctime, bool allowStale = false) {
+    if (!ctx.previous || previous == 0 || previous >= ctx.previous->size() || mtime == 0) {
+        return false;
+    }
+    const SnapshotNode& node = ctx.previous->node(previous);
+    return (node.flags & SNAPSHOT_DIRECTORY) != 0 &&
+        (allowStale || (node.flags & (SNAPSHOT_STALE | SNAPSHOT_AGGREGATED)) == 0) &&
+        node.mtime == mtime && node.ctime == ctime;
+}
+
+// ߎ: O̍v pruneBelow ŁAmtime / ctime ςĂȂTufBNgɂ͍~肸A
+// O̍vÂlƂĐBdirectoryTimes(mtime, ctime) ͌ɂȂƂĂԁistat 1jB
+// ǂ܂Ȃ؂͖؂1̃m[hƂĎcB~肸ɍς񂾂 true
+template <typename DirectoryTimes>
+bool pruneSubtree(const TraversalContext& ctx, TraversalState& state, std::uint32_t previous,
+                  const fs::path::string_type& name, DirectoryTimes&& directoryTimes,
+                  TraversalResult& result, DirectorySummary& summary) {
+    if (ctx.pruneBelow == 0 || !ctx.previous || previous == 0 || previous >= ctx.previous->size()) {
+        return false;
+    }
+    const SnapshotNode& node = ctx.previous->node(previous);
+    if (node.size >= ctx.pruneBelow || (node.flags & SNAPSHOT_PARTIAL) != 0) {
+        return false;
+    }
+    std::int64_t mtime = 0;
+    std::int64_t ctime = 0;
+    if (!directoryTimes(mtime, ctime) || !isUnchangedDirectory(ctx, previous, mtime, ctime, true)) {
+        return false;
+    }
+    std::uintmax_t bytes = node.size;
+    ctx.stats->prunedSubtrees++;
+    ctx.stats->prunedNodes += ctx.previous->subtreeEnd(previous) - previous;
+    ctx.stats->staleBytes += bytes;
+    if (state.fragment) {
+        summary.addStaleDirectory(name, bytes, mtime, ctime);
+    }
+    if (bytes > 0) {
+        result.total += bytes;
+        result.staleBytes += bytes;
+        if (ctx.progress) {
+            ctx.progress->fetch_add(bytes, std::memory_order_relaxed);
+        }
+        if (ctx.stale) {
+            ctx.stale->fetch_add(bytes, std::memory_order_relaxed);
+        }
+    }
+    return true;
+}
+
+// ςĂȂfBNg̈ꗗAǂݒɑÕXibvVbgČB
+// statEntry(name, isDirectory, size, mtime, ctime) ͊m̃Gg𒲂גAނႦ false Ԃ
+// it@C trustUnchanged ȂĂ΂ɑO̒lgjBTufBNg mtime m߂邽
+// ʏǂςށiߎō~Ȃ̂jBEHb`hbOɈpꂽ false
+template <typename StatEntry>
+bool reuseDirectory(const DirectoryWork& work, const std::shared_ptr<DirectoryHandle>& handle,
+                    TraversalState& state, const TraversalContext& ctx, TraversalResult& result,
+                    DirectorySummary& summary, StatEntry&& statEntry) {
+    const Snapshot& previous = *ctx.previous;
+    bool keepFiles = state.keepFiles();
+    std::int64_t now = static_cast<std::int64_t>(std::time(nullptr));
+    bool abandoned = false;
+    bool stopped = false;
+    ctx.stats->reusedDirectories++;
+    previous.forEachChild(work.previous, [&](std::uint32_t child) {
+        if (abandoned || stopped) {
+            return;
+        }
+        if (ctx.stopRequested()) {
+            stopped = true;
+            return;
+        }
+        ctx.stats->entries++;
+        const SnapshotNode& node = previous.node(child);
+        fs::path name = fs::u8path(previous.name(child));
+        bool isDirectory = (node.flags & SNAPSHOT_DIRECTORY) != 0;
+        auto facts = [&]() {
+            return std::pair<std::uintmax_t, std::int64_t>(isDirectory ? 0 : node.size,
+                                                           now - node.mtime / 1000000000LL);
+        };
+        ExclusionSet::State childState;
+        if (advanceExclusion(ctx, work.exclusion, name, isDirectory, facts, childState)) {
+            return;
+        }
+        if (isDirectory) {
+            bool pruned = pruneSubtree(ctx, state, child, name.native(),
+                                       [&](std::int64_t& mtime, std::int64_t& ctime) {
+                std::uintmax_t size = 0;
+                if (ctx.throttle) {
+                    ctx.throttle->acquire(ctx.device);
+                }
+                state.beginOperation();
+                bool found = statEntry(name, true, size, mtime, ctime);
+                abandoned = !state.endOperation();
+                return found && !abandoned;
+            }, result, summary);
+            if (abandoned || pruned) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(state.mutex);
+            if (state.abandoned) {
+                abandoned = true;
+                return;
+            }
+            state.pending.push_back(DirectoryWork{ work.path / name, std::move(childState), handle,
+                                                   state.addDirectoryNode(work.node, name.native()), child });
+            return;
+        }
+
+        std::uintmax_t size = node.size;
+        std::int64_t mtime = node.mtime;
+        std::int64_t ctime = node.ctime;
+        if (!ctx.trustUnchanged) {
+            if (ctx.throttle) {
+                ctx.throttle->acquire(ctx.device);
+            }
+            state.beginOperation();
+            bool regular = statEntry(name, false, size, mtime, ctime);
+            if (!state.endOperation()) {
+                abandoned = true;
+                return;
+            }
+            if (!regular) {
+                return;
+            }
+        }
+        ctx.stats->reusedFiles++;
+        ctx.stats->reusedBytes += size;
+        if (state.fragment) {
+            summary.addFile(keepFiles, name.native(), size, mtime, ctime);
+        }
+        if (size > 0) {
+            result.total += size;
+            if (ctx.progress) {
+                ctx.progress->fetch_add(size, std::memory_order_relaxed);
+            }
+        }
+    });
+    if (stopped) {
+        // r܂ł̈ꗗ̊ɂȂ悤AL^Ȃ
+        result.isPartial = true;
+        summary.mtime = summary.ctime = 0;
+    }
+    return !abandoned;
+}
+
+// ςfBNgǂݒƂATufBNgÕm[hƑΉt
+std::uint32_t previousChild(const std::map<std::string, std::uint32_t>& children, const std::string& name) {
+    auto it = children.find(name);
+    return it != children.end() ? it->second : 0;
+}
+
+#ifdef __linux__
+// getdents64 ԂGg
+struct LinuxDirent64 {
+    std::uint64_t d_ino;
+    std::int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+// 1̃fBNg fd ΂œǂށie fd  openat AGg getdents64  fstatat ŒׂjB
+// pX̍ĉȂ̂Ő[؂ł1Gg̃RXgBEHb`hbOɈpꂽ false
+bool scanDirectoryAt(const DirectoryWork& work, TraversalState& state, const TraversalContext& ctx,
+                     TraversalResult& result, DirectorySummary& summary) {
+    const size_t BUFFER_SIZE = 32 * 1024;
+    IoThrottle* throttle = ctx.throttle;
+    const fs::path& current = work.path;
+
+    if (throttle) {
+        throttle->acquire(ctx.device);
+    }
+    std::error_code ec;
+    state.beginOperation();
+    DirectoryHandleCache::Pin dir = ctx.handles->open(work.parent, current, ec);
+    bool skip = !ec && shouldSkipDirectory(dir.fd(), ctx.stayOnDevice);
+    FileIdentity identity;
+    if (!ec && !skip && ctx.otherRoots && fileIdentityOf(dir.fd(), identity)) {
+        skip = isOtherRoot(ctx.otherRoots, identity);
+    }
+    if (!state.endOperation()) {
+        return false;
+    }
+    if (ec) {
+        ctx.stats->recordError(ec, current);
+        return true;
+    }
+    if (skip) {
+        return true;
+    }
+    bool keepFiles = state.keepFiles();
+    if (state.fragment || ctx.previous) {
+        struct stat st;
+        if (::fstat(dir.fd(), &st) == 0) {
+            summary.mtime = toUnixNanoseconds(st.st_mtim);
+            summary.ctime = toUnixNanoseconds(st.st_ctim);
+        }
+    }
+    std::map<std::string, std::uint32_t> previousChildren;
+    if (ctx.previous) {
+        if (isUnchangedDirectory(ctx, work.previous, summary.mtime, summary.ctime)) {
+            return reuseDirectory(work, dir.handle(), state, ctx, result, summary,
+                                  [&](const fs::path& name, bool isDirectory, std::uintmax_t& size,
+                                      std::int64_t& mtime, std::int64_t& ctime) {
+                struct stat st;
+                if (::fstatat(dir.fd(), name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                    ctx.stats->recordError(std::error_code(errno, std::generic_category()), current / name);
+                    return false;
+                }
+                if (isDirectory ? !S_ISDIR(st.st_mode) : !S_ISREG(st.st_mode)) {
+                    return false;
+                }
+                size = static_cast<std::uintmax_t>(st.st_size);
+                mtime = toUnixNanoseconds(st.st_mtim);
+                ctime = toUnixNanoseconds(st.st_ctim);
+                return true;
+            });
+        }
+        ctx.stats->rereadDirectories++;
+        if (work.previous != 0) {
+            previousChildren = ctx.previous->childDirectories(work.previous);
+        }
+    }
+
+    alignas(LinuxDirent64) char buffer[BUFFER_SIZE];
+    while (true) {
+        state.beginOperation();
+        long bytes = ::syscall(SYS_getdents64, dir.fd(), buffer, BUFFER_SIZE);
+        int readError = errno;
+        if (!state.endOperation()) {
+            return false;
+        }
+        if (bytes < 0) {
+            ctx.stats->recordError(std::error_code(readError, std::generic_category()), current);
+            summary.mtime = summary.ctime = 0;
+            return true;
+        }
+        if (bytes == 0) {
+            return true;
+        }
+
+        for (long offset = 0; offset < bytes;) {
+            const auto* entry = reinterpret_cast<const LinuxDirent64*>(buffer + offset);
+            offset += entry->d_reclen;
+            const char* name = entry->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+
+            // fv̓GgƂɊmFAɔir܂ł̈ꗗ͎̊ɂȂj
+            if (ctx.stopRequested()) {
+                result.isPartial = true;
+                summary.mtime = summary.ctime = 0;
+                return true;
+            }
+
+            // ᕉ׃[hł̓GgƂɃg[N
+            if (throttle) {
+                throttle->acquire(ctx.device);
+            }
+            ctx.stats->entries++;
+
+            // stat ͎ނȂƂATCYKvȂƂAO[̏𒲂ׂƂs
+            struct stat st;
+            bool haveStat = false;
+            int statError = 0;
+            auto statEntry = [&]() {
+                if (!haveStat && statError == 0) {
+                    if (::fstatat(dir.fd(), name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+                        haveStat = true;
+                    } else {
+                        statError = errno;
+                    }
+                }
+                return haveStat;
+            };
+            auto facts = [&]() {
+                std::pair<std::uintmax_t, std::int64_t> f(0, 0);
+                if (statEntry()) {
+                    f.first = S_ISREG(st.st_mode) ? static_cast<std::uintmax_t>(st.st_size) : 0;
+                    f.second = static_cast<std::int64_t>(::time(nullptr) - st.st_mtime);
+                }
+                return f;
+            };
+
+            bool descend = false;
+            std::uintmax_t fileSize = 0;
+            std::uint32_t previousNode = 0;
+            ExclusionSet::State childState;
+            state.beginOperation();
+            unsigned char type = entry->d_type;
+            if (type == DT_UNKNOWN && statEntry()) {
+                type = IFTODT(st.st_mode);
+            }
+            // V{bNN DT_LNK Ȃ̂łŏ
+            if (type == DT_DIR || type == DT_REG) {
+                bool isDirectory = type == DT_DIR;
+                bool excluded = ctx.exclusions && !work.exclusion.empty() &&
+                    advanceExclusion(ctx, work.exclusion, fs::path(name), isDirectory, facts,
+                                     childState);
+                if (isDirectory) {
+                    previousNode = previousChild(previousChildren, name);
+                    descend = !excluded &&
+                        !pruneSubtree(ctx, state, previousNode, name,
+                                      [&](std::int64_t& mtime, std::int64_t& ctime) {
+                        if (!statEntry() || !S_ISDIR(st.st_mode)) {
+                            return false;
+                        }
+                        mtime = toUnixNanoseconds(st.st_mtim);
+                        ctime = toUnixNanoseconds(st.st_ctim);
+                        return true;
+                    }, result, summary);
+                } else if (!excluded && statEntry()) {
+                    fileSize = static_cast<std::uintmax_t>(st.st_size);
+                    if (ctx.allocated && static_cast<std::uint64_t>(st.st_dev) == ctx.allocationDevice &&
+                        (st.st_nlink <= 1 || !ctx.hardLinks ||
+                         ctx.hardLinks->insert(st.st_dev, st.st_ino))) {
+                        ctx.allocated->fetch_add(static_cast<std::uintmax_t>(st.st_blocks) * 512,
+                                                 std::memory_order_relaxed);
+                    }
+                    if (state.fragment) {
+                        summary.addFile(keepFiles, name, fileSize, toUnixNanoseconds(st.st_mtim),
+                                        toUnixNanoseconds(st.st_ctim));
+                    }
+                }
+            }
+            if (!state.endOperation()) {
+                return false;
+            }
+            if (statError != 0) {
+                ctx.stats->recordError(std::error_code(statError, std::generic_category()),
+                                       current / name);
+            }
+
+            if (descend) {
+                std::lock_guard<std::mutex> lock(state.mutex);
+                if (state.abandoned) {
+                    return false;
+                }
+                state.pending.push_back(DirectoryWork{ current / name, std::move(childState),
+                                                       dir.handle(),
+                                                       state.addDirectoryNode(work.node, name),
+                                                       previousNode });
+            } else if (fileSize > 0) {
+                result.total += fileSize;
+                if (ctx.progress) {
+                    ctx.progress->fetch_add(fileSize, std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+}
+#endif
+
+TraversalResult calculateDirectorySizeWithTimeout(TraversalState& state,
+                                                  const TraversalContext& ctx) {
+    TraversalResult result;
+    IoThrottle* throttle = ctx.throttle;
+    std::uint64_t device = ctx.device;
+    std::atomic<std::uintmax_t>* progress = ctx.progress;
+
+    while (true) {
+        DirectoryWork work;
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            if (state.abandoned) {
+                result.abandoned = true;
+                return result;
+            }
+            // ÕfBNgŌ܂œǂł΁A܂ł̍vmƂi`FbN|Cgpj
+            if (!result.isPartial) {
+                state.inFlight = false;
+                state.committedBytes = progress ? progress->load() : result.total;
+            }
+            if (state.pending.empty()) {
+                break;
+            }
+
+            // ł؂vŎ~߂ꍇ͊O}Ȃ
+            if (ctx.stopRequested()) {
+                result.isPartial = true;
+                break;
+            }
+
+            // ԗ\Z`FbNifBNgPʁj
+            if (std::chrono::steady_clock::now() >= ctx.deadline) {
+                result.isPartial = true;
+                result.frontier = std::move(state.pending);
+                state.pending.clear();
+                state.resumable = false;  // c͐肷̂ōĊJ̑ΏۂɂȂ
+                break;
+            }
+
+            // ÕfBNg܂łœǂݏI؂́A\Z𒴂ĂΒfЂ珑o
+            if (state.fragment && ctx.spillFinished) {
+                ctx.spillFinished(*state.fragment, state.pending);
+            }
+
+            work = std::move(state.pending.back());
+            state.pending.pop_back();
+            state.currentDir = work.path;
+            state.inFlight = true;
+            state.pendingAtPop = state.pending.size();
+        }
+        const fs::path& current = work.path;
+
+        DirectorySummary summary;
+#ifdef __linux__
+        if (ctx.handles) {
+            if (!scanDirectoryAt(work, state, ctx, result, summary)) {
+                result.abandoned = true;
+                return result;
+            }
+            state.finishDirectory(work.node, summary);
+            continue;
+        }
+#endif
+
+        // s̓G[R[hŎ󂯂ĕނiʂ EACCES ŗO𓊂Ȃ߁jB
+        // O catch ͑zO̗OisȂǁĵ߂Ɏc
+        try {
+            if (throttle) {
+                throttle->acquire(device);
+            }
+            state.beginOperation();
+            if (shouldSkipDirectory(current, ctx.stayOnDevice) || isOtherRoot(ctx.otherRoots, current)) {
+                if (!state.endOperation()) {
+                    result.abandoned = true;
+                    return result;
+                }
+                continue;
+            }
+            std::error_code ec;
+            fs::directory_iterator it(current, ec), end;
+            if (!state.endOperation()) {
+                result.abandoned = true;
+                return result;
+            }
+            if (ec) {
+                ctx.stats->recordError(ec, current);
+                continue;
+            }
+            bool keepFiles = state.keepFiles();
+            if (state.fragment || ctx.previous) {
+                // ctime ͎Ȃ̂ mtime őpir mtime ݂̂ɂȂj
+                auto modified = fs::last_write_time(current, ec);
+                summary.mtime = summary.ctime = ec ? 0 : toUnixNanoseconds(modified);
+            }
+            std::map<std::string, std::uint32_t> previousChildren;
+            if (ctx.previous) {
+                if (isUnchangedDirectory(ctx, work.previous, summary.mtime, summary.ctime)) {
+                    bool reused = reuseDirectory(work, nullptr, state, ctx, result, summary,
+                                                 [&](const fs::path& name, bool isDirectory, std::uintmax_t& size,
+                                                     std::int64_t& mtime, std::int64_t& ctime) {
+                        std::error_code statError;
+                        fs::path file = current / name;
+                        auto status = fs::symlink_status(file, statError);
+                        if (isDirectory ? !fs::is_directory(status) : !fs::is_regular_file(status)) {
+                            if (statError) {
+                                ctx.stats->recordError(statError, file);
+                            }
+                            return false;
+                        }
+                        size = isDirectory ? 0 : fs::file_size(file, statError);
+                        auto modified = fs::last_write_time(file, statError);
+                        if (statError) {
+                            ctx.stats->recordError(statError, file);
+                            return false;
+                        }
+                        mtime = ctime = toUnixNanoseconds(modified);
+                        return true;
+                    });
+                    if (!reused) {
+                        result.abandoned = true;
+                        return result;
+                    }
+                    state.finishDirectory(work.node, summary);
+                    continue;
+                }
+                ctx.stats->rereadDirectories++;
+                if (work.previous != 0) {
+                    previousChildren = ctx.previous->childDirectories(work.previous);
+                }
+            }
+            while (it != end) {
+                // fv̓GgƂɊmFAɔir܂ł̈ꗗ͎̊ɂȂj
+                if (ctx.stopRequested()) {
+                    result.isPartial = true;
+                    summary.mtime = summary.ctime = 0;
+                    break;
+                }
+
+                // ᕉ׃[hł̓GgƂɃg[N
+                if (throttle) {
+                    throttle->acquire(device);
+                }
+                ctx.stats->entries++;
+
+                bool descend = false;
+                std::uintmax_t fileSize = 0;
+                std::uint32_t previousNode = 0;
+                ExclusionSet::State childState;
+                const auto& entry = *it;
+                state.beginOperation();
+                // V{bNNXLbv
+                if (entry.is_symlink(ec)) {
+                    // Ȃ
+                } else if (!ec && entry.is_directory(ec)) {
+                    descend = !advanceExclusion(ctx, work.exclusion, entry.path(), true,
+                                                [&entry]() { return entryFacts(entry); },
+                                                childState);
+                    if (descend && ctx.previous) {
+                        previousNode = previousChild(previousChildren, toUtf8(entry.path().filename().native()));
+                        descend = !pruneSubtree(ctx, state, previousNode, entry.path().filename().native(),
+                                                [&](std::int64_t& mtime, std::int64_t& ctime) {
+                            std::error_code timeError;
+                            auto modified = entry.last_write_time(timeError);
+                            mtime = ctime = timeError ? 0 : toUnixNanoseconds(modified);
+                            return !timeError;
+                        }, result, summary);
+                    }
+                } else if (!ec && entry.is_regular_file(ec)) {
+                    if (!advanceExclusion(ctx, work.exclusion, entry.path(), false,
+                                          [&entry]() { return entryFacts(entry); },
+                                          childState)) {
+                        fileSize = entry.file_size(ec);
+                        if (ec) {
+                            fileSize = 0;
+                        } else if (state.fragment) {
+                            std::error_code timeError;
+                            auto modified = entry.last_write_time(timeError);
+                            std::int64_t mtime = timeError ? 0 : toUnixNanoseconds(modified);
+                            summary.addFile(keepFiles, entry.path().filename().native(), fileSize,
+                                            mtime, mtime);
+                        }
+                    }
+                }
+                if (ec) {
+                    ctx.stats->recordError(ec, entry.path());
+                }
+                if (!state.endOperation()) {
+                    result.abandoned = true;
+                    return result;
+                }
+
+                if (descend) {
+                    std::lock_guard<std::mutex> lock(state.mutex);
+                    if (state.abandoned) {
+                        result.abandoned = true;
+                        return result;
+                    }
+                    state.pending.push_back(DirectoryWork{
+                        entry.path(), std::move(childState), nullptr,
+                        state.addDirectoryNode(work.node, entry.path().filename().native()),
+                        previousNode });
+                } else if (fileSize > 0) {
+                    result.total += fileSize;
+                    if (progress) {
+                        progress->fetch_add(fileSize, std::memory_order_relaxed);
+                    }
+                    // 蓖Ă͕Ȃ̂Ō̃TCYőpifd ΂̑Ȃj
+                    if (ctx.allocated) {
+                        ctx.allocated->fetch_add(fileSize, std::memory_order_relaxed);
+                    }
+                }
+
+                state.beginOperation();
+                it.increment(ec);
+                if (!state.endOperation()) {
+                    result.abandoned = true;
+                    return result;
+                }
+                if (ec) {
+                    // ǂݍ݂̓rŎsÃfBNg̎c͒߂
+                    ctx.stats->recordError(ec, current);
+                    summary.mtime = summary.ctime = 0;
+                    break;
+                }
+            }
+        } catch (...) {
+            state.operationStart.store(0, std::memory_order_relaxed);
+        }
+        state.finishDirectory(work.node, summary);
+    }
+
+    return result;
+}
+
+// lbg[Nt@CVXẽpXǂiȂ\邽ߒZ^CAEggj
+bool isNetworkFilesystem(const fs::path& p) {
+#ifdef _WIN32
+    return GetDriveTypeW(p.root_path().c_str()) == DRIVE_REMOTE;
+#elif defined(__linux__)
+    struct statfs st;
+    if (::statfs(p.c_str(), &st) != 0) {
+        return false;
+    }
+    switch (static_cast<unsigned long>(st.f_type)) {
+    case 0x6969:      // NFS
+    case 0x517B:      // SMB
+    case 0xFF534D42:  // CIFS
+    case 0xFE534D42:  // SMB2
+    case 0x65735546:  // FUSE
+    case 0x00C36400:  // Ceph
+    case 0x01021997:  // 9P
+    case 0x5346414F:  // AFS
+    case 0x47504653:  // GPFS
+        return true;
+    default:
+        return false;
+    }
+#else
+    (void)p;
+    return false;
+#endif
+}
+
+// 莞ԉȂ^f[^oEHb`hbO
+class HangWatchdog {
+private:
+    std::vector<std::shared_ptr<TraversalState>> active;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool running = false;
+    std::thread worker;
+
+public:
+    ~HangWatchdog() {
+        stop();
+    }
+
+    void start(std::function<void(const std::shared_ptr<TraversalState>&)> onHang) {
+        running = true;
+        worker = std::thread([this, onHang]() {
+            const auto CHECK_INTERVAL = std::chrono::milliseconds(100);
+            std::unique_lock<std::mutex> lock(mutex);
+            while (running) {
+                cv.wait_for(lock, CHECK_INTERVAL);
+                std::int64_t now = steadyNowNs();
+                std::vector<std::shared_ptr<TraversalState>> hung;
+                for (auto it = active.begin(); it != active.end();) {
+                    std::int64_t started = (*it)->operationStart.load(std::memory_order_relaxed);
+                    auto limit = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        (*it)->timeout).count();
+                    if (started != 0 && now - started > limit) {
+                        hung.push_back(*it);
+                        it = active.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+                lock.unlock();
+                for (const auto& state : hung) {
+                    onHang(state);
+                }
+                lock.lock();
+            }
+        });
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        cv.notify_all();
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+    void add(const std::shared_ptr<TraversalState>& state) {
+        std::lock_guard<std::mutex> lock(mutex);
+        active.push_back(state);
+    }
+
+    std::vector<std::shared_ptr<TraversalState>> states() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return active;
+    }
+
+    void remove(const TraversalState* state) {
+        std::lock_guard<std::mutex> lock(mutex);
+        active.erase(std::remove_if(active.begin(), active.end(),
+                                    [state](const std::shared_ptr<TraversalState>& s) {
+                                        return s.get() == state;
+                                    }),
+                     active.end());
+    }
+};
+
+// ǋL݂̂̃ÕR[h`: [e̒][][e][`FbNT]B
+// IŏɂȂ̃R[h́A`FbNTŌoĎ̂Ă
+struct LogRecord {
+    static std::uint32_t checksum(const std::string& data, size_t offset, size_t length) {
+        std::uint32_t hash = 2166136261u;  // FNV-1a
+        for (size_t i = offset; i < offset + length; ++i) {
+            hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+        }
+        return hash;
+    }
+
+    template <typename Integer>
+    static void put(std::string& out, Integer value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    static void putString(std::string& out, const std::string& value) {
+        put(out, static_cast<std::uint32_t>(value.size()));
+        out += value;
+    }
+
+    // 7 rbg̉ϒBt zigzag ŏȐΒlZ
+    static void putVarint(std::string& out, std::uint64_t value) {
+        while (value >= 0x80) {
+            out += static_cast<char>((value & 0x7F) | 0x80);
+            value >>= 7;
+        }
+        out += static_cast<char>(value);
+    }
+
+    static void putSigned(std::string& out, std::int64_t value) {
+        putVarint(out, (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63));
+    }
+
+    static void append(std::string& out, char type, const std::string& payload) {
+        size_t start = out.size();
+        put(out, static_cast<std::uint32_t>(payload.size()));
+        out += type;
+        out += payload;
+        put(out, checksum(out, start + sizeof(std::uint32_t), payload.size() + 1));
+    }
+
+    // R[h̓eǂށB͈͊OǂƂ false
+    struct Reader {
+        const std::string& data;
+        size_t position;
+        size_t end;
+
+        template <typename Integer>
+        bool get(Integer& value) {
+            if (end - position < sizeof(value)) {
+                return false;
+            }
+            std::memcpy(&value, data.data() + position, sizeof(value));
+            position += sizeof(value);
+            return true;
+        }
+
+        bool getString(std::string& value) {
+            std::uint32_t length = 0;
+            if (!get(length) || end - position < length) {
+                return false;
+            }
+            value.assign(data, position, length);
+            position += length;
+            return true;
+        }
+
+        bool getVarint(std::uint64_t& value) {
+            value = 0;
+            for (int shift = 0; shift < 64 && position < end; shift += 7) {
+                auto byte = static_cast<unsigned char>(data[position++]);
+                value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+                if ((byte & 0x80) == 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool getSigned(std::int64_t& value) {
+            std::uint64_t raw = 0;
+            if (!getVarint(raw)) {
+                return false;
+            }
+            value = static_cast<std::int64_t>(raw >> 1) ^ -static_cast<std::int64_t>(raw & 1);
+            return true;
+        }
+    };
+
+    // data[offset..] ̃R[hɓnBfunction  false ԂƎ~܂B
+    // ĂȂ̏IiǋLĊJʒujԂ
+    template <typename Function>
+    static size_t forEach(const std::string& data, size_t offset, Function&& function) {
+        size_t position = offset;
+        while (data.size() - position >= sizeof(std::uint32_t) + 1 + sizeof(std::uint32_t)) {
+            std::uint32_t length = 0;
+            std::memcpy(&length, data.data() + position, sizeof(length));
+            size_t body = position + sizeof(length);
+            if (data.size() - body < static_cast<size_t>(length) + 1 + sizeof(std::uint32_t)) {
+                break;  // ̃R[h
+            }
+            std::uint32_t stored = 0;
+            std::memcpy(&stored, data.data() + body + 1 + length, sizeof(stored));
+            if (stored != checksum(data, body, length + 1)) {
+                break;
+            }
+            Reader reader{ data, body + 1, body + 1 + length };
+            position = body + 1 + length + sizeof(stored);
+            if (!function(data[body], reader)) {
+                break;
+            }
+        }
+        return position;
+    }
+};
+
+// Ԃ̃XL𒆒fɍĊJ邽߂̃`FbN|CgiLogRecord `̒ǋL݂̂̃OjB
+// ^[Qbg̃R[h͌̂̂D悳B
+// ^[Qbg͊ɁAvZ̃^[Qbg͖ǂ̃fBNgԊuƂɏ
+class CheckpointLog {
+public:
+    struct Entry {
+        bool complete = false;
+        std::uintmax_t bytes = 0;       // : vAvZ: ǂݏIfBNg܂ł̍v
+        bool partial = false;
+        std::vector<fs::path> frontier;  // vZ: ǂ̃fBNg
+    };
+    using Entries = std::map<fs::path, Entry>;
+
+private:
+    static const char HEADER = 'H';
+    static const char TARGET = 'T';
+    static const char PROGRESS = 'P';
+
+    std::mutex bufferMutex;
+    std::string buffer;  //  flush ŏR[h
+    std::mutex fileMutex;
+    std::FILE* file = nullptr;
+    std::uint64_t written = 0;
+    std::uint64_t flushes = 0;
+    std::chrono::steady_clock::duration writeTime{ 0 };
+
+    static std::string targetRecord(const fs::path& target, std::uintmax_t bytes, bool partial) {
+        std::string payload;
+        LogRecord::put(payload, static_cast<std::uint64_t>(bytes));
+        payload += partial ? '\1' : '\0';
+        LogRecord::putString(payload, toUtf8(target.native()));
+        return payload;
+    }
+
+    static std::string progressRecord(const fs::path& target, std::uintmax_t committed,
+                                      const std::vector<fs::path>& frontier) {
+        std::string payload;
+        LogRecord::put(payload, static_cast<std::uint64_t>(committed));
+        LogRecord::putString(payload, toUtf8(target.native()));
+        LogRecord::put(payload, static_cast<std::uint32_t>(frontier.size()));
+        for (const auto& dir : frontier) {
+            LogRecord::putString(payload, toUtf8(dir.native()));
+        }
+        return payload;
+    }
+
+    static std::FILE* openFile(const fs::path& path, bool append) {
+#ifdef _WIN32
+        return _wfopen(path.c_str(), append ? L"ab" : L"wb");
+#else
+        return std::fopen(path.c_str(), append ? "ab" : "wb");
+#endif
+    }
+
+    static bool sync(std::FILE* f) {
+        if (std::fflush(f) != 0) {
+            return false;
+        }
+#ifdef __linux__
+        ::fdatasync(::fileno(f));
+#endif
+        return true;
+    }
+
+public:
+    CheckpointLog() = default;
+    CheckpointLog(const CheckpointLog&) = delete;
+    CheckpointLog& operator=(const CheckpointLog&) = delete;
+
+    ~CheckpointLog() {
+        if (file) {
+            std::fclose(file);
+        }
+    }
+
+    // ̃OǂށBȂAʂ̏i[g⏜O[jŎ̂Ȃ false
+    static bool load(const fs::path& path, const std::string& fingerprint, Entries& entries) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            return false;
+        }
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        bool matched = false;
+        LogRecord::forEach(data, 0, [&](char type, LogRecord::Reader& reader) {
+            std::string text;
+            if (type == HEADER) {
+                if (!reader.getString(text) || text != fingerprint) {
+                    return false;
+                }
+                matched = true;
+            } else if (type == TARGET && matched) {
+                Entry entry;
+                std::uint64_t bytes = 0;
+                char partial = 0;
+                if (reader.get(bytes) && reader.get(partial) && reader.getString(text)) {
+                    entry.complete = true;
+                    entry.bytes = bytes;
+                    entry.partial = partial != 0;
+                    entries[fs::u8path(text)] = std::move(entry);
+                }
+            } else if (type == PROGRESS && matched) {
+                Entry entry;
+                std::uint64_t committed = 0;
+                std::uint32_t count = 0;
+                if (reader.get(committed) && reader.getString(text) && reader.get(count)) {
+                    entry.bytes = committed;
+                    std::string dir;
+                    bool valid = true;
+                    for (std::uint32_t i = 0; i < count && valid; ++i) {
+                        valid = reader.getString(dir);
+                        entry.frontier.push_back(fs::u8path(dir));
+                    }
+                    if (valid) {
+                        entries[fs::u8path(text)] = std::move(entry);
+                    }
+                }
+            }
+            return true;
+        });
+        if (!matched) {
+            entries.clear();
+        }
+        return matched;
+    }
+
+    // peVOŒuiȌdR[h͂ŏjAȍ~͒ǋL
+    bool create(const fs::path& path, const std::string& fingerprint, const Entries& entries,
+                std::string& error) {
+        std::string data;
+        std::string header;
+        LogRecord::putString(header, fingerprint);
+        LogRecord::append(data, HEADER, header);
+        for (const auto& item : entries) {
+            const Entry& entry = item.second;
+            if (entry.complete) {
+                LogRecord::append(data, TARGET, targetRecord(item.first, entry.bytes, entry.partial));
+            } else {
+                LogRecord::append(data, PROGRESS, progressRecord(item.first, entry.bytes, entry.frontier));
+            }
+        }
+        fs::path temp = path;
+        temp += ".tmp";
+        std::FILE* out = openFile(temp, false);
+        if (!out) {
+            error = "cannot create " + temp.string();
+            return false;
+        }
+        bool ok = std::fwrite(data.data(), 1, data.size(), out) == data.size() && sync(out);
+        ok = std::fclose(out) == 0 && ok;
+        std::error_code ec;
+        if (ok) {
+            fs::rename(temp, path, ec);
+        }
+        if (!ok || ec) {
+            error = ec ? ec.message() : "write failed: " + temp.string();
+            fs::remove(temp, ec);
+            return false;
+        }
+        file = openFile(path, true);
+        if (!file) {
+            error = "cannot append to " + path.string();
+            return false;
+        }
+        written = data.size();
+        return true;
+    }
+
+    void recordTarget(const fs::path& target, std::uintmax_t bytes, bool partial) {
+        std::string payload = targetRecord(target, bytes, partial);
+        std::lock_guard<std::mutex> lock(bufferMutex);
+        LogRecord::append(buffer, TARGET, payload);
+    }
+
+    void recordProgress(const fs::path& target, std::uintmax_t committed, const std::vector<fs::path>& frontier) {
+        std::string payload = progressRecord(target, committed, frontier);
+        std::lock_guard<std::mutex> lock(bufferMutex);
+        LogRecord::append(buffer, PROGRESS, payload);
+    }
+
+    // ܂R[hǋLēB[J[̓obt@ւ̒ǉő҂Ȃ
+    bool flush() {
+        std::lock_guard<std::mutex> fileLock(fileMutex);
+        auto start = std::chrono::steady_clock::now();
+        std::string pending;
+        {
+            std::lock_guard<std::mutex> lock(bufferMutex);
+            pending.swap(buffer);
+        }
+        bool ok = file && std::fwrite(pending.data(), 1, pending.size(), file) == pending.size() && sync(file);
+        written += pending.size();
+        flushes++;
+        writeTime += std::chrono::steady_clock::now() - start;
+        return ok;
+    }
+
+    // Oč폜iXLŌ܂ŏIꍇj
+    void discard(const fs::path& path) {
+        std::lock_guard<std::mutex> fileLock(fileMutex);
+        if (file) {
+            std::fclose(file);
+            file = nullptr;
+        }
+        std::error_code ec;
+        fs::remove(path, ec);
+    }
+
+    std::uint64_t bytesWritten() {
+        std::lock_guard<std::mutex> fileLock(fileMutex);
+        return written;
+    }
+
+    std::uint64_t flushCount() {
+        std::lock_guard<std::mutex> fileLock(fileMutex);
+        return flushes;
+    }
+
+    std::chrono::steady_clock::duration totalWriteTime() {
+        std::lock_guard<std::mutex> fileLock(fileMutex);
+        return writeTime;
+    }
+};
+
+// fBNgTCY̗iLogRecord `̒ǋL݂̂̃OjBXLƂ1R[hǋLA
+// lȏ̃fBNĝO񂩂ς̂AO̒lƂ̍izigzag + ϒjŏB
+// ǂݍݎɑSR[hĐAfBNgƂ̕ω_̗ɂ
+class SizeHistory {
+public:
+    struct Trend {
+        size_t samples = 0;
+        std::int64_t from = 0;  // ԓ̍ŏƍŌ̃XLiUNIX bj
+        std::int64_t to = 0;
+        std::int64_t first = 0;
+        std::int64_t last = 0;
+        double bytesPerDay = 0;  // ŏ@ɂX
+        double intercept = 0;    //  to ł̓Ă͂ߒl
+    };
+
+private:
+    static const char HEADER = 'H';
+    static const char SCAN = 'S';
+    static constexpr const char* FORMAT = "DiskWiz size history 1";
+    static constexpr std::int64_t DROPPED = -1;  // li܂͏j
+
+    struct ScanPoint {
+        std::int64_t time;
+        std::int64_t used;
+        std::int64_t capacity;
+    };
+
+    std::vector<std::string> names;
+    std::map<std::string, std::uint32_t> ids;
+    std::vector<std::vector<std::pair<std::int64_t, std::int64_t>>> changes;  // (, TCY or DROPPED)
+    std::vector<std::int64_t> lastValue;  // ̊iDROPPED  0j
+    std::vector<ScanPoint> scans;
+    size_t validLength = 0;  // ĂȂ̒iǋLj
+
+    bool applyScan(LogRecord::Reader& reader) {
+        ScanPoint previous = scans.empty() ? ScanPoint{ 0, 0, 0 } : scans.back();
+        std::int64_t dTime = 0, dUsed = 0, dCapacity = 0;
+        std::uint64_t count = 0;
+        if (!reader.getSigned(dTime) || !reader.getSigned(dUsed) || !reader.getSigned(dCapacity) ||
+            !reader.getVarint(count)) {
+            return false;
+        }
+        ScanPoint point{ previous.time + dTime, previous.used + dUsed, previous.capacity + dCapacity };
+        for (std::uint64_t i = 0; i < count; ++i) {
+            std::uint64_t length = 0;
+            if (!reader.getVarint(length) || reader.end - reader.position < length) {
+                return false;
+            }
+            addName(std::string(reader.data, reader.position, static_cast<size_t>(length)));
+            reader.position += static_cast<size_t>(length);
+        }
+        std::uint64_t id = 0;
+        if (!reader.getVarint(count)) {
+            return false;
+        }
+        for (std::uint64_t i = 0; i < count; ++i) {
+            std::uint64_t gap = 0;
+            std::int64_t delta = 0;
+            if (!reader.getVarint(gap) || !reader.getSigned(delta) || (id += gap) >= names.size()) {
+                return false;
+            }
+            lastValue[id] += delta;
+            changes[id].emplace_back(point.time, lastValue[id]);
+        }
+        id = 0;
+        if (!reader.getVarint(count)) {
+            return false;
+        }
+        for (std::uint64_t i = 0; i < count; ++i) {
+            std::uint64_t gap = 0;
+            if (!reader.getVarint(gap) || (id += gap) >= names.size()) {
+                return false;
+            }
+            lastValue[id] = 0;
+            changes[id].emplace_back(point.time, DROPPED);
+        }
+        scans.push_back(point);
+        return true;
+    }
+
+    std::uint32_t addName(const std::string& name) {
+        names.push_back(name);
+        changes.emplace_back();
+        lastValue.push_back(0);
+        std::uint32_t id = static_cast<std::uint32_t>(names.size() - 1);
+        ids.emplace(name, id);
+        return id;
+    }
+
+    bool isPresent(std::uint32_t id) const {
+        return !changes[id].empty() && changes[id].back().second != DROPPED;
+    }
+
+    // ԓ̊eXL_̒lɒ𓖂Ă͂߂
+    template <typename ValueAt>
+    bool fitTrend(double days, ValueAt&& valueAt, Trend& trend) const {
+        if (scans.empty()) {
+            return false;
+        }
+        std::int64_t since = scans.back().time - static_cast<std::int64_t>(days * 86400.0);
+        auto begin = std::lower_bound(scans.begin(), scans.end(), since,
+                                      [](const ScanPoint& p, std::int64_t t) { return p.time < t; });
+        double sumT = 0, sumV = 0, sumTT = 0, sumTV = 0;
+        trend = Trend();
+        for (auto it = begin; it != scans.end(); ++it) {
+            std::int64_t value = 0;
+            if (!valueAt(*it, value)) {
+                continue;
+            }
+            if (trend.samples == 0) {
+                trend.from = it->time;
+                trend.first = value;
+            }
+            trend.to = it->time;
+            trend.last = value;
+            double t = static_cast<double>(it->time - scans.back().time) / 86400.0;
+            double v = static_cast<double>(value);
+            sumT += t;
+            sumV += v;
+            sumTT += t * t;
+            sumTV += t * v;
+            trend.samples++;
+        }
+        if (trend.samples < 2) {
+            return false;
+        }
+        double n = static_cast<double>(trend.samples);
+        double denominator = n * sumTT - sumT * sumT;
+        trend.bytesPerDay = denominator != 0 ? (n * sumTV - sumT * sumV) / denominator : 0;
+        double intercept = (sumV - trend.bytesPerDay * sumT) / n;  // Ō̃XLł̒l
+        trend.intercept = intercept + trend.bytesPerDay *
+            static_cast<double>(trend.to - scans.back().time) / 86400.0;
+        return true;
+    }
+
+public:
+    // ǂݍށBt@CȂ΋̗ƂĐ
+    bool load(const fs::path& path, std::string& error) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            return true;
+        }
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        bool valid = true;
+        size_t records = 0;
+        validLength = LogRecord::forEach(data, 0, [&](char type, LogRecord::Reader& reader) {
+            std::string text;
+            if (records++ == 0) {
+                valid = type == HEADER && reader.getString(text) && text == FORMAT;
+                return valid;
+            }
+            return type == SCAN && applyScan(reader);
+        });
+        if (!valid && !data.empty()) {
+            error = "not a DiskWiz size history: " + path.string();
+            return false;
+        }
+        return true;
+    }
+
+    // 1񕪂̃XLǋLBdirectories ͂lȏ̃fBNg (UTF-8 pX, TCY)
+    bool append(const fs::path& path, std::int64_t time, std::uintmax_t used, std::uintmax_t capacity,
+                const std::vector<std::pair<std::string, std::uintmax_t>>& directories,
+                size_t& recordBytes, std::string& error) {
+        ScanPoint previous = scans.empty() ? ScanPoint{ 0, 0, 0 } : scans.back();
+        ScanPoint point{ time, static_cast<std::int64_t>(used), static_cast<std::int64_t>(capacity) };
+        std::string payload;
+        LogRecord::putSigned(payload, point.time - previous.time);
+        LogRecord::putSigned(payload, point.used - previous.used);
+        LogRecord::putSigned(payload, point.capacity - previous.capacity);
+
+        // VOɔԍUAς̂Ə̂ԍɍŏ
+        size_t firstNew = names.size();
+        std::vector<std::pair<std::uint32_t, std::int64_t>> current;
+        for (const auto& directory : directories) {
+            auto it = ids.find(directory.first);
+            std::uint32_t id = it != ids.end() ? it->second : addName(directory.first);
+            current.emplace_back(id, static_cast<std::int64_t>(directory.second));
+        }
+        std::sort(current.begin(), current.end());
+        LogRecord::putVarint(payload, names.size() - firstNew);
+        for (size_t id = firstNew; id < names.size(); ++id) {
+            LogRecord::putVarint(payload, names[id].size());
+            payload += names[id];
+        }
+        std::string changed, dropped;
+        std::uint64_t changedCount = 0, droppedCount = 0;
+        std::uint32_t lastChanged = 0, lastDropped = 0;
+        std::vector<bool> seen(names.size(), false);
+        for (const auto& entry : current) {
+            seen[entry.first] = true;
+            if (isPresent(entry.first) && lastValue[entry.first] == entry.second) {
+                continue;
+            }
+            LogRecord::putVarint(changed, entry.first - lastChanged);
+            LogRecord::putSigned(changed, entry.second - lastValue[entry.first]);
+            lastChanged = entry.first;
+            changedCount++;
+        }
+        for (std::uint32_t id = 0; id < names.size(); ++id) {
+            if (!seen[id] && isPresent(id)) {
+                LogRecord::putVarint(dropped, id - lastDropped);
+                lastDropped = id;
+                droppedCount++;
+            }
+        }
+        LogRecord::putVarint(payload, changedCount);
+        payload += changed;
+        LogRecord::putVarint(payload, droppedCount);
+        payload += dropped;
+
+        // VO͂AǂݍݎƓ菇Ŕf
+        names.resize(firstNew);
+        changes.resize(firstNew);
+        lastValue.resize(firstNew);
+        for (auto it = ids.begin(); it != ids.end();) {
+            it = it->second >= firstNew ? ids.erase(it) : std::next(it);
+        }
+
+        std::string data;
+        if (validLength == 0) {
+            std::string header;
+            LogRecord::putString(header, FORMAT);
+            LogRecord::append(data, HEADER, header);
+        }
+        LogRecord::append(data, SCAN, payload);
+        recordBytes = data.size();
+
+        // ̖ΐ؂l߂ĂǋL
+        std::error_code ec;
+        if (fs::exists(path, ec) && fs::file_size(path, ec) != validLength) {
+            fs::resize_file(path, validLength, ec);
+        }
+        std::ofstream out(path, std::ios::binary | std::ios::app);
+        out.write(data.data(), static_cast<std::streamsize>(data.size()));
+        out.close();
+        if (ec || !out) {
+            error = "cannot append to " + path.string();
+            return false;
+        }
+
+        LogRecord::Reader reader{ payload, 0, payload.size() };
+        applyScan(reader);
+        validLength += data.size();
+        return true;
+    }
+
+    size_t scanCount() const {
+        return scans.size();
+    }
+
+    size_t seriesCount() const {
+        return names.size();
+    }
+
+    size_t fileBytes() const {
+        return validLength;
+    }
+
+    std::int64_t firstScanTime() const {
+        return scans.empty() ? 0 : scans.front().time;
+    }
+
+    std::int64_t lastScanTime() const {
+        return scans.empty() ? 0 : scans.back().time;
+    }
+
+    std::int64_t capacity() const {
+        return scans.empty() ? 0 : scans.back().capacity;
+    }
+
+    // fBNg̒ days Ԃ̑
+    bool directoryTrend(const std::string& path, double days, Trend& trend) const {
+        auto found = ids.find(path);
+        if (found == ids.end()) {
+            return false;
+        }
+        const auto& series = changes[found->second];
+        return fitTrend(days, [&series](const ScanPoint& scan, std::int64_t& value) {
+            // ̎_ŗLȕω_il̊Ԃ͕W{ɂȂj
+            auto it = std::upper_bound(series.begin(), series.end(), scan.time,
+                                       [](std::int64_t t, const std::pair<std::int64_t, std::int64_t>& change) {
+                                           return t < change.first;
+                                       });
+            if (it == series.begin() || std::prev(it)->second == DROPPED) {
+                return false;
+            }
+            value = std::prev(it)->second;
+            return true;
+        }, trend);
+    }
+
+    // {[gpʂ̒ days Ԃ̑
+    bool volumeTrend(double days, Trend& trend) const {
+        return fitTrend(days, [](const ScanPoint& scan, std::int64_t& value) {
+            value = scan.used;
+            return scan.capacity > 0;
+        }, trend);
+    }
+};
+
+// ^[Qbg̑傫̈ȖڈBt@C͑Ɋm肷̂ōŗDA
+// fBNg̓Ggist_size TZjƃTufBNgiN - 2j猩ς
+double sizeHint(const fs::path& path) {
+    std::error_code ec;
+    if (!fs::is_directory(path, ec)) {
+        return std::numeric_limits<double>::max();
+    }
+#ifdef __linux__
+    struct stat st;
+    if (::lstat(path.c_str(), &st) != 0) {
+        return 0;
+    }
+    double entries = static_cast<double>(st.st_size) / 32.0 + 1.0;
+    double subdirs = st.st_nlink > 2 ? static_cast<double>(st.st_nlink - 2) : 0.0;
+    return entries * (subdirs + 1.0);
+#else
+    // NgȂł͒̃Gg𐔂ij
+    const size_t MAX_COUNT = 10000;
+    double entries = 1, subdirs = 0;
+    for (fs::directory_iterator it(path, ec), end; !ec && it != end && entries < MAX_COUNT;
+         it.increment(ec)) {
+        entries++;
+        if (it->is_directory(ec)) {
+            subdirs++;
+        }
+    }
+    return entries * (subdirs + 1.0);
+#endif
+}
+
+// N̕тŌɕωL^ȋ̎wWj
+class RankingStabilityTracker {
+private:
+    std::vector<fs::path> lastOrder;
+    std::chrono::steady_clock::time_point lastChange;
+
+public:
+    void observe(const std::vector<PathSizeInfo>& top,
+                 std::chrono::steady_clock::time_point now) {
+        std::vector<fs::path> order;
+        order.reserve(top.size());
+        for (const auto& info : top) {
+            order.push_back(info.path);
+        }
+        if (order != lastOrder) {
+            lastOrder = std::move(order);
+            lastChange = now;
+        }
+    }
+
+    std::chrono::steady_clock::time_point lastChangeTime() const {
+        return lastChange;
+    }
+};
+
+// XLŜ̃fBNg̖؁B[g^[Qbg܂ł̍iɁAe^[Qbg TreeFragment ȂB
+// \ZienforceBudgetj𒴂ƁA؂Xst@C֏o1̃m[hɂ܂Ƃ߁A
+// łȂ΃t@CPʂ̋L^߂
+class ScanTree {
+public:
+    using NativeString = fs::path::string_type;
+
+    struct MemoryStatistics {
+        std::int64_t peakBytes = 0;     // ؂̌ς̍ői̒fЂ܂ށj
+        size_t spilledSubtrees = 0;
+        std::uint64_t spilledNodes = 0;
+        std::uint64_t spillFileBytes = 0;
+        bool filesDropped = false;
+    };
+
+private:
+    struct Node {
+        std::uint32_t parent = 0;
+        NativeString name;
+        std::uintmax_t ownBytes = 0;  // fBNg: ̃t@Ĉm[hɂĂȂ
+        std::uintmax_t totalBytes = 0;
+        std::int64_t mtime = 0;
+        std::int64_t ctime = 0;
+        bool isDirectory = true;
+        bool isTarget = false;
+        bool isPartial = false;
+        bool isStale = false;
+        bool isAggregated = false;
+        std::uint32_t spill = 0;      // qXst@C֏oꍇAspills ̔ԍ + 1
+        std::vector<std::uint32_t> children;
+    };
+
+    // Xst@C̕؁Broot  0 ƂO̎q̃m[hiYƖÖʒu͕ؓjƖO
+    struct SpillRange {
+        std::uint64_t offset;
+        std::uint64_t nodeCount;
+        std::uint64_t stringsSize;
+    };
+
+    std::mutex mutex;
+    HugePageVector<Node> nodes{ Node() };  // nodes[0] ׂ͂Ẵ[g̏̉zm[h
+    std::map<std::pair<std::uint32_t, NativeString>, std::uint32_t> skeleton;
+    size_t directoryCount = 0;
+    TreeMemory memory;
+    std::int64_t accounted = 0;         // memory ɉZA̖؂̃m[h̕
+    std::vector<SpillRange> spills;
+    std::uint64_t spilledNodeCount = 0;
+    fs::path spillBase;   // Xst@C̖Ǒiۂ̖O spillPathj
+    fs::path spillPath;
+    std::fstream spillFile;
+    std::uint64_t spillSize = 0;
+    MemoryStatistics statistics;
+
+    // ς肪\Ẑ̊𒴂畔؂oADROP_FRACTION 𒴂t@CPʂ̋L^߂
+    static constexpr double SPILL_FRACTION = 0.6;
+    static constexpr double DROP_FRACTION = 0.9;
+
+    static std::int64_t costOf(const Node& node) {
+        return static_cast<std::int64_t>(sizeof(Node) + node.name.size() * sizeof(fs::path::value_type) +
+                                         sizeof(std::uint32_t));  // e children 1vf
+    }
+
+    // e͏ɎqOɒǉiWv͓Y̋tōςށj
+    std::uint32_t addNode(std::uint32_t parent, const NativeString& name, bool isDirectory) {
+        nodes.emplace_back();
+        nodes.back().parent = parent;
+        nodes.back().name = name;
+        nodes.back().isDirectory = isDirectory;
+        std::int64_t cost = costOf(nodes.back());
+        accounted += cost;
+        memory.bytes.fetch_add(cost, std::memory_order_relaxed);
+        std::uint32_t index = static_cast<std::uint32_t>(nodes.size() - 1);
+        nodes[parent].children.push_back(index);
+        directoryCount += isDirectory ? 1 : 0;
+        return index;
+    }
+
+    // Z𖼑OɕׂOBXibvVbgƃXst@Cœg
+    static bool nameLess(const NativeString& a, const NativeString& b) {
+#ifdef _WIN32
+        return toUtf8(a) < toUtf8(b);
+#else
+        return a < b;
+#endif
+    }
+
+    void sortChildren(Node& node) {
+        std::sort(node.children.begin(), node.children.end(), [this](std::uint32_t a, std::uint32_t b) {
+            return nameLess(nodes[a].name, nodes[b].name);
+        });
+    }
+
+    static std::uint32_t flagsOf(const Node& node) {
+        return (node.isDirectory ? SNAPSHOT_DIRECTORY : 0) | (node.isTarget ? SNAPSHOT_TARGET : 0) |
+            (node.isPartial ? SNAPSHOT_PARTIAL : 0) | (node.isStale ? SNAPSHOT_STALE : 0) |
+            (node.isAggregated ? SNAPSHOT_AGGREGATED : 0);
+    }
+
+    // 폜̈󂪕tĂȂm[hVzɈڂAYtւieʂjB
+    // mutex ێԂŌĂԂ
+    void compact(const std::vector<char>& removed) {
+        std::vector<std::uint32_t> renumber(nodes.size(), 0);
+        HugePageVector<Node> kept;
+        kept.reserve(std::count(removed.begin(), removed.end(), 0));
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            if (!removed[i]) {
+                renumber[i] = static_cast<std::uint32_t>(kept.size());
+                kept.push_back(std::move(nodes[i]));
+            }
+        }
+        std::int64_t cost = 0;
+        for (auto& node : kept) {
+            node.parent = renumber[node.parent];
+            std::vector<std::uint32_t> children;
+            children.reserve(node.children.size());
+            for (std::uint32_t child : node.children) {
+                if (!removed[child]) {
+                    children.push_back(renumber[child]);
+                }
+            }
+            node.children.swap(children);
+            cost += costOf(node);
+        }
+        std::map<std::pair<std::uint32_t, NativeString>, std::uint32_t> renamed;
+        for (const auto& entry : skeleton) {
+            if (!removed[entry.first.first] && !removed[entry.second]) {
+                renamed.emplace(std::make_pair(renumber[entry.first.first], entry.first.second),
+                                renumber[entry.second]);
+            }
+        }
+        skeleton.swap(renamed);
+        nodes.swap(kept);
+        memory.bytes.fetch_add(cost - accounted, std::memory_order_relaxed);
+        accounted = cost;
+    }
+
+    bool openSpillFile() {
+        if (!spillFile.is_open()) {
+            // \ł閼Oł̂ŁÃt@C⃊N؂l߂Ȃ悤rIɍ
+            fs::path created = createPrivateFile(spillBase);
+            if (created.empty()) {
+                return false;
+            }
+            spillPath = created;
+            spillFile.open(spillPath, std::ios::binary | std::ios::in | std::ios::out);
+            if (!spillFile) {
+                std::error_code ec;
+                fs::remove(spillPath, ec);
+                spillPath.clear();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // root ̎qOŃXst@C֒ǋLBsubtreeCount ͊em[h̕؂̃m[hA
+    // children(node, function) ͎q𖼑OɓnAdescribe(node, record) ͑傫EEtO𖄂߂
+    // UTF-8 ̖OԂ
+    template <typename Children, typename Describe>
+    bool appendSpill(std::uint32_t root, const std::vector<std::uint32_t>& subtreeCount,
+                     Children&& children, Describe&& describe) {
+        if (!openSpillFile()) {
+            return false;
+        }
+        SpillRange range{ spillSize, 0, 0 };
+        std::string strings;
+        std::vector<std::pair<std::uint32_t, std::uint32_t>> stack;  // (m[h, ؓ̐e)
+        auto pushChildren = [&](std::uint32_t node, std::uint32_t local) {
+            size_t first = stack.size();
+            children(node, [&](std::uint32_t child) { stack.emplace_back(child, local); });
+            std::reverse(stack.begin() + static_cast<std::ptrdiff_t>(first), stack.end());
+        };
+        pushChildren(root, 0);
+        spillFile.seekp(static_cast<std::streamoff>(spillSize));
+        while (!stack.empty()) {
+            std::uint32_t node = stack.back().first;
+            std::uint32_t parent = stack.back().second;
+            stack.pop_back();
+            std::uint32_t local = static_cast<std::uint32_t>(++range.nodeCount);
+            SnapshotNode record = {};
+            std::string name = describe(node, record);
+            record.parent = parent;
+            record.end = local + subtreeCount[node];
+            record.nameOffset = strings.size();
+            record.nameLength = static_cast<std::uint32_t>(name.size());
+            spillFile.write(reinterpret_cast<const char*>(&record), sizeof(record));
+            strings += name;
+            pushChildren(node, local);
+        }
+        range.stringsSize = strings.size();
+        spillFile.write(strings.data(), static_cast<std::streamsize>(strings.size()));
+        if (!spillFile) {
+            return false;
+        }
+        spillSize += range.nodeCount * sizeof(SnapshotNode) + strings.size();
+        spills.push_back(range);
+        spilledNodeCount += range.nodeCount;
+        return true;
+    }
+
+    // m[h̎qOŃXst@C֒ǋLBsubtreeCount ͊em[h̕؂̃m[h
+    bool spillSubtree(std::uint32_t root, const std::vector<std::uint32_t>& subtreeCount) {
+        return appendSpill(root, subtreeCount, [this](std::uint32_t node, auto&& function) {
+            sortChildren(nodes[node]);
+            for (std::uint32_t child : nodes[node].children) {
+                function(child);
+            }
+        }, [this](std::uint32_t node, SnapshotNode& record) {
+            const Node& source = nodes[node];
+            record.size = source.totalBytes;
+            record.mtime = source.mtime;
+            record.ctime = source.ctime;
+            record.flags = flagsOf(source);
+            return toUtf8(source.name);
+        });
+    }
+
+    // ^[QbgŁAv keepAbove ̕؂o1̃m[hɂ܂Ƃ߂B
+    // 傫fBNg̓ɎĉŁAzbgX|bg◚~͈͎͂Ȃ
+    bool spillCompleted(std::uintmax_t keepAbove) {
+        rollUp();
+        // oς݂̃m[h܂ޕ؂͏oȂiXst@CœqɂȂj
+        std::vector<std::uint32_t> subtreeCount(nodes.size(), 1);
+        std::vector<char> containsSpill(nodes.size(), 0);
+        for (size_t i = nodes.size() - 1; i > 0; --i) {
+            subtreeCount[nodes[i].parent] += subtreeCount[i];
+            containsSpill[nodes[i].parent] |= containsSpill[i] || nodes[i].spill != 0;
+        }
+        // removed: 0 cA1 폜io؂̎qjA2 o؂̍
+        std::vector<char> removed(nodes.size(), 0);
+        std::vector<char> inTarget(nodes.size(), 0);
+        bool ok = true;
+        for (size_t i = 1; i < nodes.size(); ++i) {
+            Node& node = nodes[i];
+            if (removed[node.parent]) {
+                removed[i] = 1;
+                continue;
+            }
+            inTarget[i] = node.isTarget || inTarget[node.parent];
+            if (!ok || !inTarget[i] || node.children.empty() || containsSpill[i] ||
+                node.totalBytes >= keepAbove) {
+                continue;
+            }
+            if (!spillSubtree(static_cast<std::uint32_t>(i), subtreeCount)) {
+                ok = false;
+                continue;
+            }
+            node.ownBytes = node.totalBytes;
+            node.spill = static_cast<std::uint32_t>(spills.size());
+            removed[i] = 2;
+            statistics.spilledSubtrees++;
+        }
+        for (auto& mark : removed) {
+            mark = mark == 1;
+        }
+        compact(removed);
+        spillFile.flush();
+        return ok && static_cast<bool>(spillFile);
+    }
+
+    // t@C̃m[hefBNg̍vɂ܂Ƃ߂it@C̃^[Qbg͎cj
+    void dropFileNodes() {
+        std::vector<char> removed(nodes.size(), 0);
+        for (size_t i = 1; i < nodes.size(); ++i) {
+            Node& node = nodes[i];
+            if (!node.isDirectory && !node.isTarget) {
+                nodes[node.parent].ownBytes += node.ownBytes;
+                nodes[node.parent].isAggregated = true;
+                removed[i] = 1;
+            }
+        }
+        compact(removed);
+    }
+
+    // mutex ێԂŌĂԂ
+    std::uint32_t nodeForPath(const fs::path& path) {
+        std::uint32_t node = 0;
+        for (const auto& part : path) {
+            auto key = std::make_pair(node, part.native());
+            auto it = skeleton.find(key);
+            if (it != skeleton.end()) {
+                node = it->second;
+            } else {
+                std::uint32_t child = addNode(node, part.native(), true);
+                skeleton.emplace(key, child);
+                node = child;
+            }
+        }
+        return node;
+    }
+
+    // e؂̍v߂Bmutex ێԂŌĂԂ
+    void rollUp() {
+        for (auto& node : nodes) {
+            node.totalBytes = node.ownBytes;
+        }
+        for (size_t i = nodes.size() - 1; i > 0; --i) {
+            nodes[nodes[i].parent].totalBytes += nodes[i].totalBytes;
+        }
+    }
+
+public:
+    // findHotspots gǂݎp̃ANZT
+    std::uintmax_t totalBytes(std::uint32_t node) const {
+        return nodes[node].totalBytes;
+    }
+
+    bool isDirectory(std::uint32_t node) const {
+        return nodes[node].isDirectory;
+    }
+
+    template <typename Function>
+    void forEachChild(std::uint32_t node, Function&& function) const {
+        for (std::uint32_t child : nodes[node].children) {
+            function(child);
+        }
+    }
+
+    // FrozenTree::build giUTF-8 ̖OƃXibvVbg̃tOj
+    std::string name(std::uint32_t node) const {
+        return toUtf8(nodes[node].name);
+    }
+
+    std::uint32_t flags(std::uint32_t node) const {
+        return flagsOf(nodes[node]);
+    }
+
+    fs::path pathOf(std::uint32_t node) const {
+        std::vector<std::uint32_t> chain;
+        for (; node != 0; node = nodes[node].parent) {
+            chain.push_back(node);
+        }
+        fs::path path;
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+            path /= nodes[*it].name;
+        }
+        return path;
+    }
+
+    // fBNg̃^[Qbg̖؂Ȃ
+    void attach(const fs::path& target, const TreeFragment& fragment, bool partial) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<std::uint32_t> mapped(fragment.nodes.size());
+        mapped[0] = nodeForPath(target);
+        Node& top = nodes[mapped[0]];
+        top.ownBytes += fragment.nodes[0].bytes;
+        top.mtime = fragment.nodes[0].mtime;
+        top.ctime = fragment.nodes[0].ctime;
+        top.isTarget = true;
+        top.isPartial = partial;
+        top.isAggregated = fragment.nodes[0].isAggregated;
+        bool dropFiles = memory.dropFiles.load();
+        for (size_t i = 1; i < fragment.nodes.size(); ++i) {
+            const auto& source = fragment.nodes[i];
+            if (dropFiles && !source.isDirectory) {
+                // t@CPʂ̋L^߂́AfЂɎcĂt@Ceɂ܂Ƃ߂
+                nodes[mapped[source.parent]].ownBytes += source.bytes;
+                nodes[mapped[source.parent]].isAggregated = true;
+                continue;
+            }
+            mapped[i] = addNode(mapped[source.parent], source.name, source.isDirectory);
+            Node& node = nodes[mapped[i]];
+            node.ownBytes = source.bytes;
+            node.mtime = source.mtime;
+            node.ctime = source.ctime;
+            node.isStale = source.isStale;
+            node.isAggregated = source.isAggregated;
+            node.spill = source.spill;
+        }
+    }
+
+    // t@C̃^[QbgBzbgX|bgł͐efBNg̒̕ƂĈ
+    void addFile(const fs::path& target, std::uintmax_t bytes, bool partial) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::uint32_t parent = nodeForPath(target.parent_path());
+        std::uint32_t node = addNode(parent, target.filename().native(), false);
+        nodes[node].ownBytes = bytes;
+        nodes[node].isTarget = true;
+        nodes[node].isPartial = partial;
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return nodes.size() - 1 + static_cast<size_t>(spilledNodeCount);
+    }
+
+    // ̒fЂZ
+    TreeMemory* memoryAccount() {
+        return &memory;
+    }
+
+    // ς肪\Z SPILL_FRACTION 𒴂犮؂oAł DROP_FRACTION 
+    // Ă΃t@CPʂ̋L^߂BkeepAbove ȏ̕؂̓ɎcB
+    // Xst@CɏȂꍇ falseiȍ~̓t@CPʂ̋L^߂ėj
+    bool enforceBudget(std::int64_t budget, std::uintmax_t keepAbove, const fs::path& spillFilePath) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::int64_t used = memory.bytes.load();
+        statistics.peakBytes = std::max(statistics.peakBytes, used);
+        if (used < static_cast<std::int64_t>(budget * SPILL_FRACTION)) {
+            return true;
+        }
+        if (spillBase.empty()) {
+            spillBase = spillFilePath;
+        }
+        bool ok = spillCompleted(keepAbove);
+        if (!ok || memory.bytes.load() >= static_cast<std::int64_t>(budget * DROP_FRACTION)) {
+            if (!memory.dropFiles.exchange(true)) {
+                dropFileNodes();
+            }
+        }
+        return ok;
+    }
+
+    // ̒fЂ̂ǂݏIipending ̉ɂȂjfBNgŁAv keepAbove ̕؂
+    // o1̃m[hɂ܂Ƃ߂B1̃^[Qbg傫ĂA؂͓ǂݓr̎}Ƒ傫
+    // fBNg̕Ɏ܂BfЂO񂩂{Ɉ܂ł͎݂ȂȋœɂȂȂ悤jB
+    // TraversalState::mutex ێԂŌĂԂƁBXst@CɏȂꍇ false
+    bool spillFragment(TreeFragment& fragment, std::vector<DirectoryWork>& pending, std::int64_t budget,
+                       std::uintmax_t keepAbove, const fs::path& spillFilePath) {
+        if (memory.bytes.load() < static_cast<std::int64_t>(budget * SPILL_FRACTION) ||
+            fragment.accounted < 2 * fragment.spillChecked) {
+            return true;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        statistics.peakBytes = std::max(statistics.peakBytes, memory.bytes.load());
+        if (spillBase.empty()) {
+            spillBase = spillFilePath;
+        }
+        auto& source = fragment.nodes;
+        size_t count = source.size();
+        std::vector<char> open(count, 0);
+        open[0] = 1;
+        for (const auto& work : pending) {
+            for (std::uint32_t node = work.node; !open[node]; node = source[node].parent) {
+                open[node] = 1;
+            }
+        }
+        // ؂̍vƃm[hAq̈ꗗiOj
+        std::vector<std::uintmax_t> total(count);
+        std::vector<std::uint32_t> subtreeCount(count, 1);
+        std::vector<char> containsSpill(count, 0);
+        std::vector<std::uint32_t> first(count + 1, 0);
+        for (size_t i = 0; i < count; ++i) {
+            total[i] = source[i].bytes;
+        }
+        for (size_t i = count - 1; i > 0; --i) {
+            total[source[i].parent] += total[i];
+            subtreeCount[source[i].parent] += subtreeCount[i];
+            containsSpill[source[i].parent] |= containsSpill[i] || source[i].spill != 0;
+            first[source[i].parent + 1]++;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            first[i + 1] += first[i];
+        }
+        std::vector<std::uint32_t> children(count > 0 ? count - 1 : 0);
+        std::vector<std::uint32_t> filled(first.begin(), first.end() - 1);
+        for (size_t i = 1; i < count; ++i) {
+            children[filled[source[i].parent]++] = static_cast<std::uint32_t>(i);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            std::sort(children.begin() + first[i], children.begin() + first[i + 1],
+                      [&source](std::uint32_t a, std::uint32_t b) { return nameLess(source[a].name, source[b].name); });
+        }
+
+        std::vector<char> removed(count, 0);
+        bool ok = true;
+        for (size_t i = 1; i < count; ++i) {
+            auto& node = source[i];
+            if (removed[node.parent]) {
+                removed[i] = 1;
+                continue;
+            }
+            if (!ok || open[i] || first[i] == first[i + 1] || containsSpill[i] || total[i] >= keepAbove) {
+                continue;
+            }
+            bool written = appendSpill(static_cast<std::uint32_t>(i), subtreeCount,
+                                       [&](std::uint32_t parent, auto&& function) {
+                for (std::uint32_t k = first[parent]; k < first[parent + 1]; ++k) {
+                    function(children[k]);
+                }
+            }, [&](std::uint32_t index, SnapshotNode& record) {
+                const auto& entry = source[index];
+                record.size = total[index];
+                record.mtime = entry.mtime;
+                record.ctime = entry.ctime;
+                record.flags = (entry.isDirectory ? SNAPSHOT_DIRECTORY : 0) | (entry.isStale ? SNAPSHOT_STALE : 0) |
+                    (entry.isAggregated ? SNAPSHOT_AGGREGATED : 0);
+                directoryCount += entry.isDirectory ? 1 : 0;  // ScanTree ̃m[hɂȂȂ̂ŁAŐ
+                return toUtf8(entry.name);
+            });
+            if (!written) {
+                ok = false;
+                continue;
+            }
+            node.bytes = total[i];
+            node.spill = static_cast<std::uint32_t>(spills.size());
+            removed[i] = 2;
+            statistics.spilledSubtrees++;
+        }
+        for (auto& mark : removed) {
+            mark = mark == 1;
+        }
+        fragment.compact(removed, pending);
+        fragment.spillChecked = fragment.accounted;
+        spillFile.flush();
+        ok = ok && static_cast<bool>(spillFile);
+        if (!ok || memory.bytes.load() >= static_cast<std::int64_t>(budget * DROP_FRACTION)) {
+            if (!memory.dropFiles.exchange(true)) {
+                dropFileNodes();
+            }
+        }
+        return ok;
+    }
+
+    MemoryStatistics memoryStatistics() {
+        std::lock_guard<std::mutex> lock(mutex);
+        MemoryStatistics result = statistics;
+        result.peakBytes = std::max(result.peakBytes, memory.bytes.load());
+        result.spilledNodes = spilledNodeCount;
+        result.spillFileBytes = spillSize;
+        result.filesDropped = memory.dropFiles.load();
+        return result;
+    }
+
+    // Xst@CďifXgN^ʂ炸ɏIOɂĂԁj
+    void removeSpillFile() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (spillFile.is_open()) {
+            spillFile.close();
+        }
+        if (!spillPath.empty()) {
+            std::error_code ec;
+            fs::remove(spillPath, ec);
+            spillPath.clear();
+        }
+    }
+
+    ~ScanTree() {
+        removeSpillFile();
+    }
+
+    size_t directories() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return directoryCount;
+    }
+
+    // lȏ̃fBNg (pX, v) e珇ɋi؂ɂ͍~Ȃj
+    std::vector<std::pair<fs::path, std::uintmax_t>> largeDirectories(std::uintmax_t threshold) {
+        std::lock_guard<std::mutex> lock(mutex);
+        rollUp();
+        std::vector<std::pair<fs::path, std::uintmax_t>> result;
+        std::vector<std::uint32_t> stack{ 0 };
+        while (!stack.empty()) {
+            std::uint32_t node = stack.back();
+            stack.pop_back();
+            for (std::uint32_t child : nodes[node].children) {
+                if (nodes[child].isDirectory && nodes[child].totalBytes >= threshold) {
+                    result.emplace_back(pathOf(child), nodes[child].totalBytes);
+                    stack.push_back(child);
+                }
+            }
+        }
+        return result;
+    }
+
+    // lȏ߂ŏ̃fBNg傫ɕԂ
+    std::vector<Hotspot> hotspots(double fraction, std::uintmax_t threshold,
+                                  std::uintmax_t& total, std::uintmax_t& explained) {
+        std::lock_guard<std::mutex> lock(mutex);
+        rollUp();
+        return findHotspots(*this, fraction, threshold, total, explained);
+    }
+
+    // WvČZ𖼑Oɂ؂AbN܂ܓǂݎp̃ANZTŒׂirɎgj
+    template <typename Function>
+    void inspect(Function&& function) {
+        std::lock_guard<std::mutex> lock(mutex);
+        rollUp();
+        for (auto& node : nodes) {
+            sortChildren(node);
+        }
+        function(static_cast<const ScanTree&>(*this));
+    }
+
+    // Wv蒼i傫ȃy[W̗LŎԂׂ邽߁j
+    void recomputeTotals() {
+        std::lock_guard<std::mutex> lock(mutex);
+        rollUp();
+    }
+
+    // ؂̃m[ȟςioCgj
+    std::int64_t memoryBytes() const {
+        return memory.bytes.load();
+    }
+
+    // XibvVbgƂďoBꎞt@CɏĂûŁA
+    // rŎsẴXibvVbg͉Ȃ
+    bool save(const fs::path& path, std::uint64_t scanFingerprint, std::string& error) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (nodes.size() > std::numeric_limits<std::uint32_t>::max()) {
+            error = "too many nodes";
+            return false;
+        }
+        rollUp();
+
+        // OɕׂiZ͖OjB؂̃m[hem[h end ߂B
+        // o؂̓Xst@C̑Ô܂܍̒ɋ
+        std::vector<std::uint64_t> subtreeCount(nodes.size(), 1);
+        for (size_t i = nodes.size() - 1; i > 0; --i) {
+            subtreeCount[i] += nodes[i].spill ? spills[nodes[i].spill - 1].nodeCount : 0;
+            subtreeCount[nodes[i].parent] += subtreeCount[i];
+        }
+        if (subtreeCount[0] > std::numeric_limits<std::uint32_t>::max()) {
+            error = "too many nodes";
+            return false;
+        }
+        std::vector<std::uint32_t> order;
+        std::vector<std::uint32_t> position(nodes.size());
+        order.reserve(nodes.size());
+        std::uint64_t nextPosition = 0;
+        std::vector<std::uint32_t> stack{ 0 };
+        while (!stack.empty()) {
+            std::uint32_t node = stack.back();
+            stack.pop_back();
+            position[node] = static_cast<std::uint32_t>(nextPosition);
+            nextPosition += 1 + (nodes[node].spill ? spills[nodes[node].spill - 1].nodeCount : 0);
+            order.push_back(node);
+            sortChildren(nodes[node]);
+            auto& children = nodes[node].children;
+            stack.insert(stack.end(), children.rbegin(), children.rend());
+        }
+        if (spillFile.is_open()) {
+            spillFile.flush();
+        }
+        // Xst@C̋Ԃǂ݁AYƖÖʒu炵Ďʂ
+        auto copySpill = [this](std::ofstream& out, const SpillRange& range, bool records, std::uint32_t base,
+                                std::uint64_t nameBase) {
+            const size_t CHUNK = 4096;
+            std::vector<SnapshotNode> chunk(CHUNK);
+            if (records) {
+                spillFile.seekg(static_cast<std::streamoff>(range.offset));
+                for (std::uint64_t done = 0; done < range.nodeCount;) {
+                    size_t count = static_cast<size_t>(std::min<std::uint64_t>(CHUNK, range.nodeCount - done));
+                    spillFile.read(reinterpret_cast<char*>(chunk.data()),
+                                   static_cast<std::streamsize>(count * sizeof(SnapshotNode)));
+                    for (size_t i = 0; i < count; ++i) {
+                        chunk[i].parent += base;
+                        chunk[i].end += base;
+                        chunk[i].nameOffset += nameBase;
+                    }
+                    out.write(reinterpret_cast<const char*>(chunk.data()),
+                              static_cast<std::streamsize>(count * sizeof(SnapshotNode)));
+                    done += count;
+                }
+            } else {
+                spillFile.seekg(static_cast<std::streamoff>(range.offset + range.nodeCount * sizeof(SnapshotNode)));
+                std::vector<char> buffer(64 * 1024);
+                for (std::uint64_t done = 0; done < range.stringsSize;) {
+                    size_t count = static_cast<size_t>(std::min<std::uint64_t>(buffer.size(), range.stringsSize - done));
+                    spillFile.read(buffer.data(), static_cast<std::streamsize>(count));
+                    out.write(buffer.data(), static_cast<std::streamsize>(count));
+                    done += count;
+                }
+            }
+            return static_cast<bool>(spillFile);
+        };
+
+        fs::path temp = path;
+        temp += ".tmp";
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            error = "cannot create " + temp.string();
+            return false;
+        }
+        auto pad = [&out](std::uint64_t written) {
+            static const char zeros[8] = {};
+            out.write(zeros, static_cast<std::streamsize>((8 - written % 8) % 8));
+            return (written + 7) / 8 * 8;
+        };
+
+        SnapshotHeader header = {};
+        std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.version = SNAPSHOT_VERSION;
+        header.byteOrder = SNAPSHOT_BYTE_ORDER;
+        header.headerSize = sizeof(SnapshotHeader);
+        header.nodeCount = nextPosition;
+        header.nodesOffset = sizeof(SnapshotHeader);
+        header.directoryCount = directoryCount;
+        header.createdAt = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        header.scanFingerprint = scanFingerprint;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        std::vector<std::uint32_t> targets;
+        std::uint64_t nameOffset = 0;
+        bool spillRead = true;
+        for (size_t i = 0; i < order.size(); ++i) {
+            const Node& source = nodes[order[i]];
+            std::uint32_t self = position[order[i]];
+            std::string name = toUtf8(source.name);
+            SnapshotNode record = {};
+            record.size = source.totalBytes;
+            record.mtime = source.mtime;
+            record.ctime = source.ctime;
+            record.parent = i == 0 ? 0 : position[source.parent];
+            record.end = static_cast<std::uint32_t>(self + subtreeCount[order[i]]);
+            record.nameOffset = nameOffset;
+            record.nameLength = static_cast<std::uint32_t>(name.size());
+            record.flags = flagsOf(source);
+            out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+            nameOffset += name.size();
+            if (source.isTarget) {
+                targets.push_back(self);
+            }
+            if (source.spill) {
+                const SpillRange& range = spills[source.spill - 1];
+                spillRead = spillRead && copySpill(out, range, true, self, nameOffset);
+                nameOffset += range.stringsSize;
+            }
+        }
+        header.targetCount = targets.size();
+        header.targetsOffset = header.nodesOffset + header.nodeCount * sizeof(SnapshotNode);
+        out.write(reinterpret_cast<const char*>(targets.data()),
+                  static_cast<std::streamsize>(targets.size() * sizeof(std::uint32_t)));
+        header.stringsOffset = header.targetsOffset + pad(targets.size() * sizeof(std::uint32_t));
+        header.stringsSize = nameOffset;
+        for (std::uint32_t node : order) {
+            std::string name = toUtf8(nodes[node].name);
+            out.write(name.data(), static_cast<std::streamsize>(name.size()));
+            if (nodes[node].spill) {
+                spillRead = spillRead && copySpill(out, spills[nodes[node].spill - 1], false, 0, 0);
+            }
+        }
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.close();
+        if (!out || !spillRead) {
+            std::error_code ec;
+            error = "write failed: " + temp.string();
+            fs::remove(temp, ec);
+            return false;
+        }
+        std::error_code ec;
+        fs::rename(temp, path, ec);
+        if (ec) {
+            error = ec.message();
+            fs::remove(temp, ec);
+            return false;
+        }
+        return true;
+    }
+};
+
+// _1{̌oHt܂ŒHA؂̃oCgsΐ肷iKnuth ̖؂̑傫jB
+// state ΊeEHb`hbO̊ĎōsApꂽ炻̎_Ŗ߂
+double probeSubtreeBytes(const DirectoryWork& dir, std::mt19937_64& rng,
+                         const TraversalContext& ctx, TraversalState* state = nullptr) {
+    const int MAX_PROBE_DEPTH = 64;
+    double estimate = 0;
+    double weight = 1;
+    DirectoryWork current = dir;
+
+    for (int depth = 0; depth < MAX_PROBE_DEPTH; ++depth) {
+        std::uintmax_t fileBytes = 0;
+        std::vector<DirectoryWork> subdirs;
+        if (ctx.throttle) {
+            ctx.throttle->acquire(ctx.device);
+        }
+        if (state) {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->currentDir = current.path;
+            state->beginOperation();
+        }
+        if (shouldSkipDirectory(current.path, ctx.stayOnDevice) ||
+            isOtherRoot(ctx.otherRoots, current.path)) {
+            break;
+        }
+        // fBNgxK̂ŁAł̎s̓G[ɐȂ
+        std::error_code ec;
+        fs::directory_iterator it(current.path, ec), end;
+        for (; !ec && it != end; it.increment(ec)) {
+            if (ctx.stopRequested() || (state && state->abandoned)) {
+                if (state) {
+                    state->endOperation();
+                }
+                return estimate;
+            }
+            if (state) {
+                state->beginOperation();  // Ԑ͌Ăяo1񂲂
+            }
+            ctx.stats->entries++;
+            const auto& entry = *it;
+            std::error_code entryError;
+            if (entry.is_symlink(entryError) || entryError) {
+                continue;
+            }
+            ExclusionSet::State childState;
+            bool isDir = entry.is_directory(entryError);
+            if (entryError || advanceExclusion(ctx, current.exclusion, entry.path(), isDir,
+                                               [&entry]() { return entryFacts(entry); },
+                                               childState)) {
+                continue;
+            }
+            if (isDir) {
+                subdirs.push_back(DirectoryWork{ entry.path(), std::move(childState), nullptr, 0, 0 });
+            } else if (entry.is_regular_file(entryError)) {
+                std::uintmax_t size = entry.file_size(entryError);
+                fileBytes += entryError ? 0 : size;
+            }
+        }
+
+        if (state && !state->endOperation()) {
+            return estimate;
+        }
+
+        // ̊Kw̃t@ĆAɎm̋tŏdݕt
+        estimate += weight * static_cast<double>(fileBytes);
+        if (subdirs.empty()) {
+            break;
+        }
+        std::uniform_int_distribution<size_t> pick(0, subdirs.size() - 1);
+        weight *= static_cast<double>(subdirs.size());
+        current = std::move(subdirs[pick(rng)]);
+    }
+    if (state) {
+        state->endOperation();
+    }
+    return estimate;
+}
+
+// TfBNg疳גoAc̍vTCYƕU𐄒肷B
+// v[u state ̃EHb`hbO̊ĎōsipꂽW{ȂŖ߂j
+SubtreeEstimate estimateUnexplored(const std::vector<DirectoryWork>& frontier,
+                                   const std::chrono::steady_clock::time_point& until,
+                                   const TraversalContext& ctx, TraversalState* state = nullptr) {
+    const size_t SAMPLE_DIRS = 16;
+    const int PROBES_PER_DIR = 4;
+    SubtreeEstimate estimate;
+    if (frontier.empty()) {
+        return estimate;
+    }
+
+    thread_local std::mt19937_64 rng(std::random_device{}());
+    std::vector<size_t> order(frontier.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), rng);
+
+    // ofBNgƂ̐l̕ςƕUŜO}
+    std::vector<double> samples;
+    for (size_t i = 0; i < order.size() && samples.size() < SAMPLE_DIRS; ++i) {
+        if (std::chrono::steady_clock::now() >= until || ctx.stopRequested()) {
+            break;
+        }
+        double sum = 0;
+        for (int p = 0; p < PROBES_PER_DIR; ++p) {
+            sum += probeSubtreeBytes(frontier[order[i]], rng, ctx, state);
+        }
+        if (state && state->abandoned) {
+            return estimate;
+        }
+        samples.push_back(sum / PROBES_PER_DIR);
+    }
+    if (samples.empty()) {
+        return estimate;
+    }
+
+    double count = static_cast<double>(frontier.size());
+    double m = static_cast<double>(samples.size());
+    double mean = 0;
+    for (double v : samples) {
+        mean += v;
+    }
+    mean /= m;
+    double sampleVariance = 0;
+    for (double v : samples) {
+        sampleVariance += (v - mean) * (v - mean);
+    }
+    // W{1̂Ƃ͐l̂̂덷Ƃ݂Ȃ
+    sampleVariance = samples.size() > 1 ? sampleVariance / (m - 1) : mean * mean;
+
+    estimate.bytes = count * mean;
+    estimate.variance = count * count * sampleVariance / m;
+    estimate.samples = samples.size();
+    return estimate;
+}
+
+// 胂[h: e^[Qbg̍烉_v[uJԂAS񋓂ɃTCY𐄒肷B
+// v[u͑ƓԐŊĎAȂXbh͒uɂĂ̕W{̂ĂB
+// uɂXbh falseiĂяo͏I҂ɔj
+bool runProbeEstimation(ResultManager& manager, double seconds, size_t workers,
+                        ScanStats& stats, IoThrottle* throttle, bool polite,
+                        const ExclusionSet& exclusions,
+                        const std::function<const std::vector<FileIdentity>*(size_t)>& otherRootsOf,
+                        std::chrono::steady_clock::duration operationTimeout,
+                        std::chrono::steady_clock::duration networkOperationTimeout) {
+    struct Accumulator {
+        double sum = 0;
+        double sumSquares = 0;
+        size_t probes = 0;
+    };
+    // XbhQƂ́BuɂXbhŐGĂȂ悤L̏Lɂ
+    struct Shared {
+        std::vector<PathSizeInfo> targets;
+        std::vector<std::uint64_t> devices;
+        std::vector<bool> isDirectory;
+        std::vector<bool> isNetwork;
+        std::vector<DirectoryWork> roots;
+        std::vector<const std::vector<FileIdentity>*> otherRoots;
+        std::atomic<size_t> next{ 0 };
+    };
+    struct Worker {
+        std::shared_ptr<TraversalState> state = std::make_shared<TraversalState>();
+        std::vector<Accumulator> local;
+        std::atomic<bool> done{ false };
+        std::thread thread;
+    };
+
+    auto shared = std::make_shared<Shared>();
+    shared->targets = manager.getTopN(manager.totalTargets());
+    const auto& targets = shared->targets;
+    if (targets.empty()) {
+        return true;
+    }
+    shared->devices.assign(targets.size(), 0);
+    shared->isDirectory.assign(targets.size(), false);
+    shared->isNetwork.assign(targets.size(), false);
+    shared->roots.resize(targets.size());
+    shared->otherRoots.resize(targets.size());
+    for (size_t i = 0; i < targets.size(); ++i) {
+        std::error_code ec;
+        shared->isDirectory[i] = fs::is_directory(targets[i].path, ec);
+        shared->isNetwork[i] = shared->isDirectory[i] && isNetworkFilesystem(targets[i].path);
+        shared->roots[i] = DirectoryWork{ targets[i].path, exclusions.stateFor(targets[i].path), nullptr, 0, 0 };
+        shared->otherRoots[i] = otherRootsOf(targets[i].id);
+        if (throttle) {
+            shared->devices[i] = deviceIdOf(targets[i].path);
+        }
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+    auto until = startTime + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(seconds));
+
+    HangWatchdog watchdog;
+    watchdog.start([&stats](const std::shared_ptr<TraversalState>& state) {
+        fs::path hung;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->abandoned = true;
+            hung = state->currentDir;
+        }
+        stats.recordError(ErrorCategory::Timeout, hung);
+    });
+
+    // v[u̓EhrŊe^[QbgɊ蓖āAWv̓XbhƂɍs
+    std::vector<std::shared_ptr<Worker>> pool;
+    for (size_t w = 0; w < workers; ++w) {
+        auto worker = std::make_shared<Worker>();
+        worker->local.resize(targets.size());
+        worker->state->timeout = operationTimeout;
+        watchdog.add(worker->state);
+        worker->thread = std::thread([shared, worker, w, until, polite, throttle, operationTimeout,
+                                      networkOperationTimeout, &stats, &exclusions]() {
+            if (polite) {
+                lowerCurrentThreadPriority();
+            }
+            std::mt19937_64 rng(std::random_device{}() + w);
+            TraversalState& state = *worker->state;
+            auto& local = worker->local;
+            TraversalContext ctx;
+            ctx.stats = &stats;
+            ctx.throttle = throttle;
+            ctx.exclusions = &exclusions;
+            while (std::chrono::steady_clock::now() < until && !cancelRequested) {
+                size_t i = shared->next++ % shared->targets.size();
+                double bytes = 0;
+                if (shared->isDirectory[i]) {
+                    ctx.device = shared->devices[i];
+                    ctx.otherRoots = shared->otherRoots[i];
+                    state.timeout = shared->isNetwork[i] ? networkOperationTimeout : operationTimeout;
+                    bytes = probeSubtreeBytes(shared->roots[i], rng, ctx, &state);
+                } else if (local[i].probes > 0) {
+                    continue;  // t@C1񑪂Ώ\
+                } else {
+                    std::error_code ec;
+                    {
+                        std::lock_guard<std::mutex> lock(state.mutex);
+                        state.currentDir = shared->targets[i].path;
+                    }
+                    state.beginOperation();
+                    auto fileSize = fs::file_size(shared->targets[i].path, ec);
+                    state.endOperation();
+                    bytes = ec ? 0.0 : static_cast<double>(fileSize);
+                }
+                // uɂꂽ͏Ȃi܂ł̕W{͌Ăяogj
+                std::lock_guard<std::mutex> lock(state.mutex);
+                if (state.abandoned) {
+                    return;
+                }
+                local[i].sum += bytes;
+                local[i].sumSquares += bytes * bytes;
+                local[i].probes++;
+            }
+            worker->done = true;
+        });
+        pool.push_back(worker);
+    }
+
+    // SXbhI邩AȂȂĒuɂ̂҂
+    for (;;) {
+        bool waiting = false;
+        for (const auto& worker : pool) {
+            waiting |= !worker->done && !worker->state->abandoned;
+        }
+        if (!waiting) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    watchdog.stop();
+    bool allExited = true;
+    std::vector<Accumulator> totals(targets.size());
+    for (auto& worker : pool) {
+        if (worker->done) {
+            worker->thread.join();
+        } else {
+            worker->thread.detach();
+            allExited = false;
+        }
+        std::lock_guard<std::mutex> lock(worker->state->mutex);
+        for (size_t i = 0; i < targets.size(); ++i) {
+            totals[i].sum += worker->local[i].sum;
+            totals[i].sumSquares += worker->local[i].sumSquares;
+            totals[i].probes += worker->local[i].probes;
+        }
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - startTime);
+    for (size_t i = 0; i < targets.size(); ++i) {
+        const Accumulator& total = totals[i];
+        SubtreeEstimate estimate;
+        if (total.probes > 0) {
+            double n = static_cast<double>(total.probes);
+            double mean = total.sum / n;
+            double variance = total.probes > 1
+                ? std::max(0.0, (total.sumSquares - n * mean * mean) / (n - 1))
+                : mean * mean;
+            estimate.bytes = mean;
+            estimate.variance = shared->isDirectory[i] ? variance / n : 0.0;
+            estimate.samples = total.probes;
+        }
+        manager.update(targets[i].path, 0, shared->isDirectory[i], elapsed, &estimate);
+    }
+    return allExited;
+}
+
+// WvΏۃpX̎WŁAꂩ璲ׂpXi납oj
+struct CollectionWork {
+    fs::path path;
+    int depth = 0;
+    ExclusionSet::State exclusion;
+};
+
+// WvΏۃpXW֐i1XbhjB^f[^ state ̊ĎōsApꂽ
+// o^ɖ߂B̃pX state.mutex ŕی삵 pending ɒu
+void collectTargetsFrom(TraversalState& state, std::vector<CollectionWork>& pending, int maxDepth,
+                        ResultManager& manager, ScanStats& stats, const ExclusionSet& exclusions,
+                        const std::vector<FileIdentity>* otherRoots,
+                        std::chrono::steady_clock::duration operationTimeout,
+                        std::chrono::steady_clock::duration networkOperationTimeout) {
+    while (!cancelRequested) {
+        CollectionWork work;
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            if (state.abandoned || pending.empty()) {
+                return;
+            }
+            work = std::move(pending.back());
+            pending.pop_back();
+            state.currentDir = work.path;
+        }
+        bool isTarget = false;
+        std::vector<CollectionWork> children;
+        state.timeout = operationTimeout;
+        state.beginOperation();
+        try {
+            // O[Ɛ[݂̐̂`FbN
+            if (work.depth > maxDepth) {
+                state.endOperation();
+                continue;
+            }
+            std::error_code ec;
+            bool isDirectory = fs::is_directory(work.path, ec);
+            bool excluded = false;
+            if (!work.exclusion.empty()) {
+                fs::directory_entry self(work.path, ec);
+                excluded = exclusions.excludes(work.exclusion, isDirectory,
+                                               [&self]() { return entryFacts(self); });
+            }
+
+            // zt@CVXeƁÃ[g󂯎fBNg͏WvΏۂɂȂ
+            if (excluded || (isDirectory && (shouldSkipDirectory(work.path, 0) ||
+                                             isOtherRoot(otherRoots, work.path)))) {
+                // Ȃ
+            } else if (isTargetUnit(work.path, maxDepth)) {
+                // WvPʂ̔iV{bNÑ`FbN܂ށj
+                // z̓TCYŐ̂ŁAWł͍~ȂiG[̓dvhj
+                isTarget = true;
+            } else if (isDirectory && work.depth < maxDepth) {
+                // fBNg̏ꍇ͎qςށilbg[N}Egł͑ƓZɂj
+                if (isNetworkFilesystem(work.path)) {
+                    state.timeout = networkOperationTimeout;
+                }
+                fs::directory_iterator it(work.path, ec), end;
+                for (; !ec && it != end; it.increment(ec)) {
+                    state.beginOperation();  // Ԑ͌Ăяo1񂲂
+                    const fs::path& child = it->path();
+                    children.push_back(CollectionWork{
+                        child, work.depth + 1, exclusions.advance(work.exclusion, child.filename().native()) });
+                }
+                if (ec) {
+                    stats.recordError(ec, work.path);
+                }
+            }
+        } catch (...) {}
+        if (!state.endOperation()) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (state.abandoned) {
+            return;
+        }
+        if (isTarget) {
+            manager.addTarget(work.path);
+        }
+        // ꗗ̏Ɏo悤tɐςށi^[Qbg̔ԍ[D̏ɂj
+        for (auto it = children.rbegin(); it != children.rend(); ++it) {
+            pending.push_back(std::move(*it));
+        }
+    }
+}
+
+// [g1̏WvΏۂWBȂ삪΂̃pX𓞒Bs\ƂċL^A
+// ~܂Xbh͒uɂĎcVXbhőiuɂ falsej
+bool collectTargetPaths(const fs::path& root, int maxDepth, ResultManager& manager, ScanStats& stats,
+                        const ExclusionSet& exclusions, const std::vector<FileIdentity>* otherRoots,
+                        std::chrono::steady_clock::duration operationTimeout,
+                        std::chrono::steady_clock::duration networkOperationTimeout) {
+    struct Run {
+        TraversalState state;
+        std::vector<CollectionWork> pending;
+        std::atomic<bool> done{ false };
+    };
+    const auto CHECK_INTERVAL = std::chrono::milliseconds(10);
+    std::vector<CollectionWork> pending{ CollectionWork{ root, 0, exclusions.stateFor(root) } };
+    bool allExited = true;
+    while (!pending.empty()) {
+        auto run = std::make_shared<Run>();
+        run->pending = std::move(pending);
+        pending.clear();
+        // uɂĂȂ悤AXbh run Ǝ̒̂QƂ
+        std::thread collector([run, maxDepth, &manager, &stats, &exclusions, otherRoots,
+                               operationTimeout, networkOperationTimeout]() {
+            collectTargetsFrom(run->state, run->pending, maxDepth, manager, stats, exclusions, otherRoots,
+                               operationTimeout, networkOperationTimeout);
+            run->done = true;
+        });
+        for (;;) {
+            std::this_thread::sleep_for(CHECK_INTERVAL);
+            if (run->done) {
+                collector.join();
+                break;
+            }
+            std::int64_t started = run->state.operationStart.load(std::memory_order_relaxed);
+            auto limit = std::chrono::duration_cast<std::chrono::nanoseconds>(run->state.timeout).count();
+            if (started == 0 || steadyNowNs() - started <= limit) {
+                continue;
+            }
+            fs::path hung;
+            {
+                std::lock_guard<std::mutex> lock(run->state.mutex);
+                run->state.abandoned = true;
+                pending = std::move(run->pending);
+                hung = run->state.currentDir;
+            }
+            stats.recordError(ErrorCategory::Timeout, hung);
+            collector.detach();
+            allExited = false;
+            break;
+        }
+    }
+    return allExited;
+}
+
+// 郋[gBd[g͏Aq̃[g͊ȎO
+struct ScanRoot {
+    fs::path path;
+    FileIdentity identity;
+    std::uint64_t device = 0;
+    int targetDepth = 0;               // WvPʂƂKwi[g[j
+    std::vector<FileIdentity> others;  // ̃[gi͂֍~Ȃj
+};
+
+std::vector<ScanRoot> resolveRoots(const std::vector<fs::path>& paths, int minTargetDepth) {
+    std::vector<ScanRoot> roots;
+    for (const auto& path : paths) {
+        ScanRoot root;
+        root.path = path;
+        if (!fileIdentityOf(path, root.identity)) {
+            std::cerr << "Skipping root " << path.string() << ": cannot access\n";
+            continue;
+        }
+        auto same = std::find_if(roots.begin(), roots.end(),
+                                 [&root](const ScanRoot& r) { return r.identity == root.identity; });
+        if (same != roots.end()) {
+            std::cerr << "Skipping root " << path.string() << ": same directory as "
+                << same->path.string() << "\n";
+            continue;
+        }
+        root.device = deviceIdOf(path);
+        fs::path relative = path.relative_path();
+        int depth = static_cast<int>(std::distance(relative.begin(), relative.end()));
+        root.targetDepth = std::max(minTargetDepth, depth + 1);
+        roots.push_back(root);
+    }
+    for (auto& root : roots) {
+        for (const auto& other : roots) {
+            if (!(other.identity == root.identity)) {
+                root.others.push_back(other.identity);
+            }
+        }
+    }
+    return roots;
+}
+
+// [ĝ{[̎gpʂ̍vifoCX1񂾂j
+VolumeUsage combinedVolumeUsage(const std::vector<ScanRoot>& roots) {
+    VolumeUsage total;
+    std::vector<std::uint64_t> seen;
+    for (const auto& root : roots) {
+        if (std::find(seen.begin(), seen.end(), root.device) != seen.end()) {
+            continue;
+        }
+        seen.push_back(root.device);
+        VolumeUsage usage = queryVolumeUsage(root.path);
+        if (!usage.valid) {
+            return VolumeUsage();
+        }
+        total.usedBytes += usage.usedBytes;
+        total.usedInodes += usage.usedInodes;
+        total.totalBytes += usage.totalBytes;
+        total.valid = true;
+    }
+    return total;
+}
+
+// vZX̍ő풓i擾łȂ 0j
+std::uint64_t peakResidentBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters{};
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#elif defined(__linux__)
+    struct rusage usage{};
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        return static_cast<std::uint64_t>(usage.ru_maxrss) * 1024;  // KB P
+    }
+    return 0;
+#else
+    return 0;
+#endif
+}
+
+// Xst@C̒uꏊBXibvVbgۑȂ炻ׁ̗AȂΈꎞfBNg
+fs::path spillFilePath(const ScanOptions& options) {
+    if (!options.savePath.empty()) {
+        return fs::path(options.savePath.native() + fs::path(".spill").native());
+    }
+    std::error_code ec;
+    fs::path directory = fs::temp_directory_path(ec);
+    if (ec) {
+        directory = fs::current_path(ec);
+    }
+#ifdef _WIN32
+    unsigned long pid = GetCurrentProcessId();
+#elif defined(__linux__)
+    long pid = static_cast<long>(getpid());
+#else
+    long pid = 0;
+#endif
+    return directory / ("diskwiz-" + std::to_string(pid) + ".spill");
+}
+
+// vZX̓̂ߓIȑ傫ȃy[WɍڂĂʁiLinux ȊO擾łȂ 0j
+std::uint64_t anonymousHugePageBytes() {
+#ifdef __linux__
+    std::ifstream smaps("/proc/self/smaps_rollup");
+    std::string line;
+    while (std::getline(smaps, line)) {
+        if (line.compare(0, 14, "AnonHugePages:") == 0) {
+            return std::strtoull(line.c_str() + 14, nullptr, 10) * 1024;
+        }
+    }
+#endif
+    return 0;
+}
+
+// J[\p̊֐ǉ
+void moveCursorToTop() {
+    std::cout << "\033[H"; // J[\ʂ̐擪Ɉړ
+}
+
+void clearToEndOfLine() {
+    std::cout << "\033[K"; // J[\s܂ŃNA
+}
+
+// ʕ\֐C
+void displayResults(const ResultManager& manager, size_t limit,
+                    const ScanStats& stats, const DiskStatsMonitor& monitor,
+                    const ProgressTracker& progress) {
+    moveCursorToTop();
+
+    // i\igpʂɑ΂oCgEinode ̊Ǝc莞ԁj
+    if (progress.hasReference()) {
+        std::cout << "Progress: " << std::fixed << std::setprecision(1)
+            << progress.bytesFraction() * 100 << "% of used bytes ("
+            << std::setprecision(2) << toGB(progress.countedBytes()) << "/"
+            << toGB(progress.referenceBytes()) << " GB)";
+        if (progress.inodesFraction() > 0) {
+            std::cout << ", " << std::setprecision(1) << progress.inodesFraction() * 100
+                << "% of used inodes";
+        }
+        double eta = progress.etaSeconds();
+        if (eta >= 0) {
+            std::cout << ", ETA " << formatDuration(eta);
+        }
+        std::cout << "\n";
+        clearToEndOfLine();
+    }
+
+    size_t completed = manager.completedTargets();
+    size_t total = manager.totalTargets();
+    std::cout << "Targets: " << completed << "/" << total;
+    if (manager.isRankingFinal()) {
+        std::cout << " [ranking final]";
+    }
+    if (manager.prunedTargets() > 0) {
+        std::cout << " [" << manager.prunedTargets() << " targets cut off by usage bound]";
+    }
+    std::cout << "\n";
+    clearToEndOfLine();
+
+    // X[vbgƃfoCXgp̕\
+    std::cout << "Throughput: " << std::fixed << std::setprecision(0)
+        << stats.entriesPerSecond() << " entries/s";
+    double utilization = 0, busyRatio = 0;
+    if (monitor.summary(utilization, busyRatio)) {
+        std::cout << ", device busy: " << utilization * 100 << "% (avg "
+            << busyRatio * 100 << "%)";
+    }
+    std::cout << "\n\n";
+    clearToEndOfLine();
+
+    // LO\
+    std::cout << "=== Top " << limit << " Largest Files/Folders ===\n";
+    clearToEndOfLine();
+
+    for (size_t i = 0; i < limit; ++i) {
+        auto results = manager.getTopN(limit);
+        if (i < results.size()) {
+            const auto& info = results[i];
+            if (info.calculated && info.isEstimated) {
+                // l95%Mԕtŕ\
+                std::cout << (i + 1) << ". " << info.path.string()
+                    << " : ~" << std::fixed << std::setprecision(2)
+                    << toGB(static_cast<std::uintmax_t>(info.estimate)) << " GB"
+                    << " +/- " << toGB(static_cast<std::uintmax_t>(info.margin)) << " GB (";
+                if (info.size > 0) {
+                    std::cout << "scanned " << toGB(info.size) << " GB, ";
+                }
+                std::cout << info.elapsed.count() / 1000.0 << " sec)";
+            } else if (info.calculated) {
+                std::cout << (i + 1) << ". " << info.path.string()
+                    << " : " << std::fixed << std::setprecision(2)
+                    << toGB(info.size) << " GB"
+                    << (info.isPartial ? "+" : "") << " (";
+                if (info.staleBytes > 0) {
+                    std::cout << "incl. " << toGB(info.staleBytes) << " GB stale, ";
+                }
+                std::cout << info.elapsed.count() / 1000.0 << " sec)";
+            } else {
+                std::cout << (i + 1) << ". " << info.path.string()
+                    << " : calculating... (" << std::fixed << std::setprecision(2)
+                    << toGB(info.size) << " GB so far)";
+            }
+        }
+        std::cout << "\n";
+        clearToEndOfLine();
+    }
+}
+
+// R}hC̉
+bool parseOptions(int argc, char* argv[], ScanOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto hasValue = [&]() { return i + 1 < argc; };
+        if (arg == "--root" && hasValue()) {
+            if (!options.rootsGiven) {
+                options.roots.clear();
+                options.rootsGiven = true;
+            }
+            options.roots.push_back(fs::path(argv[++i]));
+        } else if (arg == "--polite") {
+            options.polite = true;
+        } else if (arg == "--polite-ops" && hasValue()) {
+            options.politeOpsPerSec = std::max(1.0, std::stod(argv[++i]));
+        } else if (arg == "--busy-threshold" && hasValue()) {
+            options.busyThreshold = std::stod(argv[++i]) / 100.0;
+        } else if (arg == "--workers" && hasValue()) {
+            options.workers = std::stoul(argv[++i]);
+        } else if (arg == "--time-budget" && hasValue()) {
+            options.timeBudget = std::max(0.0, std::stod(argv[++i]));
+        } else if (arg == "--estimate" && hasValue()) {
+            options.estimateOnly = std::max(0.0, std::stod(argv[++i]));
+        } else if (arg == "--order" && hasValue()) {
+            std::string order = argv[++i];
+            if (order != "largest" && order != "collection") {
+                return false;
+            }
+            options.largestFirst = order == "largest";
+        } else if (arg == "--early-exit") {
+            options.earlyExit = true;
+        } else if ((arg == "--op-timeout" || arg == "--net-op-timeout") && hasValue()) {
+            auto timeout = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(std::max(0.1, std::stod(argv[++i]))));
+            (arg == "--op-timeout" ? options.operationTimeout : options.networkOperationTimeout) = timeout;
+        } else if (arg == "--exclude" && hasValue()) {
+            options.excludeRules.push_back(argv[++i]);
+        } else if (arg == "--exclude-from" && hasValue()) {
+            options.excludeFiles.push_back(fs::path(argv[++i]));
+        } else if (arg == "--hotspots" && hasValue()) {
+            std::string value = argv[++i];
+            if (!value.empty() && value.back() == '%') {
+                options.hotspotFraction = std::stod(value.substr(0, value.size() - 1)) / 100.0;
+                if (options.hotspotFraction <= 0 || options.hotspotFraction > 1) {
+                    return false;
+                }
+            } else {
+                double gb = std::stod(value);  //  G / GB ͖
+                if (gb <= 0) {
+                    return false;
+                }
+                options.hotspotBytes = static_cast<std::uintmax_t>(gb * 1024.0 * 1024.0 * 1024.0);
+            }
+        } else if (arg == "--save" && hasValue()) {
+            options.savePath = fs::path(argv[++i]);
+        } else if (arg == "--open" && hasValue()) {
+            options.openPath = fs::path(argv[++i]);
+        } else if (arg == "--diff" && i + 2 < argc) {
+            options.diffOld = fs::path(argv[++i]);
+            options.diffNew = fs::path(argv[++i]);
+        } else if (arg == "--merge" && i + 2 < argc) {
+            options.mergePath = fs::path(argv[++i]);
+            while (i + 1 < argc && std::string(argv[i + 1]).compare(0, 2, "--") != 0) {
+                options.mergeInputs.push_back(argv[++i]);
+            }
+        } else if (arg == "--since" && hasValue()) {
+            options.sincePath = fs::path(argv[++i]);
+        } else if (arg == "--trust-unchanged") {
+            options.trustUnchanged = true;
+        } else if (arg == "--approximate" && hasValue()) {
+            options.approximatePercent = std::stod(argv[++i]);
+            if (options.approximatePercent <= 0 || options.approximatePercent > 100) {
+                return false;
+            }
+        } else if (arg == "--huge-pages" && hasValue()) {
+            std::string mode = argv[++i];
+            if (mode != "off" && mode != "transparent" && mode != "explicit") {
+                return false;
+            }
+            options.hugePages = mode == "off" ? HugePageMode::Off :
+                mode == "explicit" ? HugePageMode::Explicit : HugePageMode::Transparent;
+            options.hugePageReport = true;
+        } else if (arg == "--freeze") {
+            options.freeze = true;
+        } else if (arg == "--memory-budget" && hasValue()) {
+            options.memoryBudget = static_cast<std::int64_t>(std::max(1.0, std::stod(argv[++i])) * 1024.0 * 1024.0);
+        } else if (arg == "--checkpoint" && hasValue()) {
+            options.checkpointPath = fs::path(argv[++i]);
+        } else if (arg == "--history" && hasValue()) {
+            options.historyPath = fs::path(argv[++i]);
+        } else if (arg == "--history-min-gb" && hasValue()) {
+            options.historyMinBytes = static_cast<std::uintmax_t>(
+                std::max(0.0, std::stod(argv[++i])) * 1024.0 * 1024.0 * 1024.0);
+        } else if (arg == "--trend" && hasValue()) {
+            options.trendPath = fs::path(argv[++i]);
+        } else if (arg == "--forecast" && hasValue()) {
+            options.forecastPercent = std::stod(argv[++i]);
+            if (options.forecastPercent <= 0 || options.forecastPercent > 100) {
+                return false;
+            }
+        } else if (arg == "--days" && hasValue()) {
+            options.trendDays = std::max(1.0, std::stod(argv[++i]));
+        } else if (arg == "--checkpoint-interval" && hasValue()) {
+            options.checkpointInterval = std::max(1.0, std::stod(argv[++i]));
+        } else if (arg == "--max-gb" && hasValue()) {
+            options.maxBytes = static_cast<std::uintmax_t>(
+                std::max(0.0, std::stod(argv[++i])) * 1024.0 * 1024.0 * 1024.0);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+void printUsage() {
+    std::cout << "Usage: DiskWiz [options]\n"
+        << "  --root <path>            directory to scan; repeat to scan several roots as one ranking\n"
+        << "                           (default: C:\\ on Windows, / elsewhere)\n"
+        << "  --polite                 low-impact mode (idle I/O class, rate limit, backoff)\n"
+        << "  --polite-ops <n>         metadata operations per second per device (default 2000)\n"
+        << "  --busy-threshold <pct>   back off above this device utilization (default 50)\n"
+        << "  --workers <n>            worker threads (default: from affinity and cgroup limits)\n"
+        << "  --time-budget <sec>      stop scanning after this time and estimate the rest\n"
+        << "  --estimate <sec>         estimate sizes with random probes only, for this long\n"
+        << "  --order <largest|collection>  target scheduling order (default largest)\n"
+        << "  --early-exit             stop once the top-N ranking is provably final\n"
+        << "                           (stays on the root filesystem)\n"
+        << "  --max-gb <gb>            stop once this much data has been counted\n"
+        << "  --op-timeout <sec>       give up on a directory whose metadata call hangs (default 30)\n"
+        << "  --net-op-timeout <sec>   same, for network filesystems (default 5)\n"
+        << "  --exclude <rule>         skip matching paths at any depth (repeatable)\n"
+        << "                           e.g. /var/cache, node_modules, **/build/tmp, *.iso size>1G age>30d\n"
+        << "  --exclude-from <file>    read exclusion rules from a file, one per line\n"
+        << "  --hotspots <pct%|gb>     list the fewest directories each holding at least this much\n"
+        << "  --save <file>            write the scanned tree to a snapshot file\n"
+        << "  --open <file>            show a saved snapshot instead of scanning\n"
+        << "  --freeze                 after the scan (or with --open), pack the tree into a read-only\n"
+        << "                           succinct form and compare its size and query time with the original\n"
+        << "  --huge-pages <mode>      pages for the tree arrays: transparent (default), explicit\n"
+        << "                           (reserved huge pages, falling back) or off; reports rollup and\n"
+        << "                           query time and dTLB misses so runs can be compared\n"
+        << "  --diff <old> <new>       show what grew between two snapshots\n"
+        << "  --merge <out> <in>...    combine snapshots into one (no scan); write an input as\n"
+        << "                           label=file to place it under a top-level directory 'label'\n"
+        << "  --since <file>           rescan incrementally: directories whose mtime/ctime match the\n"
+        << "                           snapshot are not re-read, only their known files re-stat'ed\n"
+        << "  --trust-unchanged        with --since, also trust the snapshot's file sizes\n"
+        << "  --approximate <pct>      with --since, do not descend into unchanged directories that held\n"
+        << "                           less than pct% of the snapshot; count their old totals as stale\n"
+        << "  --memory-budget <mb>     keep the scanned tree within this much memory: spill completed\n"
+        << "                           subtrees to a temporary file, then drop per-file detail\n"
+        << "  --checkpoint <file>      save progress periodically and resume from it on the next run\n"
+        << "  --checkpoint-interval <sec>  seconds between checkpoints (default 60)\n"
+        << "  --history <file>         append directory sizes to a history after each scan\n"
+        << "  --history-min-gb <gb>    only record directories at least this large (default 1)\n"
+        << "  --trend <path>           with --history, show the growth of a directory (no scan)\n"
+        << "  --forecast <pct>         with --history, project when the volume reaches pct% (no scan)\n"
+        << "  --days <n>               period for --trend and --forecast (default 30)\n";
+}
+
+// ߎ̓Əʂ̌덷̏B~Ȃ؂́AO񂩂kł΍ő
+// ̍vߑɂȂB̒g͕Ȃ̂ŁA̕؂k񂾕܂őĂ
+// Ƃ蓾BŁugp - ǂ񂾃t@C̊蓖āvA~Ȃ؂
+// ׂĊ܂ގc̏ƂB^[Qbg̐^̒ĺAǂ񂾕ɂ̎c𑫂l𒴂Ȃ
+// iapplyUsageBound ƓA~Ȃ؂ɃXp[Xt@CȂꍇj
+void printApproximation(const ResultManager& manager, const ScanStats& stats, const Snapshot& previous,
+                        std::uintmax_t pruneBelow, const VolumeUsage& usage, size_t limit) {
+    std::uint64_t skippedNodes = stats.prunedNodes.load();
+    std::uintmax_t stale = stats.staleBytes.load();
+    std::uintmax_t counted = manager.countedBytes();
+    std::cout << "Approximate: " << stats.prunedSubtrees.load() << " subtrees under " << std::setprecision(3)
+        << toGB(pruneBelow) << " GB not descended (" << std::setprecision(1)
+        << (previous.size() > 1 ? 100.0 * static_cast<double>(skippedNodes) / static_cast<double>(previous.size() - 1) : 0.0)
+        << "% of the snapshot's entries, " << std::setprecision(2) << toGB(stale) << " GB = "
+        << std::setprecision(2)
+        << (counted > 0 ? 100.0 * static_cast<double>(stale) / static_cast<double>(counted) : 0.0)
+        << "% of the total counted as stale)\n";
+    if (stale == 0) {
+        return;
+    }
+
+    auto results = manager.getTopN(manager.totalTargets());
+    bool bounded = usage.valid;
+    std::uintmax_t allocated = manager.allocatedCountedBytes();
+    std::uintmax_t residual = usage.valid && usage.usedBytes > allocated ? usage.usedBytes - allocated : 0;
+    std::uintmax_t maxStale = 0;
+    std::uintmax_t maxLow = 0;
+    for (size_t i = 0; i < std::min(limit, results.size()); ++i) {
+        maxStale = std::max(maxStale, results[i].staleBytes);
+        if (results[i].staleBytes > 0 || results[i].isPartial) {
+            maxLow = std::max(maxLow, residual - std::min(residual, results[i].staleBytes));
+        }
+    }
+    std::cout << "Error bound: listed sizes may be high by at most their stale part (up to "
+        << std::setprecision(2) << toGB(maxStale) << " GB)";
+    if (bounded) {
+        std::cout << " and low by at most " << toGB(maxLow) << " GB (volume usage not held by files read in"
+            << " this scan, less the stale part)";
+    } else {
+        std::cout << "; volume usage is unavailable, so growth since the snapshot is unbounded";
+    }
+    std::cout << "\n";
+
+    //  i m肷̂́Aȍ~ׂ̂Ă̏ȏ̂Ƃ
+    std::uintmax_t unknown = std::numeric_limits<std::uintmax_t>::max();
+    std::vector<std::uintmax_t> upperAfter(results.size() + 1, 0);
+    for (size_t i = results.size(); i-- > 0;) {
+        const auto& info = results[i];
+        std::uintmax_t upper = info.staleBytes == 0 && !info.isPartial ? info.size
+            : bounded ? info.size - info.staleBytes + residual : unknown;
+        upperAfter[i] = std::max(upperAfter[i + 1], upper);
+    }
+    size_t certain = 0;
+    size_t top = std::min(limit, results.size());
+    while (certain < top &&
+           results[certain].size - results[certain].staleBytes >= upperAfter[certain + 1]) {
+        certain++;
+    }
+    std::cout << "Ranking: " << (certain == top ? "all " : "") << certain << " of the top " << top
+        << " positions are guaranteed despite the stale subtrees\n";
+}
+
+// zbgX|bg: lȏ߂ŏ̃fBNg
+void printHotspots(const std::vector<Hotspot>& hotspots, const ScanOptions& options,
+                   std::uintmax_t total, std::uintmax_t explained, size_t directories, bool interrupted) {
+    std::cout << "\nHotspots (each at least ";
+    if (options.hotspotBytes > 0) {
+        std::cout << std::setprecision(2) << toGB(options.hotspotBytes) << " GB";
+    } else {
+        std::cout << std::setprecision(1) << options.hotspotFraction * 100 << "%";
+    }
+    std::cout << " of " << std::setprecision(2) << toGB(total) << " GB in " << directories
+        << " directories" << (interrupted ? ", completed targets only" : "") << "):\n";
+    for (size_t i = 0; i < hotspots.size(); ++i) {
+        const auto& spot = hotspots[i];
+        std::cout << std::setw(3) << i + 1 << ". " << spot.path.string()
+            << (spot.remainder ? " (excluding listed subdirectories)" : "") << " : "
+            << std::setprecision(2) << toGB(spot.bytes) << " GB (" << std::setprecision(1)
+            << (total > 0 ? 100.0 * static_cast<double>(spot.bytes) / static_cast<double>(total) : 0.0)
+            << "%)\n";
+    }
+    std::cout << "These " << hotspots.size() << " directories explain " << std::setprecision(1)
+        << (total > 0 ? 100.0 * static_cast<double>(explained) / static_cast<double>(total) : 0.0)
+        << "% of usage\n";
+}
+
+// l̑傫 limit ێiŏq[vj
+template <typename Entry>
+class TopEntries {
+private:
+    size_t limit;
+    std::vector<Entry> heap;
+
+    static bool greater(const Entry& a, const Entry& b) {
+        return a.key > b.key;
+    }
+
+public:
+    explicit TopEntries(size_t n) : limit(n) {}
+
+    // ̏ʂɓl
+    bool admits(decltype(Entry::key) key) const {
+        return heap.size() < limit || (limit > 0 && key > heap.front().key);
+    }
+
+    void offer(const Entry& entry) {
+        if (heap.size() < limit) {
+            heap.push_back(entry);
+            std::push_heap(heap.begin(), heap.end(), greater);
+        } else if (limit > 0 && greater(entry, heap.front())) {
+            std::pop_heap(heap.begin(), heap.end(), greater);
+            heap.back() = entry;
+            std::push_heap(heap.begin(), heap.end(), greater);
+        }
+    }
+
+    std::vector<Entry> sorted() const {
+        std::vector<Entry> result = heap;
+        std::sort(result.begin(), result.end(), greater);
+        return result;
+    }
+};
+
+// 傫 limit ̃fBNgiv, m[hjBv͑c傫ȂȂ̂ŁA
+// ʂɓȂfBNg̉ɂ͍~Ȃ
+template <typename Tree>
+std::vector<std::pair<std::uintmax_t, std::uint32_t>> largestDirectories(const Tree& tree, size_t limit) {
+    struct Entry {
+        std::uintmax_t key;
+        std::uint32_t node;
+    };
+    TopEntries<Entry> top(limit);
+    std::vector<std::uint32_t> stack{ 0 };
+    while (!stack.empty()) {
+        std::uint32_t node = stack.back();
+        stack.pop_back();
+        tree.forEachChild(node, [&](std::uint32_t child) {
+            if (tree.isDirectory(child) && top.admits(tree.totalBytes(child))) {
+                top.offer(Entry{ tree.totalBytes(child), child });
+                stack.push_back(child);
+            }
+        });
+    }
+    std::vector<std::pair<std::uintmax_t, std::uint32_t>> result;
+    for (const auto& entry : top.sorted()) {
+        result.emplace_back(entry.key, entry.node);
+    }
+    return result;
+}
+
+// ֐JԂA1񂠂̃~bԂiȂƂ 3 Av 50 ms xj
+template <typename Function>
+double measureMilliseconds(Function&& function) {
+    auto start = std::chrono::steady_clock::now();
+    int runs = 0;
+    std::chrono::duration<double, std::milli> elapsed(0);
+    do {
+        function();
+        ++runs;
+        elapsed = std::chrono::steady_clock::now() - start;
+    } while ((runs < 3 || elapsed.count() < 50) && runs < 1000);
+    return elapsed.count() / runs;
+}
+
+// ؂̑傫ƁA̖؁iXibvVbg̖؁jƂ̖₢킹Ԃׂĕ\
+template <typename Tree>
+void printFreezeReport(const FrozenTree& frozen, double buildMilliseconds, const Tree& original,
+                       const char* originalName, std::uint64_t originalBytes, size_t limit) {
+    const double MB = 1024.0 * 1024.0;
+    double nodes = std::max<double>(1, frozen.size());
+    std::cout << "\nFrozen tree: " << frozen.size() - 1 << " nodes in " << std::fixed << std::setprecision(2)
+        << static_cast<double>(frozen.memoryBytes()) / MB << " MB (" << std::setprecision(1)
+        << static_cast<double>(frozen.memoryBytes()) * 8 / nodes << " bits/node: topology "
+        << static_cast<double>(frozen.topologyBytes()) * 8 / nodes << ", sizes "
+        << static_cast<double>(frozen.sizeBytes()) * 8 / nodes << ", names "
+        << static_cast<double>(frozen.nameBytes()) * 8 / nodes << ", flags "
+        << static_cast<double>(frozen.flagBytes()) * 8 / nodes << "), built in " << std::setprecision(1)
+        << buildMilliseconds << " ms\n";
+    std::cout << "The " << originalName << " takes " << std::setprecision(2)
+        << static_cast<double>(originalBytes) / MB << " MB (" << std::setprecision(1)
+        << static_cast<double>(originalBytes) / std::max<double>(1, static_cast<double>(frozen.memoryBytes()))
+        << "x the frozen tree)\n";
+
+    // ₢킹𗼕ɓAԂƌʂׂ
+    auto walk = [](const auto& tree) {
+        std::uint64_t visited = 0;
+        std::vector<std::uint32_t> stack{ 0 };
+        while (!stack.empty()) {
+            std::uint32_t node = stack.back();
+            stack.pop_back();
+            tree.forEachChild(node, [&](std::uint32_t child) {
+                ++visited;
+                stack.push_back(child);
+            });
+        }
+        return visited;
+    };
+    auto paths = [limit](const auto& tree, const std::vector<std::pair<std::uintmax_t, std::uint32_t>>& top) {
+        std::vector<fs::path> result;
+        for (size_t i = 0; i < top.size() && i < limit; ++i) {
+            result.push_back(tree.pathOf(top[i].second));
+        }
+        return result;
+    };
+    auto hotspotSizes = [](const auto& tree) {
+        std::uintmax_t total = 0, explained = 0;
+        std::vector<std::uintmax_t> result;
+        for (const auto& hotspot : findHotspots(tree, 0.01, 0, total, explained)) {
+            result.push_back(hotspot.bytes);
+        }
+        return result;
+    };
+    auto frozenTop = largestDirectories(frozen, limit);
+    auto originalTop = largestDirectories(original, limit);
+    bool same = walk(frozen) == walk(original) && hotspotSizes(frozen) == hotspotSizes(original) &&
+        frozenTop.size() == originalTop.size();
+    for (size_t i = 0; same && i < frozenTop.size(); ++i) {
+        same = frozenTop[i].first == originalTop[i].first &&
+            frozen.pathOf(frozenTop[i].second) == original.pathOf(originalTop[i].second);
+    }
+
+    volatile std::uint64_t sink = 0;  // ₢킹œKŏȂ悤Ɍʂc
+    struct Query {
+        std::string label;
+        double frozen;
+        double original;
+    };
+    std::vector<Query> queries;
+    queries.push_back(Query{ "walk all nodes (children)",
+                             measureMilliseconds([&] { sink = sink + walk(frozen); }),
+                             measureMilliseconds([&] { sink = sink + walk(original); }) });
+    queries.push_back(Query{ "top " + std::to_string(limit) + " directories",
+                             measureMilliseconds([&] { sink = sink + largestDirectories(frozen, limit).size(); }),
+                             measureMilliseconds([&] { sink = sink + largestDirectories(original, limit).size(); }) });
+    queries.push_back(Query{ "paths of the top " + std::to_string(limit) + " (parent, name)",
+                             measureMilliseconds([&] { sink = sink + paths(frozen, frozenTop).size(); }),
+                             measureMilliseconds([&] { sink = sink + paths(original, originalTop).size(); }) });
+    queries.push_back(Query{ "hotspots >= 1%",
+                             measureMilliseconds([&] { sink = sink + hotspotSizes(frozen).size(); }),
+                             measureMilliseconds([&] { sink = sink + hotspotSizes(original).size(); }) });
+    std::cout << std::left << std::setw(40) << "Query" << std::right << std::setw(12) << "frozen"
+        << std::setw(16) << originalName << "\n";
+    for (const auto& query : queries) {
+        std::cout << "  " << std::left << std::setw(38) << query.label << std::right << std::setprecision(3)
+            << std::setw(9) << query.frozen << " ms" << std::setw(13) << query.original << " ms\n";
+    }
+    std::cout << (same ? "Query results are identical" : "Warning: query results differ") << "\n";
+}
+
+// ۑXibvVbgJAʂƓ`ŕ\
+int showSnapshot(const ScanOptions& options, size_t limit) {
+    auto openStart = std::chrono::steady_clock::now();
+    Snapshot snapshot;
+    std::string error;
+    if (!snapshot.open(options.openPath, error)) {
+        std::cerr << "Cannot open snapshot: " << error << "\n";
+        return 1;
+    }
+    auto openTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - openStart);
+
+    // --freeze ł͓؂\AŌɃXibvVbgƔׂ
+    FrozenTree frozen;
+    double freezeTime = 0;
+    if (options.freeze) {
+        auto freezeStart = std::chrono::steady_clock::now();
+        if (!frozen.build(snapshot)) {
+            std::cerr << "Cannot freeze snapshot: too many nodes\n";
+            return 1;
+        }
+        freezeTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - freezeStart).count();
+    }
+    ResultManager manager;
+    if (options.freeze) {
+        frozen.forEachTarget([&](std::uint32_t node) {
+            manager.addCompletedTarget(frozen.pathOf(node), frozen.totalBytes(node),
+                                       (frozen.flags(node) & SNAPSHOT_PARTIAL) != 0);
+        });
+    } else {
+        snapshot.forEachTarget([&](std::uint32_t index) {
+            const SnapshotNode& node = snapshot.node(index);
+            manager.addCompletedTarget(snapshot.pathOf(index), node.size, (node.flags & SNAPSHOT_PARTIAL) != 0);
+        });
+    }
+
+    ScanStats stats;
+    DiskStatsMonitor monitor;
+    displayResults(manager, limit, stats, monitor, ProgressTracker(VolumeUsage()));
+    std::time_t created = static_cast<std::time_t>(snapshot.header().createdAt / 1000000000LL);
+    std::cout << "\nSnapshot " << options.openPath.string() << " taken "
+        << std::put_time(std::localtime(&created), "%Y-%m-%d %H:%M:%S") << ": "
+        << snapshot.size() - 1 << " nodes, " << manager.totalTargets() << " targets, opened in "
+        << std::fixed << std::setprecision(1) << openTime.count() << " ms\n";
+
+    if (options.hotspotFraction > 0 || options.hotspotBytes > 0) {
+        std::uintmax_t total = 0, explained = 0;
+        auto hotspots = options.freeze ?
+            frozen.hotspots(options.hotspotFraction, options.hotspotBytes, total, explained) :
+            snapshot.hotspots(options.hotspotFraction, options.hotspotBytes, total, explained);
+        printHotspots(hotspots, options, total, explained,
+                      static_cast<size_t>(snapshot.header().directoryCount), false);
+    }
+    if (options.freeze) {
+        printFreezeReport(frozen, freezeTime, snapshot, "snapshot", snapshot.mappedBytes(), limit);
+    }
+    return 0;
+}
+
+// 2̃XibvVbg̍Bm[h͓YŎApX͕\镪gݗĂ
+struct SnapshotDiff {
+    struct Entry {
+        double key = 0;
+        std::uint32_t node = 0;  // inOld ȂÂAłȂΐV̓Y
+        bool inOld = false;
+        std::uintmax_t oldSize = 0;
+        std::uintmax_t newSize = 0;
+    };
+
+    TopEntries<Entry> growth;    // ؂̑
+    TopEntries<Entry> relative;  // ؂̑
+    TopEntries<Entry> newFiles;
+    TopEntries<Entry> deletedFiles;
+    TopEntries<Entry> changedFiles;  // TCY̕ωʁiΒlj
+    std::uint64_t newFileCount = 0, deletedFileCount = 0, changedFileCount = 0;
+    std::uintmax_t newFileBytes = 0, deletedFileBytes = 0;
+    std::int64_t changedFileDelta = 0;
+    std::uint64_t newDirectoryCount = 0, deletedDirectoryCount = 0;
+
+    explicit SnapshotDiff(size_t limit)
+        : growth(limit), relative(limit), newFiles(limit), deletedFiles(limit), changedFiles(limit) {}
+};
+
+// ̏ʂɓŏ̑ʁiȃfBNg̐{̕ωŖ܂Ȃ悤Ɂj
+const std::uintmax_t MIN_RELATIVE_GROWTH_BYTES = 1024 * 1024;
+
+// ЕɂȂ؂̃t@CVK܂͍폜ƂĐ
+void addSubtreeOnlyIn(const Snapshot& snapshot, std::uint32_t index, bool inOld, SnapshotDiff& diff) {
+    for (std::uint32_t i = index, end = snapshot.subtreeEnd(index); i < end; ++i) {
+        const SnapshotNode& node = snapshot.node(i);
+        if (node.flags & SNAPSHOT_DIRECTORY) {
+            (inOld ? diff.deletedDirectoryCount : diff.newDirectoryCount)++;
+            continue;
+        }
+        SnapshotDiff::Entry entry;
+        entry.key = static_cast<double>(node.size);
+        entry.node = i;
+        entry.inOld = inOld;
+        (inOld ? entry.oldSize : entry.newSize) = node.size;
+        if (inOld) {
+            diff.deletedFileCount++;
+            diff.deletedFileBytes += node.size;
+            diff.deletedFiles.offer(entry);
+        } else {
+            diff.newFileCount++;
+            diff.newFileBytes += node.size;
+            diff.newFiles.offer(entry);
+        }
+    }
+}
+
+// ̖؂瓯ɒHAZ𖼑OɃ}[Wiem[h1񂸂̂Ő`ԁj
+void diffSnapshots(const Snapshot& before, const Snapshot& after, SnapshotDiff& diff) {
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> stack{ { 0, 0 } };
+    while (!stack.empty()) {
+        std::uint32_t oldDir = stack.back().first;
+        std::uint32_t newDir = stack.back().second;
+        stack.pop_back();
+        std::int64_t dirGrowth = static_cast<std::int64_t>(after.node(newDir).size) -
+            static_cast<std::int64_t>(before.node(oldDir).size);
+        bool explainedByChild = false;  // ׂ1̃TufBNgɂ
+
+        // ߎœǂ܂Ȃ͒gȂ̂ŁAvׂ
+        std::uint32_t dirFlags = before.node(oldDir).flags | after.node(newDir).flags;
+        bool totalsOnly = (dirFlags & SNAPSHOT_STALE) != 0;
+        // Е̒̃t@CvȂAЕɂȂt@C͐VKE폜Ƃ݂ȂȂ
+        bool filesComparable = (dirFlags & SNAPSHOT_AGGREGATED) == 0;
+        std::uint32_t a = totalsOnly ? 0 : before.firstChild(oldDir);
+        std::uint32_t b = totalsOnly ? 0 : after.firstChild(newDir);
+        while (a != 0 || b != 0) {
+            int order = a == 0 ? 1 : b == 0 ? -1 : before.nameView(a).compare(after.nameView(b));
+            if (order < 0) {
+                if (filesComparable || before.isDirectory(a)) {
+                    addSubtreeOnlyIn(before, a, true, diff);
+                }
+                a = before.nextSibling(oldDir, a);
+                continue;
+            }
+            if (order > 0) {
+                if (filesComparable || after.isDirectory(b)) {
+                    addSubtreeOnlyIn(after, b, false, diff);
+                }
+                b = after.nextSibling(newDir, b);
+                continue;
+            }
+            const SnapshotNode& oldNode = before.node(a);
+            const SnapshotNode& newNode = after.node(b);
+            bool oldIsDirectory = (oldNode.flags & SNAPSHOT_DIRECTORY) != 0;
+            bool newIsDirectory = (newNode.flags & SNAPSHOT_DIRECTORY) != 0;
+            if (oldIsDirectory != newIsDirectory) {
+                // ނς͍̂폜ƐVKƂĈ
+                addSubtreeOnlyIn(before, a, true, diff);
+                addSubtreeOnlyIn(after, b, false, diff);
+            } else if (oldIsDirectory) {
+                std::int64_t childGrowth = static_cast<std::int64_t>(newNode.size) -
+                    static_cast<std::int64_t>(oldNode.size);
+                explainedByChild |= childGrowth == dirGrowth;
+                stack.emplace_back(a, b);
+            } else if (oldNode.size != newNode.size) {
+                std::int64_t delta = static_cast<std::int64_t>(newNode.size) -
+                    static_cast<std::int64_t>(oldNode.size);
+                diff.changedFileCount++;
+                diff.changedFileDelta += delta;
+                diff.changedFiles.offer(SnapshotDiff::Entry{ std::fabs(static_cast<double>(delta)), b, false,
+                                                             oldNode.size, newNode.size });
+            }
+            a = before.nextSibling(oldDir, a);
+            b = after.nextSibling(newDir, b);
+        }
+
+        // ̂܂܎qɓn̑ćAʂłłȂił[cB
+        // q̑̕傫̂ŁȀʂqɂȂj
+        if (newDir == 0 || dirGrowth <= 0 || explainedByChild) {
+            continue;
+        }
+        SnapshotDiff::Entry entry{ static_cast<double>(dirGrowth), newDir, false,
+                                   before.node(oldDir).size, after.node(newDir).size };
+        diff.growth.offer(entry);
+        if (entry.oldSize > 0 && static_cast<std::uintmax_t>(dirGrowth) >= MIN_RELATIVE_GROWTH_BYTES) {
+            entry.key = static_cast<double>(dirGrowth) / static_cast<double>(entry.oldSize);
+            diff.relative.offer(entry);
+        }
+    }
+}
+
+std::string formatSignedGB(std::int64_t bytes) {
+    std::ostringstream out;
+    out << (bytes < 0 ? "-" : "+") << std::fixed << std::setprecision(2)
+        << toGB(static_cast<std::uintmax_t>(bytes < 0 ? -bytes : bytes)) << " GB";
+    return out.str();
+}
+
+// 2̃XibvVbgׁA\
+int showSnapshotDiff(const ScanOptions& options, size_t limit) {
+    auto start = std::chrono::steady_clock::now();
+    Snapshot before, after;
+    std::string error;
+    if (!before.open(options.diffOld, error) || !after.open(options.diffNew, error)) {
+        std::cerr << "Cannot open snapshot: " << error << "\n";
+        return 1;
+    }
+    SnapshotDiff diff(limit);
+    diffSnapshots(before, after, diff);
+    auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+
+    auto takenAt = [](const Snapshot& snapshot) {
+        std::time_t created = static_cast<std::time_t>(snapshot.header().createdAt / 1000000000LL);
+        std::ostringstream out;
+        out << std::put_time(std::localtime(&created), "%Y-%m-%d %H:%M:%S");
+        return out.str();
+    };
+    std::uintmax_t oldTotal = before.node(0).size;
+    std::uintmax_t newTotal = after.node(0).size;
+    std::cout << "Diff " << options.diffOld.string() << " (" << takenAt(before) << ") -> "
+        << options.diffNew.string() << " (" << takenAt(after) << "): "
+        << formatSignedGB(static_cast<std::int64_t>(newTotal) - static_cast<std::int64_t>(oldTotal))
+        << " (" << std::fixed << std::setprecision(2) << toGB(oldTotal) << " -> " << toGB(newTotal) << " GB)\n";
+    std::cout << "Files: " << diff.newFileCount << " new (" << formatSignedGB(static_cast<std::int64_t>(diff.newFileBytes))
+        << "), " << diff.deletedFileCount << " deleted ("
+        << formatSignedGB(-static_cast<std::int64_t>(diff.deletedFileBytes)) << "), "
+        << diff.changedFileCount << " changed size (" << formatSignedGB(diff.changedFileDelta) << ")\n";
+    std::cout << "Directories: " << diff.newDirectoryCount << " new, " << diff.deletedDirectoryCount << " deleted\n";
+
+    auto pathOf = [&](const SnapshotDiff::Entry& entry) {
+        return (entry.inOld ? before : after).pathOf(entry.node).string();
+    };
+    auto printDirectories = [&](const char* title, const TopEntries<SnapshotDiff::Entry>& list) {
+        auto entries = list.sorted();
+        if (entries.empty()) {
+            return;
+        }
+        std::cout << "\n=== " << title << " ===\n";
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const auto& entry = entries[i];
+            std::int64_t delta = static_cast<std::int64_t>(entry.newSize) - static_cast<std::int64_t>(entry.oldSize);
+            std::cout << (i + 1) << ". " << pathOf(entry) << " : " << formatSignedGB(delta) << " ("
+                << std::setprecision(2) << toGB(entry.oldSize) << " -> " << toGB(entry.newSize) << " GB";
+            if (entry.oldSize > 0) {
+                std::cout << ", +" << std::setprecision(1)
+                    << 100.0 * static_cast<double>(delta) / static_cast<double>(entry.oldSize) << "%";
+            }
+            std::cout << ")\n";
+        }
+    };
+    auto printFiles = [&](const char* title, const TopEntries<SnapshotDiff::Entry>& list) {
+        auto entries = list.sorted();
+        if (entries.empty()) {
+            return;
+        }
+        std::cout << "\n=== " << title << " ===\n";
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const auto& entry = entries[i];
+            std::cout << (i + 1) << ". " << pathOf(entry) << " : ";
+            if (entry.oldSize > 0 && entry.newSize > 0) {
+                std::cout << formatSignedGB(static_cast<std::int64_t>(entry.newSize) -
+                                            static_cast<std::int64_t>(entry.oldSize)) << " ("
+                    << std::setprecision(2) << toGB(entry.oldSize) << " -> " << toGB(entry.newSize) << " GB)\n";
+            } else {
+                std::cout << std::setprecision(2) << toGB(entry.inOld ? entry.oldSize : entry.newSize) << " GB\n";
+            }
+        }
+    };
+    printDirectories("Top Growing Directories", diff.growth);
+    printDirectories("Top Directories by Relative Growth", diff.relative);
+    printFiles("Largest New Files", diff.newFiles);
+    printFiles("Largest Deleted Files", diff.deletedFiles);
+    printFiles("Largest Size Changes", diff.changedFiles);
+    std::cout << "\nCompared " << before.size() - 1 << " and " << after.size() - 1 << " nodes in "
+        << std::setprecision(1) << elapsed.count() << " ms\n";
+    return 0;
+}
+
+// ̃XibvVbg1̖؂ɂ܂Ƃ߂i--mergejB͂͂ǂOŌZ킪OȂ̂ŁA
+// pX̎q k {̐ς݂̗ƂĕłB̊KwiijŕA
+// m[h taskNodes ȉɂȂ؂̕т̓[J[ɕĈꎞt@C֏oB
+// ŌɍiƊe^XN̏o͂OɘAAYtւBv̓^XNƍiłꂼꋁߒB
+// t@C̓͂ɂ΍łVXibvVbg̒l1񂾂
+class SnapshotMerger {
+public:
+    struct Statistics {
+        std::uint64_t nodes = 0;
+        std::uint64_t overlapping = 0;  // ̓͂ɂm[h
+        size_t skeletonNodes = 0;
+        size_t tasks = 0;
+        size_t largestTask = 0;         // ^XÑm[h̍ői̖ڈj
+        size_t threads = 0;
+    };
+
+private:
+    static const std::uint32_t LABEL_NODE = std::numeric_limits<std::uint32_t>::max();
+
+    struct Input {
+        fs::path path;
+        std::string label;  // łȂ΁A̖ÕfBNg̉ɒuizXgƂȂǁj
+        std::unique_ptr<Snapshot> snapshot;
+    };
+
+    // m[h̏oǂBindex  LABEL_NODE Ȃ烉x̃fBNgig͓͂̉zm[hj
+    struct Match {
+        std::uint32_t input;
+        std::uint32_t index;
+    };
+    using Matches = std::vector<Match>;
+
+    struct Merged {
+        std::uint64_t ownBytes = 0;  // qɊ܂܂Ȃ
+        std::int64_t mtime = 0;
+        std::int64_t ctime = 0;
+        std::uint32_t flags = 0;
+        Matches kept;                // q𕹍錳
+        bool overlapping = false;
+    };
+
+    struct Item {
+        bool isTask;
+        size_t index;
+    };
+
+    struct SkeletonNode {
+        std::string name;
+        Merged merged;
+        bool underTarget = false;    // c悪^[Qbgiq̃^[Qbg͓dɐȂ悤Oj
+        std::vector<Item> items;     // qiĩm[h^XNj
+        std::uint64_t count = 1;     // ؂̃m[h
+        std::uint64_t total = 0;
+    };
+
+    struct Task {
+        std::vector<std::pair<std::string, Matches>> roots;  // e̘AZ
+        bool underTarget = false;
+        std::uint64_t estimate = 0;
+        fs::path part;
+        std::uint64_t nodeCount = 0;
+        std::uint64_t stringsSize = 0;
+        std::uint64_t total = 0;
+        std::uint64_t directories = 0;
+        std::uint64_t overlapping = 0;
+        std::vector<std::uint32_t> targets;  // ^XN̓Y
+        bool failed = false;
+    };
+
+    std::vector<Input> inputs;
+    std::vector<SkeletonNode> skeleton;
+    std::vector<Task> tasks;
+
+    const Snapshot& snapshotOf(const Match& match) const {
+        return *inputs[match.input].snapshot;
+    }
+
+    std::uint32_t indexOf(const Match& match) const {
+        return match.index == LABEL_NODE ? 0 : match.index;
+    }
+
+    std::string_view nameOf(const Match& match) const {
+        return match.index == LABEL_NODE ? std::string_view(inputs[match.input].label)
+                                         : snapshotOf(match).nameView(match.index);
+    }
+
+    std::uint32_t flagsOf(const Match& match) const {
+        return match.index == LABEL_NODE ? SNAPSHOT_DIRECTORY : snapshotOf(match).node(match.index).flags;
+    }
+
+    // qɊ܂܂Ȃit@CȂTCYAǂ܂ȂfBNgȂO̍vj
+    std::uint64_t ownBytesOf(const Match& match) const {
+        const Snapshot& snapshot = snapshotOf(match);
+        std::uint32_t index = indexOf(match);
+        std::uint64_t own = snapshot.node(index).size;
+        snapshot.forEachChild(index, [&](std::uint32_t child) {
+            own -= std::min(own, snapshot.node(child).size);
+        });
+        return own;
+    }
+
+    // ̕؂̃m[ȟςidȂ肪Α߂ɂȂj
+    std::uint64_t estimateOf(const Matches& matches) const {
+        std::uint64_t count = 0;
+        for (const auto& match : matches) {
+            std::uint32_t index = indexOf(match);
+            count += snapshotOf(match).subtreeEnd(index) - index + (match.index == LABEL_NODE ? 1 : 0);
+        }
+        return count;
+    }
+
+    // fBNg̒g̏ڂ: 2 t@C܂łA1 ̃t@C͍v̂݁iAGGREGATEDjA
+    // 0 gȂiSTALEj
+    static int detailOf(std::uint32_t flags) {
+        return (flags & SNAPSHOT_STALE) != 0 ? 0 : (flags & SNAPSHOT_AGGREGATED) != 0 ? 1 : 2;
+    }
+
+    // ނƎ͍łVXibvVbgɍ킹BfBNg͍łڂ̂𕹍
+    // iv̂̂ƍƓt@Cdɐj
+    Merged resolve(const Matches& matches, bool underTarget) const {
+        Merged merged;
+        auto createdAt = [this](const Match& match) {
+            return inputs[match.input].snapshot->header().createdAt;
+        };
+        const Match* newest = &matches[0];
+        for (const auto& match : matches) {
+            if (createdAt(match) > createdAt(*newest)) {
+                newest = &match;
+            }
+        }
+        bool directory = (flagsOf(*newest) & SNAPSHOT_DIRECTORY) != 0;
+        int detail = 0;
+        for (const auto& match : matches) {
+            std::uint32_t flags = flagsOf(match);
+            if ((flags & SNAPSHOT_DIRECTORY) != 0) {
+                detail = std::max(detail, detailOf(flags));
+            }
+        }
+        const Match* timeSource = nullptr;
+        for (const auto& match : matches) {
+            std::uint32_t flags = flagsOf(match);
+            if (((flags & SNAPSHOT_DIRECTORY) != 0) != directory || (!directory && &match != newest) ||
+                (directory && detailOf(flags) != detail)) {
+                continue;
+            }
+            merged.kept.push_back(match);
+            merged.flags |= flags & (SNAPSHOT_TARGET | SNAPSHOT_PARTIAL);
+            merged.ownBytes = std::max(merged.ownBytes, ownBytesOf(match));
+            if (!timeSource || createdAt(match) > createdAt(*timeSource)) {
+                timeSource = &match;
+            }
+        }
+        if (timeSource->index != LABEL_NODE) {
+            const SnapshotNode& node = snapshotOf(*timeSource).node(timeSource->index);
+            merged.mtime = node.mtime;
+            merged.ctime = node.ctime;
+        }
+        if (directory) {
+            merged.flags |= SNAPSHOT_DIRECTORY | (detail == 0 ? SNAPSHOT_STALE : 0) |
+                (detail == 1 ? SNAPSHOT_AGGREGATED : 0);
+        } else {
+            merged.kept.clear();
+        }
+        if (underTarget) {
+            merged.flags &= ~SNAPSHOT_TARGET;
+        }
+        merged.overlapping = matches.size() > 1;
+        return merged;
+    }
+
+    // e̊eoǂ̎q𖼑OɕAOƂ function(name, matches) ĂԁB
+    // zm[hiwithLabelsjɂ̓xt̓͂̃xqƂĕ
+    template <typename Function>
+    void forEachMergedChild(const Matches& parents, bool withLabels, Function&& function) const {
+        struct Cursor {
+            std::uint32_t input;
+            std::uint32_t parent;
+            std::uint32_t current;
+            std::string_view name;
+        };
+        auto later = [](const Cursor& a, const Cursor& b) { return a.name > b.name; };
+        std::vector<Cursor> heap;
+        for (const auto& match : parents) {
+            std::uint32_t parent = indexOf(match);
+            std::uint32_t child = snapshotOf(match).firstChild(parent);
+            if (child != 0) {
+                heap.push_back(Cursor{ match.input, parent, child, snapshotOf(match).nameView(child) });
+            }
+        }
+        if (withLabels) {
+            for (std::uint32_t i = 0; i < inputs.size(); ++i) {
+                if (!inputs[i].label.empty()) {
+                    heap.push_back(Cursor{ i, LABEL_NODE, LABEL_NODE, inputs[i].label });
+                }
+            }
+        }
+        std::make_heap(heap.begin(), heap.end(), later);
+        Matches matches;
+        while (!heap.empty()) {
+            std::string_view name = heap.front().name;
+            matches.clear();
+            while (!heap.empty() && heap.front().name == name) {
+                std::pop_heap(heap.begin(), heap.end(), later);
+                Cursor cursor = heap.back();
+                heap.pop_back();
+                matches.push_back(Match{ cursor.input, cursor.current });
+                // ͂̎̌Z͖O傫̂ŁA܂Ƃ߂Ďoɖ߂
+                if (cursor.parent != LABEL_NODE) {
+                    const Snapshot& snapshot = *inputs[cursor.input].snapshot;
+                    std::uint32_t next = snapshot.nextSibling(cursor.parent, cursor.current);
+                    if (next != 0) {
+                        cursor.current = next;
+                        cursor.name = snapshot.nameView(next);
+                        heap.push_back(cursor);
+                        std::push_heap(heap.begin(), heap.end(), later);
+                    }
+                }
+            }
+            function(std::string(name), matches);
+        }
+    }
+
+    // iBς肪 taskNodes 𒴂fBNg͍iɎcAȊO
+    // Z킲Ƃɂ܂Ƃ߂ă^XNɂ
+    void buildSkeleton(const Matches& roots, std::uint64_t taskNodes, const fs::path& output) {
+        skeleton.clear();
+        tasks.clear();
+        skeleton.emplace_back();
+        if (!roots.empty()) {
+            skeleton[0].merged = resolve(roots, false);
+        }
+        skeleton[0].merged.flags |= SNAPSHOT_DIRECTORY;
+        skeleton[0].merged.flags &= ~SNAPSHOT_STALE;
+        std::vector<size_t> stack{ 0 };
+        while (!stack.empty()) {
+            size_t parent = stack.back();
+            stack.pop_back();
+            Matches kept = skeleton[parent].merged.kept;
+            bool underTarget = skeleton[parent].underTarget ||
+                (skeleton[parent].merged.flags & SNAPSHOT_TARGET) != 0;
+            size_t openTask = std::numeric_limits<size_t>::max();
+            forEachMergedChild(kept, parent == 0, [&](const std::string& name, const Matches& matches) {
+                std::uint64_t estimate = estimateOf(matches);
+                if (estimate > taskNodes) {
+                    Merged merged = resolve(matches, underTarget);
+                    if ((merged.flags & SNAPSHOT_DIRECTORY) != 0 && !merged.kept.empty()) {
+                        SkeletonNode node;
+                        node.name = name;
+                        node.merged = std::move(merged);
+                        node.underTarget = underTarget;
+                        skeleton.push_back(std::move(node));
+                        skeleton[parent].items.push_back(Item{ false, skeleton.size() - 1 });
+                        stack.push_back(skeleton.size() - 1);
+                        openTask = std::numeric_limits<size_t>::max();
+                        return;
+                    }
+                }
+                if (openTask == std::numeric_limits<size_t>::max() ||
+                    tasks[openTask].estimate + estimate > taskNodes) {
+                    tasks.emplace_back();
+                    openTask = tasks.size() - 1;
+                    tasks[openTask].underTarget = underTarget;
+                    tasks[openTask].part = output;
+                    tasks[openTask].part += ".part" + std::to_string(openTask) + ".tmp";
+                    skeleton[parent].items.push_back(Item{ true, openTask });
+                }
+                tasks[openTask].roots.emplace_back(name, matches);
+                tasks[openTask].estimate += estimate;
+            });
+        }
+    }
+
+    // ^XN̕؂OɏoB擪̌Z̐e͘AɌ܂̂ LABEL_NODE ɂĂ
+    std::uint64_t emit(Task& task, std::vector<SnapshotNode>& records, std::string& strings,
+                       const std::string& name, const Matches& matches, bool underTarget,
+                       std::uint32_t parent) const {
+        Merged merged = resolve(matches, underTarget);
+        std::uint32_t index = static_cast<std::uint32_t>(records.size());
+        SnapshotNode record = {};
+        record.mtime = merged.mtime;
+        record.ctime = merged.ctime;
+        record.parent = parent;
+        record.nameOffset = strings.size();
+        record.nameLength = static_cast<std::uint32_t>(name.size());
+        record.flags = merged.flags;
+        records.push_back(record);
+        strings += name;
+        task.overlapping += merged.overlapping ? 1 : 0;
+        if ((merged.flags & SNAPSHOT_TARGET) != 0) {
+            task.targets.push_back(index);
+        }
+        std::uint64_t total = merged.ownBytes;
+        if ((merged.flags & SNAPSHOT_DIRECTORY) != 0) {
+            task.directories++;
+            bool childUnderTarget = underTarget || (merged.flags & SNAPSHOT_TARGET) != 0;
+            forEachMergedChild(merged.kept, false, [&](const std::string& childName, const Matches& childMatches) {
+                total += emit(task, records, strings, childName, childMatches, childUnderTarget, index);
+            });
+        }
+        records[index].size = total;
+        records[index].end = static_cast<std::uint32_t>(records.size());
+        return total;
+    }
+
+    void runTask(Task& task) const {
+        std::vector<SnapshotNode> records;
+        std::string strings;
+        for (const auto& root : task.roots) {
+            task.total += emit(task, records, strings, root.first, root.second, task.underTarget, LABEL_NODE);
+        }
+        task.nodeCount = records.size();
+        task.stringsSize = strings.size();
+        std::ofstream out(task.part, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(records.data()),
+                  static_cast<std::streamsize>(records.size() * sizeof(SnapshotNode)));
+        out.write(strings.data(), static_cast<std::streamsize>(strings.size()));
+        out.close();
+        task.failed = !out;
+    }
+
+    // iOɏoB^XN̏o͓͂YƖÖʒu炵Ďʂ
+    bool writeNodes(std::ofstream& out, size_t node, std::uint32_t parent, std::uint64_t& position,
+                    std::uint64_t& nameOffset, std::vector<std::uint32_t>& targets) const {
+        const SkeletonNode& source = skeleton[node];
+        std::uint32_t self = static_cast<std::uint32_t>(position);
+        SnapshotNode record = {};
+        record.size = source.total;
+        record.mtime = source.merged.mtime;
+        record.ctime = source.merged.ctime;
+        record.parent = parent;
+        record.end = static_cast<std::uint32_t>(position + source.count);
+        record.nameOffset = nameOffset;
+        record.nameLength = static_cast<std::uint32_t>(source.name.size());
+        record.flags = source.merged.flags;
+        out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+        if ((record.flags & SNAPSHOT_TARGET) != 0) {
+            targets.push_back(self);
+        }
+        position++;
+        nameOffset += source.name.size();
+        for (const auto& item : source.items) {
+            if (!item.isTask) {
+                if (!writeNodes(out, item.index, self, position, nameOffset, targets)) {
+                    return false;
+                }
+                continue;
+            }
+            const Task& task = tasks[item.index];
+            std::ifstream in(task.part, std::ios::binary);
+            std::uint32_t base = static_cast<std::uint32_t>(position);
+            const size_t CHUNK = 4096;
+            std::vector<SnapshotNode> chunk(CHUNK);
+            for (std::uint64_t done = 0; done < task.nodeCount;) {
+                size_t count = static_cast<size_t>(std::min<std::uint64_t>(CHUNK, task.nodeCount - done));
+                in.read(reinterpret_cast<char*>(chunk.data()), static_cast<std::streamsize>(count * sizeof(SnapshotNode)));
+                if (!in) {
+                    return false;
+                }
+                for (size_t i = 0; i < count; ++i) {
+                    SnapshotNode& n = chunk[i];
+                    n.parent = n.parent == LABEL_NODE ? self : n.parent + base;
+                    n.end += base;
+                    n.nameOffset += nameOffset;
+                }
+                out.write(reinterpret_cast<const char*>(chunk.data()), static_cast<std::streamsize>(count * sizeof(SnapshotNode)));
+                done += count;
+            }
+            for (std::uint32_t target : task.targets) {
+                targets.push_back(base + target);
+            }
+            position += task.nodeCount;
+            nameOffset += task.stringsSize;
+        }
+        return true;
+    }
+
+    // O̕\ writeNodes Ɠɏo
+    bool writeStrings(std::ofstream& out, size_t node) const {
+        const SkeletonNode& source = skeleton[node];
+        out.write(source.name.data(), static_cast<std::streamsize>(source.name.size()));
+        for (const auto& item : source.items) {
+            if (!item.isTask) {
+                if (!writeStrings(out, item.index)) {
+                    return false;
+                }
+                continue;
+            }
+            const Task& task = tasks[item.index];
+            std::ifstream in(task.part, std::ios::binary);
+            in.seekg(static_cast<std::streamoff>(task.nodeCount * sizeof(SnapshotNode)));
+            std::vector<char> buffer(64 * 1024);
+            for (std::uint64_t done = 0; done < task.stringsSize;) {
+                size_t count = static_cast<size_t>(std::min<std::uint64_t>(buffer.size(), task.stringsSize - done));
+                in.read(buffer.data(), static_cast<std::streamsize>(count));
+                if (!in) {
+                    return false;
+                }
+                out.write(buffer.data(), static_cast<std::streamsize>(count));
+                done += count;
+            }
+        }
+        return true;
+    }
+
+    void removeParts() const {
+        for (const auto& task : tasks) {
+            std::error_code ec;
+            fs::remove(task.part, ec);
+        }
+    }
+
+public:
+    // ͂ "file"  "label=file"
+    bool addInput(const std::string& spec, std::string& error) {
+        Input input;
+        size_t equals = spec.find('=');
+        if (equals != std::string::npos && equals > 0 && spec.find_first_of("/\\") > equals) {
+            input.label = spec.substr(0, equals);
+            input.path = fs::u8path(spec.substr(equals + 1));
+        } else {
+            input.path = fs::u8path(spec);
+        }
+        input.snapshot = std::make_unique<Snapshot>();
+        if (!input.snapshot->open(input.path, error)) {
+            error = input.path.string() + ": " + error;
+            return false;
+        }
+        inputs.push_back(std::move(input));
+        return true;
+    }
+
+    size_t inputCount() const {
+        return inputs.size();
+    }
+
+    bool merge(const fs::path& path, size_t threads, Statistics& statistics, std::string& error) {
+        Matches roots;
+        std::uint64_t estimate = 0;
+        std::int64_t createdAt = 0;
+        // ̐ݒ肪ĂƂpi݂Ă΋L^ȂƂj
+        std::uint64_t scanFingerprint = inputs.empty() ? 0 : inputs[0].snapshot->scanFingerprint();
+        for (std::uint32_t i = 0; i < inputs.size(); ++i) {
+            estimate += inputs[i].snapshot->size();
+            createdAt = std::max(createdAt, inputs[i].snapshot->header().createdAt);
+            if (inputs[i].snapshot->scanFingerprint() != scanFingerprint) {
+                scanFingerprint = 0;
+            }
+            if (inputs[i].label.empty()) {
+                roots.push_back(Match{ i, 0 });
+            }
+        }
+        // ^XN̓Xbh̐{ɕA1̃}
+        const std::uint64_t MIN_TASK_NODES = 4096;
+        const std::uint64_t MAX_TASK_NODES = 256 * 1024;
+        std::uint64_t taskNodes = std::clamp<std::uint64_t>(estimate / (threads * 4 + 1), MIN_TASK_NODES, MAX_TASK_NODES);
+        buildSkeleton(roots, taskNodes, path);
+
+        std::atomic<size_t> next{ 0 };
+        std::vector<std::thread> workers;
+        for (size_t w = 0; w < std::min(threads, tasks.size()); ++w) {
+            workers.emplace_back([this, &next]() {
+                for (size_t i = next++; i < tasks.size(); i = next++) {
+                    try {
+                        runTask(tasks[i]);
+                    } catch (...) {
+                        tasks[i].failed = true;
+                    }
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        statistics = Statistics();
+        statistics.skeletonNodes = skeleton.size();
+        statistics.tasks = tasks.size();
+        statistics.threads = workers.size();
+        std::uint64_t directories = 0;
+        for (const auto& task : tasks) {
+            if (task.failed) {
+                removeParts();
+                error = "cannot write " + task.part.string();
+                return false;
+            }
+            statistics.largestTask = std::max<size_t>(statistics.largestTask, task.nodeCount);
+            statistics.overlapping += task.overlapping;
+            directories += task.directories;
+        }
+
+        // i̍vƃm[h͎q̕Y傫̂ŋtɋ܂
+        for (size_t i = skeleton.size(); i-- > 0;) {
+            SkeletonNode& node = skeleton[i];
+            node.total = node.merged.ownBytes;
+            node.count = 1;
+            for (const auto& item : node.items) {
+                node.total += item.isTask ? tasks[item.index].total : skeleton[item.index].total;
+                node.count += item.isTask ? tasks[item.index].nodeCount : skeleton[item.index].count;
+            }
+            statistics.overlapping += node.merged.overlapping ? 1 : 0;
+        }
+        directories += skeleton.size() - 1;
+        statistics.nodes = skeleton[0].count;
+        if (statistics.nodes > std::numeric_limits<std::uint32_t>::max()) {
+            removeParts();
+            error = "too many nodes";
+            return false;
+        }
+
+        fs::path temp = path;
+        temp += ".tmp";
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            removeParts();
+            error = "cannot create " + temp.string();
+            return false;
+        }
+        SnapshotHeader header = {};
+        std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.version = SNAPSHOT_VERSION;
+        header.byteOrder = SNAPSHOT_BYTE_ORDER;
+        header.headerSize = sizeof(SnapshotHeader);
+        header.nodeCount = statistics.nodes;
+        header.nodesOffset = sizeof(SnapshotHeader);
+        header.directoryCount = directories;
+        header.createdAt = createdAt;
+        header.scanFingerprint = scanFingerprint;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        std::uint64_t position = 0;
+        std::vector<std::uint32_t> targets;
+        bool written = writeNodes(out, 0, 0, position, header.stringsSize, targets);
+        header.targetCount = targets.size();
+        header.targetsOffset = header.nodesOffset + header.nodeCount * sizeof(SnapshotNode);
+        out.write(reinterpret_cast<const char*>(targets.data()),
+                  static_cast<std::streamsize>(targets.size() * sizeof(std::uint32_t)));
+        static const char zeros[8] = {};
+        std::uint64_t targetBytes = targets.size() * sizeof(std::uint32_t);
+        out.write(zeros, static_cast<std::streamsize>((8 - targetBytes % 8) % 8));
+        header.stringsOffset = header.targetsOffset + (targetBytes + 7) / 8 * 8;
+        written = written && writeStrings(out, 0);
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.close();
+        removeParts();
+        std::error_code ec;
+        if (!written || !out) {
+            fs::remove(temp, ec);
+            error = "write failed: " + temp.string();
+            return false;
+        }
+        fs::rename(temp, path, ec);
+        if (ec) {
+            fs::remove(temp, ec);
+            error = "cannot replace " + path.string();
+            return false;
+        }
+        return true;
+    }
+};
+
+// XibvVbgĕۑAʂ̃LO\
+int mergeSnapshots(const ScanOptions& options, size_t limit) {
+    auto start = std::chrono::steady_clock::now();
+    SnapshotMerger merger;
+    for (const auto& spec : options.mergeInputs) {
+        std::string error;
+        if (!merger.addInput(spec, error)) {
+            std::cerr << "Cannot open snapshot " << error << "\n";
+            return 1;
+        }
+    }
+    size_t threads = options.workers > 0 ? options.workers : detectWorkerBudget(0).cpuWorkers;
+    SnapshotMerger::Statistics statistics;
+    std::string error;
+    if (!merger.merge(options.mergePath, threads, statistics, error)) {
+        std::cerr << "Cannot merge snapshots: " << error << "\n";
+        return 1;
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+    std::cout << "Merged " << merger.inputCount() << " snapshots into " << options.mergePath.string() << " ("
+        << statistics.nodes - 1 << " nodes, " << statistics.overlapping << " present in more than one input) in "
+        << std::fixed << std::setprecision(2) << elapsed.count() << " sec\n"
+        << "  " << statistics.tasks << " subtree tasks on " << statistics.threads << " threads, skeleton "
+        << statistics.skeletonNodes << " nodes, largest task " << statistics.largestTask << " nodes\n\n";
+    ScanOptions merged = options;
+    merged.openPath = options.mergePath;
+    return showSnapshot(merged, limit);
+}
+
+// AfBNg̑ƃ{[̎gpwlɒB߂
+int showHistory(const ScanOptions& options) {
+    auto loadStart = std::chrono::steady_clock::now();
+    SizeHistory history;
+    std::string error;
+    if (!history.load(options.historyPath, error)) {
+        std::cerr << error << "\n";
+        return 1;
+    }
+    if (history.scanCount() == 0) {
+        std::cerr << "History " << options.historyPath.string() << " has no scans\n";
+        return 1;
+    }
+    auto loadTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart);
+    auto formatDate = [](std::int64_t time) {
+        std::time_t t = static_cast<std::time_t>(time);
+        std::ostringstream out;
+        out << std::put_time(std::localtime(&t), "%Y-%m-%d");
+        return out.str();
+    };
+    std::cout << "History " << options.historyPath.string() << ": " << history.scanCount() << " scans from "
+        << formatDate(history.firstScanTime()) << " to " << formatDate(history.lastScanTime()) << ", "
+        << history.seriesCount() << " directories, " << std::fixed << std::setprecision(1)
+        << static_cast<double>(history.fileBytes()) / 1024.0 << " KB (loaded in "
+        << loadTime.count() << " ms)\n";
+
+    auto queryStart = std::chrono::steady_clock::now();
+    std::ostringstream report;
+    report << std::fixed;
+    SizeHistory::Trend trend;
+    if (!options.trendPath.empty()) {
+        std::error_code ec;
+        fs::path target = fs::absolute(options.trendPath, ec).lexically_normal();
+        if (!target.has_filename() && target != target.root_path()) {
+            target = target.parent_path();  // ̋؂蕶
+        }
+        report << target.string() << ": ";
+        if (history.directoryTrend(toUtf8(target.native()), options.trendDays, trend)) {
+            report << formatSignedGB(trend.last - trend.first) << " over the last " << std::setprecision(0)
+                << options.trendDays << " days (" << formatDate(trend.from) << " -> " << formatDate(trend.to)
+                << ", " << trend.samples << " scans), trend "
+                << formatSignedGB(static_cast<std::int64_t>(trend.bytesPerDay)) << "/day\n";
+        } else {
+            report << "not enough history (needs 2 scans in the period where it was recorded)\n";
+        }
+    }
+    if (options.forecastPercent > 0) {
+        double capacity = static_cast<double>(history.capacity());
+        double limit = options.forecastPercent / 100.0 * capacity;
+        report << "Volume: ";
+        if (!history.volumeTrend(options.trendDays, trend) || capacity <= 0) {
+            report << "not enough history (needs 2 scans in the period)\n";
+        } else {
+            report << std::setprecision(1) << 100.0 * static_cast<double>(trend.last) / capacity << "% used, trend "
+                << formatSignedGB(static_cast<std::int64_t>(trend.bytesPerDay)) << "/day; ";
+            if (trend.intercept >= limit) {
+                report << "already at " << options.forecastPercent << "%\n";
+            } else if (trend.bytesPerDay <= 0) {
+                report << "not growing, no date for " << options.forecastPercent << "%\n";
+            } else {
+                double days = (limit - trend.intercept) / trend.bytesPerDay;
+                report << "projected to reach " << options.forecastPercent << "% on "
+                    << formatDate(trend.to + static_cast<std::int64_t>(days * 86400.0)) << " (in "
+                    << std::setprecision(0) << days << " days)\n";
+            }
+        }
+    }
+    auto queryTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - queryStart);
+    std::cout << report.str() << "Query time: " << std::setprecision(3) << queryTime.count() << " ms\n";
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    ScanOptions options;
+    try {
+        if (!parseOptions(argc, argv, options)) {
+            printUsage();
+            return 1;
+        }
+    } catch (...) {
+        printUsage();
+        return 1;
+    }
+
+#ifdef _WIN32
+    HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD dwMode = 0;
+    GetConsoleMode(hOut, &dwMode);
+    dwMode |= ENABLE_VIRTUAL_TERMINAL_PROCESSING;
+    SetConsoleMode(hOut, dwMode);
+#endif
+    HugePageArena::setMode(options.hugePages);
+
+    // Ctrl+C ł͓rʂo͂ĂI
+    std::signal(SIGINT, handleInterruptSignal);
+    std::signal(SIGTERM, handleInterruptSignal);
+#ifdef _WIN32
+    SetConsoleCtrlHandler(handleConsoleControl, TRUE);
+#endif
+
+    std::cout.setf(std::ios::unitbuf);
+    const int MAX_DEPTH = 4;
+    const size_t DISPLAY_LIMIT = 16;
+    if (!options.openPath.empty()) {
+        return showSnapshot(options, DISPLAY_LIMIT);
+    }
+    if (!options.diffOld.empty()) {
+        return showSnapshotDiff(options, DISPLAY_LIMIT);
+    }
+    if (!options.mergePath.empty()) {
+        return mergeSnapshots(options, DISPLAY_LIMIT);
+    }
+    if (!options.historyPath.empty() && (!options.trendPath.empty() || options.forecastPercent > 0)) {
+        return showHistory(options);
+    }
+    const int DISPLAY_FPS = 2;
+    const auto DISPLAY_INTERVAL = std::chrono::milliseconds(1000 / DISPLAY_FPS);
+
+    ResultManager manager;
+    ScanStats stats;
+    DiskStatsMonitor monitor;
+    std::unique_ptr<IoThrottle> throttle;
+    if (options.polite) {
+        throttle = std::make_unique<IoThrottle>(options.politeOpsPerSec);
+    }
+
+    // O[̃RpCiWindows ł̓VXëŏOj
+    ExclusionSet exclusions;
+#ifdef _WIN32
+    for (const auto& excluded : EXCLUDED_PATHS) {
+        std::string rule = fs::path(excluded).string();
+        if (!exclusions.addRule(rule)) {
+            std::cerr << "Invalid built-in exclusion rule: " << rule << "\n";
+            return 1;
+        }
+    }
+#endif
+    for (const auto& rule : options.excludeRules) {
+        if (!exclusions.addRule(rule)) {
+            std::cerr << "Invalid exclusion rule: " << rule << "\n";
+            return 1;
+        }
+    }
+    for (const auto& file : options.excludeFiles) {
+        std::string error;
+        if (!exclusions.loadFile(file, error)) {
+            std::cerr << "Invalid exclusion file: " << error << "\n";
+            return 1;
+        }
+    }
+
+    // `FbN|CgĊJ^[Qbgɂ͖؂Ȃ̂ŁA؂go͂Ƃ͕płȂ
+    if (!options.checkpointPath.empty() && (!options.savePath.empty() || !options.historyPath.empty() ||
+                                             options.hotspotFraction > 0 || options.hotspotBytes > 0)) {
+        std::cerr << "--checkpoint cannot be combined with --save, --history or --hotspots\n";
+        return 1;
+    }
+
+    // ꗗ̒gEݒiO[ --early-exit ̃foCXj̃nbVB
+    // XibvVbgɋL^AႤݒŎ͍̂̊ɂȂ
+    std::uint64_t scanFingerprint = 14695981039346656037ULL;  // FNV-1a
+    {
+        std::string settings = exclusions.text();
+        if (options.earlyExit) {
+            settings += "early-exit\n";
+        }
+        for (unsigned char c : settings) {
+            scanFingerprint = (scanFingerprint ^ c) * 1099511628211ULL;
+        }
+        if (scanFingerprint == 0) {
+            scanFingerprint = 1;  // 0 ͋L^Ȃ\
+        }
+    }
+
+    // ̊i[J[QƂ̂ő̏I܂ŕێj
+    std::unique_ptr<Snapshot> previous;
+    std::uintmax_t pruneBelow = 0;
+    if (options.approximatePercent > 0 && options.sincePath.empty()) {
+        std::cerr << "--approximate requires --since\n";
+        return 1;
+    }
+    if (!options.sincePath.empty()) {
+        previous = std::make_unique<Snapshot>();
+        std::string error;
+        if (!previous->open(options.sincePath, error)) {
+            std::cerr << "Cannot open snapshot: " << error << "\n";
+            return 1;
+        }
+        if (previous->scanFingerprint() != scanFingerprint) {
+            std::cout << "Snapshot " << options.sincePath.string()
+                << " was taken with different exclusion rules or --early-exit; rescanning everything\n";
+            previous.reset();
+        }
+    }
+    if (previous) {
+        // l͑ȎŜ̍vɑ΂銄
+        pruneBelow = static_cast<std::uintmax_t>(
+            static_cast<double>(previous->totalBytes(0)) * options.approximatePercent / 100.0);
+    }
+
+    // Phase 1: WvΏۂ̎Wi[gƂɍsA1̃LOɂ܂Ƃ߂j
+    std::cout << "Collecting target paths...\n";
+    std::vector<ScanRoot> roots = resolveRoots(options.roots, MAX_DEPTH);
+    if (roots.empty()) {
+        std::cerr << "No root to scan\n";
+        return 1;
+    }
+    std::vector<size_t> rootOfTarget;  // ^[Qbg id  roots ̓Y
+    bool collectorsExited = true;      // ȂWXbhuɂ false
+    for (size_t r = 0; r < roots.size(); ++r) {
+        const ScanRoot& root = roots[r];
+        collectorsExited &= collectTargetPaths(root.path, root.targetDepth, manager, stats, exclusions,
+                                               root.others.empty() ? nullptr : &root.others,
+                                               options.operationTimeout, options.networkOperationTimeout);
+        rootOfTarget.resize(manager.totalTargets(), r);
+    }
+    auto otherRootsOf = [&roots, &rootOfTarget](size_t id) {
+        const ScanRoot& root = roots[rootOfTarget[id]];
+        return root.others.empty() ? nullptr : &root.others;
+    };
+
+    // Õ`FbN|Cgǂ݁Â̂Ȃp
+    std::unique_ptr<CheckpointLog> checkpoint;
+    CheckpointLog::Entries resumed;
+    if (!options.checkpointPath.empty()) {
+        std::string fingerprint;
+        for (const auto& root : roots) {
+            fingerprint += "root " + toUtf8(root.path.native()) + "\n";
+        }
+        for (const auto& rule : options.excludeRules) {
+            fingerprint += "exclude " + rule + "\n";
+        }
+        for (const auto& file : options.excludeFiles) {
+            fingerprint += "exclude-from " + toUtf8(fs::absolute(file).native()) + "\n";
+        }
+        if (CheckpointLog::load(options.checkpointPath, fingerprint, resumed)) {
+            std::cout << "Resuming from checkpoint " << options.checkpointPath.string() << " ("
+                << resumed.size() << " targets)\n";
+        } else {
+            resumed.clear();
+        }
+        checkpoint = std::make_unique<CheckpointLog>();
+        std::string error;
+        if (!checkpoint->create(options.checkpointPath, fingerprint, resumed, error)) {
+            std::cerr << "Cannot write checkpoint: " << error << "\n";
+            return 1;
+        }
+    }
+
+    // CPU ̐̓vZXŜ̂̂Ȃ̂ŁAXbh1̃v[i--workers ΂̐jɂB
+    // x̓[g̃foCXƂɌ߁Av[̑傫 io depth ̏O[v̏ɂ
+    std::map<std::uint64_t, WorkerBudget> deviceBudgets;
+    size_t totalWorkers = options.workers;
+    for (const auto& root : roots) {
+        if (deviceBudgets.count(root.device) == 0) {
+            deviceBudgets[root.device] = detectWorkerBudget(root.device);
+            if (options.workers == 0) {
+                totalWorkers = std::max(totalWorkers, deviceBudgets[root.device].cpuWorkers);
+            }
+        }
+    }
+    std::set<std::uint64_t> shownDevices;
+    for (const auto& root : roots) {
+        if (!shownDevices.insert(root.device).second) {
+            continue;
+        }
+        WorkerBudget& budget = deviceBudgets[root.device];
+        budget.workers = std::min(totalWorkers, budget.ioDepth);
+        std::cout << "Workers: " << budget.workers;
+        if (roots.size() > 1) {
+            std::cout << " for " << root.path.string();
+        }
+        std::cout << " (cpus " << budget.affinityCpus;
+        if (budget.cgroupCpus > 0) {
+            std::cout << ", cpu.max " << std::setprecision(2) << budget.cgroupCpus;
+        }
+        if (budget.ioMaxIops > 0) {
+            std::cout << ", io.max riops " << budget.ioMaxIops;
+        }
+        std::cout << ", io depth " << budget.ioDepth << ")\n";
+    }
+    if (deviceBudgets.size() > 1) {
+        std::cout << "Worker pool: " << totalWorkers << " threads shared by " << deviceBudgets.size()
+            << " devices (" << (options.workers > 0 ? "--workers" : "CPU limit") << ")\n";
+    }
+
+    // 胂[h: v[û݂ŌʂoďI
+    if (options.estimateOnly > 0) {
+        stats.startTime = std::chrono::steady_clock::now();
+        bool probesExited = runProbeEstimation(manager, options.estimateOnly, totalWorkers, stats,
+                                               throttle.get(), options.polite, exclusions, otherRootsOf,
+                                               options.operationTimeout, options.networkOperationTimeout);
+        displayResults(manager, DISPLAY_LIMIT, stats, monitor, ProgressTracker(VolumeUsage()));
+        std::cout << "\nEstimation complete! (" << stats.entries.load()
+            << " entries probed)\n";
+        if (!probesExited || !collectorsExited) {
+            // Ȃv[ũXbh҂Ȃ
+            std::cout.flush();
+            std::_Exit(0);
+        }
+        return 0;
+    }
+
+    // Phase 2: TCYvZ
+
+    auto results = manager.getTopN(manager.totalTargets());  // S^[Qbg擾
+
+    // --early-exit ł͊e^[Qbgg̃t@CVXeŏWvB[gƕʂ̃t@CVXe
+    // ^[QbgiɃ}Egꂽ́j́A[g̎gpʂŏ߂Ȃ̂őł؂̑ΏۊOɂ
+    std::vector<std::uint64_t> targetDevice(manager.totalTargets(), 0);
+    for (const auto& target : results) {
+        std::uint64_t device = deviceIdOf(target.path);
+        monitor.watch(device);
+        targetDevice[target.id] = device;
+        if (options.earlyExit && device != 0 && device != roots[rootOfTarget[target.id]].device) {
+            manager.excludeFromUsageBound(target.id);
+        }
+    }
+    monitor.start(throttle.get(), options.busyThreshold);
+    stats.startTime = std::chrono::steady_clock::now();
+
+    // ԗ\ZsÂ߂ɂ1iŒ1bjǉŎg
+    auto deadline = std::chrono::steady_clock::time_point::max();
+    auto estimateDeadline = deadline;
+    if (options.timeBudget > 0) {
+        auto budgetDuration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(options.timeBudget));
+        deadline = stats.startTime + budgetDuration;
+        estimateDeadline = deadline + std::max<std::chrono::steady_clock::duration>(
+            budgetDuration / 10, std::chrono::seconds(1));
+    }
+
+#ifdef __linux__
+    // [J[ɔj悤Av[ɍ
+    DirectoryHandleCache handles(DirectoryHandleCache::budgetFromLimit(totalWorkers));
+#endif
+    WorkerPool pool(totalWorkers, [&options]() {
+        if (options.polite) {
+            lowerCurrentThreadPriority();
+        }
+    });
+    for (const auto& entry : deviceBudgets) {
+        pool.setGroupLimit(entry.first, entry.second.workers);
+    }
+
+    // 傫ȃ^[QbgvZAN𑁂m肳
+    if (options.largestFirst) {
+        for (auto& target : results) {
+            target.priority = sizeHint(target.path);
+            manager.setPriority(target.id, target.priority);
+        }
+    }
+    // zbgX|bgAXibvVbgA߂ꍇ́AȂ؂B
+    // XibvVbgɂ̓t@C1L^
+    std::unique_ptr<ScanTree> tree;
+    bool keepFiles = !options.savePath.empty() || options.freeze;
+    if (options.hotspotFraction > 0 || options.hotspotBytes > 0 || keepFiles || !options.historyPath.empty()) {
+        tree = std::make_unique<ScanTree>();
+    }
+
+    // \Z𒴂AzbgX|bg◚ɕKvȑ傫̊؂oB
+    // \[vɉA傫ȒfЂȂ[J[Ă
+    std::uintmax_t keepAbove = std::numeric_limits<std::uintmax_t>::max();
+    if (!options.historyPath.empty()) {
+        keepAbove = std::min(keepAbove, options.historyMinBytes);
+    }
+    if (options.hotspotBytes > 0) {
+        keepAbove = std::min(keepAbove, options.hotspotBytes);
+    }
+    const fs::path spillPath = spillFilePath(options);
+    std::atomic<bool> spillFailed{false};
+    auto spillLimit = [&]() {
+        std::uintmax_t limit = keepAbove;
+        if (options.hotspotFraction > 0) {
+            limit = std::min(limit, static_cast<std::uintmax_t>(
+                options.hotspotFraction * static_cast<double>(manager.countedBytes())));
+        }
+        return limit;
+    };
+    auto reportSpillFailure = [&]() {
+        if (!spillFailed.exchange(true)) {
+            std::cerr << "Cannot write spill file " << spillPath.string()
+                << "; dropping per-file detail instead\n";
+        }
+    };
+    auto enforceMemoryBudget = [&]() {
+        if (!tree || options.memoryBudget <= 0) {
+            return;
+        }
+        if (!tree->enforceBudget(options.memoryBudget, spillLimit(), spillPath)) {
+            reportSpillFailure();
+        }
+    };
+
+    HardLinkSet hardLinks;  // gpʂƓ˂킹Ŋ蓖ĂdɐȂ
+
+    // ^[Qbg1̃^XN𓊓Bstart łȂ΁AȂȂ
+    // [J[pTfBNgiƓr܂ł̖؁j̑𑖍
+    HangWatchdog watchdog;
+    std::function<void(size_t, const fs::path&, std::vector<DirectoryWork>, std::shared_ptr<TreeFragment>,
+                       bool, std::chrono::steady_clock::time_point)> scheduleTarget;
+    scheduleTarget = [&](size_t id, const fs::path& path, std::vector<DirectoryWork> start,
+                         std::shared_ptr<TreeFragment> fragment, bool continuation,
+                         std::chrono::steady_clock::time_point startTime) {
+        if (tree && !fragment) {
+            fragment = std::make_shared<TreeFragment>();
+            fragment->keepFiles = keepFiles;
+            if (options.memoryBudget > 0) {
+                fragment->memory = tree->memoryAccount();
+            }
+        }
+        TraversalContext ctx;
+        ctx.deadline = deadline;
+        ctx.stats = &stats;
+        ctx.throttle = throttle.get();
+        ctx.progress = &manager.progressCounter(id);
+        ctx.stop = &manager.stopFlag(id);
+        // ʊmɂł؂͎gpʂrłt@CVXeɌ̂ŁA^[Qbg̉
+        // }Egɂ͍~Ȃi^[Qbgg͕ʂ̃t@CVXeɂĂ悢j
+        const ScanRoot& root = roots[rootOfTarget[id]];
+        if (options.earlyExit) {
+            ctx.stayOnDevice = targetDevice[id] != 0 ? targetDevice[id] : root.device;
+        }
+        // gpʂƓ˂킹i--early-exit Ƌߎ̌덷ĵ߂Ɋ蓖Ă𐔂
+        if (options.earlyExit || pruneBelow > 0) {
+            ctx.allocated = &manager.allocationCounter(id);
+            ctx.allocationDevice = root.device;
+            ctx.hardLinks = &hardLinks;
+        }
+        ctx.otherRoots = otherRootsOf(id);
+        ctx.exclusions = &exclusions;
+        ctx.previous = previous.get();
+        ctx.trustUnchanged = options.trustUnchanged;
+        ctx.pruneBelow = pruneBelow;
+        ctx.stale = &manager.staleCounter(id);
+#ifdef __linux__
+        ctx.handles = &handles;
+#endif
+        if (tree && options.memoryBudget > 0) {
+            // 1̃^[Qbg\Z𒴂Ĉ炽Ȃ悤AɂǂݏI؂o
+            ctx.spillFinished = [&](TreeFragment& fragment, std::vector<DirectoryWork>& pending) {
+                if (!tree->spillFragment(fragment, pending, options.memoryBudget, spillLimit(), spillPath)) {
+                    reportSpillFailure();
+                }
+            };
+        }
+        double priority = continuation ? std::numeric_limits<double>::max() : manager.priorityOf(id);
+        pool.submit(
+            [&manager, &watchdog, &options, &exclusions, &tree, &checkpoint, &enforceMemoryBudget,
+             estimateDeadline, totalWorkers, ctx, id, path, start = std::move(start), fragment = std::move(fragment), continuation, startTime]() mutable {
+                auto state = std::make_shared<TraversalState>();
+                state->targetId = id;
+                state->targetPath = path;
+                state->startTime = continuation ? startTime : std::chrono::steady_clock::now();
+                state->workerIndex = WorkerPool::currentIndex();
+                state->timeout = options.operationTimeout;
+                state->currentDir = path;
+                state->fragment = std::move(fragment);
+                bool resumed = !continuation && !start.empty();  // `FbN|Cg̖ǃfBNgĊJ
+                watchdog.add(state);
+
+                std::uintmax_t size = 0;
+                bool isPartial = continuation;
+                bool isDirectory = continuation;
+                SubtreeEstimate remaining;
+                try {
+                    // ŏ stat lbg[N}Egł͎~܂蓾̂ŊĎōs
+                    state->operationStart = steadyNowNs();
+                    std::error_code ec;
+                    isDirectory = continuation || fs::is_directory(path, ec);
+                    if (isDirectory && !continuation && isNetworkFilesystem(path)) {
+                        state->timeout = options.networkOperationTimeout;
+                    }
+                    ctx.device = ctx.throttle ? deviceIdOf(path) : 0;
+                    if (!isDirectory && !ctx.stopRequested()) {
+                        size = fs::file_size(path, ec);
+                        if (ec) {
+                            ctx.stats->recordError(ec, path);
+                            size = 0;
+                        }
+                    }
+                    state->operationStart = 0;
+                    if (state->abandoned) {
+                        return;
+                    }
+
+                    if (ctx.stopRequested()) {
+                        isPartial = true;
+                    } else if (isDirectory) {
+                        {
+                            std::lock_guard<std::mutex> lock(state->mutex);
+                            if (continuation || resumed) {
+                                state->pending = std::move(start);
+                            } else {
+                                state->pending.push_back(DirectoryWork{
+                                    path, exclusions.stateFor(path), nullptr, 0,
+                                    ctx.previous ? ctx.previous->find(path) : 0 });
+                            }
+                            state->resumable = true;
+                            state->committedBytes = ctx.progress->load();
+                        }
+                        auto traversal = calculateDirectorySizeWithTimeout(*state, ctx);
+                        if (traversal.abandoned) {
+                            return;  // ͈p[J[񍐂
+                        }
+                        // pĊJ̏ꍇ͑Õ[J[iO̎sj̕܂߂vg
+                        size = continuation || resumed ? ctx.progress->load() : traversal.total;
+                        isPartial |= traversal.isPartial;
+                        if (traversal.isPartial && !traversal.frontier.empty()) {
+                            // ̎Ԃ́A܂񍐂ĂȂ^[Qbgŕ
+                            // iɊ}̂g؂Â̂ȂɂȂ̂hj
+                            auto now = std::chrono::steady_clock::now();
+                            auto until = estimateDeadline;
+                            size_t waiting = manager.totalTargets() - manager.completedTargets();
+                            if (estimateDeadline != std::chrono::steady_clock::time_point::max() &&
+                                now < estimateDeadline && waiting > totalWorkers) {
+                                until = now + (estimateDeadline - now) * totalWorkers / waiting;
+                            }
+                            remaining = estimateUnexplored(traversal.frontier, until, ctx, state.get());
+                            if (state->abandoned) {
+                                return;  // p[J[r܂ł̍v񍐂
+                            }
+                        }
+                    }
+                } catch (...) {
+                    state->operationStart = 0;
+                    if (state->abandoned) {
+                        return;
+                    }
+                }
+                // fŎ~܂^[QbǵAǂ̃fBNgcĎɑ
+                if (checkpoint) {
+                    std::uintmax_t committed = 0;
+                    std::vector<fs::path> frontier;
+                    if (!cancelRequested) {
+                        checkpoint->recordTarget(path, size, isPartial);
+                    } else if (state->resumePoint(committed, frontier)) {
+                        checkpoint->recordProgress(path, committed, frontier);
+                    }
+                }
+                watchdog.remove(state.get());
+                auto endTime = std::chrono::steady_clock::now();
+                auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    endTime - state->startTime);
+                if (tree) {
+                    // ̔ɂȂA\[v̏Iɖ؂Ă悤ɂ
+                    if (isDirectory) {
+                        tree->attach(path, *state->fragment, isPartial);
+                        enforceMemoryBudget();
+                    } else {
+                        tree->addFile(path, size, isPartial);
+                    }
+                }
+                manager.update(path, size, isPartial, elapsed, &remaining);
+            }, priority, root.device);
+    };
+
+    // ȂoÃfBNg𓞒Bs\ƂċL^A
+    // cV[J[Ɉp
+    watchdog.start([&](const std::shared_ptr<TraversalState>& state) {
+        std::vector<DirectoryWork> rest;
+        std::shared_ptr<TreeFragment> fragment;
+        fs::path hung;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->abandoned = true;
+            rest = std::move(state->pending);
+            fragment = state->fragment;  // ȍ~Ã[J[͖؂ɏ܂Ȃ
+            hung = state->currentDir;
+        }
+        stats.recordError(ErrorCategory::Timeout, hung);
+        pool.retire(state->workerIndex);
+        scheduleTarget(state->targetId, state->targetPath, std::move(rest), std::move(fragment), true,
+                       state->startTime);
+    });
+
+    size_t resumedTargets = 0;
+    for (const auto& target : results) {
+        std::vector<DirectoryWork> start;
+        auto saved = resumed.find(target.path);
+        if (saved != resumed.end()) {
+            // ẮiƖǂ̃fBNgcĂȂ́j͂̂܂܌ʂɂ
+            const CheckpointLog::Entry& entry = saved->second;
+            resumedTargets++;
+            if (entry.complete || entry.frontier.empty()) {
+                manager.update(target.path, entry.bytes, entry.partial, std::chrono::milliseconds(0));
+                continue;
+            }
+            manager.progressCounter(target.id).store(entry.bytes);
+            for (const auto& dir : entry.frontier) {
+                start.push_back(DirectoryWork{ dir, exclusions.stateFor(dir), nullptr, 0, 0 });
+            }
+        }
+        scheduleTarget(target.id, target.path, std::move(start), nullptr, false,
+                       std::chrono::steady_clock::time_point());
+    }
+    if (resumedTargets > 0) {
+        std::cout << "Resumed " << resumedTargets << " of " << results.size() << " targets from the checkpoint\n";
+    }
+
+    // vZ̃^[Qbg̍ĊJ_A܂R[hƂ܂Ƃ߂ĒǋL
+    auto writeCheckpoint = [&]() {
+        for (const auto& state : watchdog.states()) {
+            std::uintmax_t committed = 0;
+            std::vector<fs::path> frontier;
+            if (state->resumePoint(committed, frontier)) {
+                checkpoint->recordProgress(state->targetPath, committed, frontier);
+            }
+        }
+        if (!checkpoint->flush()) {
+            std::cerr << "Cannot write checkpoint " << options.checkpointPath.string() << "\n";
+        }
+    };
+    const auto CHECKPOINT_INTERVAL = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(options.checkpointInterval));
+    auto lastCheckpoint = std::chrono::steady_clock::now();
+
+    // Phase 3: ʕ\[v
+    const auto STABILITY_INTERVAL = std::chrono::milliseconds(100);
+    RankingStabilityTracker stability;
+    ProgressTracker progress(combinedVolumeUsage(roots));
+    auto lastUpdate = std::chrono::steady_clock::now();
+    auto lastStabilityCheck = lastUpdate;
+    bool limitReached = false;
+    while (!manager.isComplete() && !cancelRequested) {
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastStabilityCheck >= STABILITY_INTERVAL) {
+            stability.observe(manager.getTopN(DISPLAY_LIMIT), now);
+            if (options.maxBytes > 0 && manager.countedBytes() >= options.maxBytes) {
+                limitReached = true;
+                cancelRequested = true;
+            }
+            if (options.earlyExit) {
+                VolumeUsage usage = combinedVolumeUsage(roots);
+                if (usage.valid) {
+                    manager.applyUsageBound(usage.usedBytes, DISPLAY_LIMIT);
+                }
+            }
+            enforceMemoryBudget();
+            lastStabilityCheck = now;
+        }
+        if (checkpoint && now - lastCheckpoint >= CHECKPOINT_INTERVAL) {
+            writeCheckpoint();
+            lastCheckpoint = now;
+        }
+        if (now - lastUpdate >= DISPLAY_INTERVAL) {
+            progress.sample(manager.countedBytes(), stats.entries.load(std::memory_order_relaxed), now);
+            displayResults(manager, DISPLAY_LIMIT, stats, monitor, progress);
+            lastUpdate = now;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    // f͌vZ̃^[Qbgr܂ł̍vŊm肳
+    bool interrupted = cancelRequested;
+    if (interrupted) {
+        manager.finalizeIncomplete();
+    }
+    auto endTime = std::chrono::steady_clock::now();
+    stability.observe(manager.getTopN(DISPLAY_LIMIT), endTime);
+
+    // ŏIʕ\
+    progress.sample(manager.countedBytes(), stats.entries.load(std::memory_order_relaxed), endTime);
+    displayResults(manager, DISPLAY_LIMIT, stats, monitor, progress);
+    monitor.stop();
+    if (interrupted) {
+        std::cout << "\n" << (limitReached ? "Size limit reached" : "Interrupted")
+            << ": partial results (sizes marked + are incomplete)\n";
+    } else {
+        std::cout << "\nAnalysis complete!\n";
+    }
+    std::cout << "Scanned " << stats.entries.load() << " entries ("
+        << std::fixed << std::setprecision(0) << stats.entriesPerSecond()
+        << " entries/s)";
+    double utilization = 0, busyRatio = 0;
+    if (monitor.summary(utilization, busyRatio)) {
+        std::cout << ", device busy " << std::setprecision(1) << busyRatio * 100 << "% of scan time";
+    }
+    std::cout << "\n";
+    std::cout << "Time to stable top " << DISPLAY_LIMIT << ": " << std::setprecision(2)
+        << std::chrono::duration<double>(stability.lastChangeTime() - stats.startTime).count()
+        << " sec (total " << std::chrono::duration<double>(endTime - stats.startTime).count()
+        << " sec)\n";
+#ifdef __linux__
+    auto handleStats = handles.statistics();
+    if (handleStats.opened > 0) {
+        std::cout << "Directory handles: " << handleStats.opened << " opened, "
+            << std::setprecision(1)
+            << 100.0 * static_cast<double>(handleStats.relative) / static_cast<double>(handleStats.opened)
+            << "% relative to an open parent, " << handleStats.reopened << " reopened after eviction, peak "
+            << handleStats.peak << " of " << handleStats.budget << " fds\n";
+    }
+#endif
+
+    if (previous) {
+        std::uint64_t reused = stats.reusedDirectories.load();
+        std::uint64_t reread = stats.rereadDirectories.load();
+        std::cout << "Incremental: " << reused << " of " << reused + reread
+            << " directories unchanged since the snapshot (" << std::setprecision(1)
+            << (reused + reread > 0 ? 100.0 * static_cast<double>(reused) / static_cast<double>(reused + reread) : 0.0)
+            << "%), " << reread << " re-read; " << stats.reusedFiles.load() << " known files "
+            << (options.trustUnchanged ? "trusted" : "re-checked") << " ("
+            << std::setprecision(2) << toGB(stats.reusedBytes.load()) << " GB)\n";
+        if (pruneBelow > 0) {
+            printApproximation(manager, stats, *previous, pruneBelow, combinedVolumeUsage(roots), DISPLAY_LIMIT);
+        }
+    }
+    if (options.memoryBudget > 0) {
+        const double MB = 1024.0 * 1024.0;
+        std::cout << "Memory: ";
+        if (tree) {
+            enforceMemoryBudget();
+            auto memory = tree->memoryStatistics();
+            std::cout << "tree peak " << std::setprecision(1) << static_cast<double>(memory.peakBytes) / MB
+                << " MB of budget " << static_cast<double>(options.memoryBudget) / MB << " MB; spilled "
+                << memory.spilledSubtrees << " subtrees (" << memory.spilledNodes << " nodes, "
+                << static_cast<double>(memory.spillFileBytes) / MB << " MB spill file); file detail "
+                << (memory.filesDropped ? "dropped" : "kept") << "; ";
+        }
+        std::uint64_t peak = peakResidentBytes();
+        if (peak > 0) {
+            std::cout << "peak RSS " << std::setprecision(1) << static_cast<double>(peak) / MB << " MB";
+        }
+        std::cout << "\n";
+    }
+    if (tree && !options.savePath.empty()) {
+        std::string error;
+        if (tree->save(options.savePath, scanFingerprint, error)) {
+            std::cout << "Snapshot saved to " << options.savePath.string() << " (" << tree->size() << " nodes"
+                << (interrupted ? ", completed targets only" : "") << ")\n";
+        } else {
+            std::cerr << "Cannot save snapshot: " << error << "\n";
+        }
+    }
+    if (tree && !options.historyPath.empty()) {
+        SizeHistory history;
+        std::string error;
+        if (interrupted) {
+            std::cout << "History not updated: the scan did not complete\n";
+        } else if (!history.load(options.historyPath, error)) {
+            std::cerr << error << "\n";
+        } else {
+            std::vector<std::pair<std::string, std::uintmax_t>> directories;
+            for (const auto& directory : tree->largeDirectories(options.historyMinBytes)) {
+                directories.emplace_back(toUtf8(directory.first.native()), directory.second);
+            }
+            VolumeUsage usage = combinedVolumeUsage(roots);
+            std::int64_t now = static_cast<std::int64_t>(std::time(nullptr));
+            size_t recordBytes = 0;
+            if (history.append(options.historyPath, now, usage.usedBytes, usage.totalBytes, directories,
+                               recordBytes, error)) {
+                std::cout << "History: scan " << history.scanCount() << " appended to "
+                    << options.historyPath.string() << " (" << recordBytes << " bytes for "
+                    << directories.size() << " directories; history " << std::setprecision(1)
+                    << static_cast<double>(history.fileBytes()) / 1024.0 << " KB)\n";
+            } else {
+                std::cerr << "Cannot update history: " << error << "\n";
+            }
+        }
+    }
+    if (tree && (options.hotspotFraction > 0 || options.hotspotBytes > 0)) {
+        std::uintmax_t total = 0, explained = 0;
+        auto hotspots = tree->hotspots(options.hotspotFraction, options.hotspotBytes, total, explained);
+        printHotspots(hotspots, options, total, explained, tree->directories(), interrupted);
+    }
+    if (tree && options.freeze) {
+        tree->inspect([&](const ScanTree& mutableTree) {
+            FrozenTree frozen;
+            auto freezeStart = std::chrono::steady_clock::now();
+            if (!frozen.build(mutableTree)) {
+                std::cerr << "Cannot freeze the tree: too many nodes\n";
+                return;
+            }
+            double freezeTime = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - freezeStart).count();
+            printFreezeReport(frozen, freezeTime, mutableTree, "mutable tree",
+                              static_cast<std::uint64_t>(mutableTree.memoryBytes()), DISPLAY_LIMIT);
+        });
+    }
+    // ؂̔zuy[Wł̏WvƖ₢킹̎ԁB--huge-pages off ̎sƔׂ
+    if (tree && options.hugePageReport) {
+        TlbMissCounter counter;
+        double rollUpTime = measureMilliseconds([&] { tree->recomputeTotals(); });
+        counter.start();
+        tree->recomputeTotals();
+        std::uint64_t rollUpMisses = counter.stop();
+        double queryTime = 0;
+        std::uint64_t queryMisses = 0;
+        tree->inspect([&](const ScanTree& scanned) {
+            auto query = [&] {
+                std::uintmax_t total = 0, explained = 0;
+                return largestDirectories(scanned, DISPLAY_LIMIT).size() +
+                    findHotspots(scanned, 0.01, 0, total, explained).size();
+            };
+            queryTime = measureMilliseconds(query);
+            counter.start();
+            query();
+            queryMisses = counter.stop();
+        });
+        const double MB = 1024.0 * 1024.0;
+        auto arena = HugePageArena::statistics();
+        const char* modes[] = { "off", "transparent", "explicit" };
+        std::cout << "Huge pages (" << modes[static_cast<int>(options.hugePages)] << "): "
+            << std::setprecision(1) << static_cast<double>(arena.bytes) / MB << " MB of tree arrays in "
+            << arena.regions << " regions";
+        if (options.hugePages == HugePageMode::Explicit) {
+            std::cout << " (" << arena.explicitRegions << " reserved, " << arena.fallbacks << " fell back)";
+        }
+        std::uint64_t anonymousHuge = anonymousHugePageBytes();
+        if (anonymousHuge > 0) {
+            std::cout << ", " << static_cast<double>(anonymousHuge) / MB << " MB of the process on huge pages";
+        }
+        std::cout << "\n  rollup " << std::setprecision(3) << rollUpTime << " ms, top " << DISPLAY_LIMIT
+            << " + hotspots " << queryTime << " ms";
+        if (counter.valid()) {
+            std::cout << "; dTLB load misses " << rollUpMisses << " (rollup), " << queryMisses << " (queries)";
+        } else {
+            std::cout << "; dTLB counters unavailable";
+        }
+        std::cout << "\n";
+    }
+
+    // ǂݔ΂Gg𕪗ނƂɌƗŎ
+    watchdog.stop();
+    for (size_t c = 0; c < ScanStats::CATEGORY_COUNT; ++c) {
+        auto category = static_cast<ErrorCategory>(c);
+        std::uint64_t count = stats.errorCount(category);
+        if (count == 0) {
+            continue;
+        }
+        std::cout << "Skipped (" << errorCategoryName(category) << "): " << count << "\n";
+        for (const auto& p : stats.errorPaths(category)) {
+            std::cout << "  " << p.string() << "\n";
+        }
+    }
+
+    // Ȃ[J[ĂI҂Ȃ
+    int exitCode = interrupted && !limitReached ? 130 : 0;
+    bool workersExited = pool.shutdown(std::chrono::milliseconds(200));
+    if (checkpoint) {
+        if (interrupted) {
+            // ~܂[J[̕܂߂ďA͂ĊJ
+            writeCheckpoint();
+            std::cout << "Checkpoint saved to " << options.checkpointPath.string()
+                << "; run again with the same options to resume\n";
+        } else {
+            checkpoint->discard(options.checkpointPath);
+        }
+        double scanSeconds = std::chrono::duration<double>(endTime - stats.startTime).count();
+        double writeSeconds = std::chrono::duration<double>(checkpoint->totalWriteTime()).count();
+        std::cout << "Checkpoints: " << checkpoint->flushCount() << " written, " << std::setprecision(1)
+            << static_cast<double>(checkpoint->bytesWritten()) / 1024.0 << " KB, "
+            << writeSeconds * 1000 << " ms (" << std::setprecision(2)
+            << (scanSeconds > 0 ? 100.0 * writeSeconds / scanSeconds : 0.0) << "% of scan time)\n";
+    }
+    if (!workersExited || !collectorsExited) {
+        if (tree) {
+            tree->removeSpillFile();
+        }
+        std::cout.flush();
+        std::_Exit(exitCode);
+    }
+    return exitCode;
 }
\ No newline at end of file